@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "runtime/alloc.h"
+#include "runtime/arena.h"
+
+// Measures the cost of address translation on a heap allocated in an arena, in
+// order to compare the page sizes selected with the KLLVM_HUGE_PAGES
+// environment variable (cf runtime/alloc/arena.cpp). It allocates a heap of
+// nodes linked in a random order, then times a traversal following the links,
+// which misses the TLB on nearly every node with base pages, and a sequential
+// scan of the blocks of the arena, as done by the garbage collector.
+//
+// The page size is fixed when the runtime starts, so unless KLLVM_HUGE_PAGES
+// is set, the benchmark runs itself once per mode (none, thp and 2mb) with the
+// same block size, and reports the fastest of several runs of each mode side
+// by side. The block size is KLLVM_BLOCK_SIZE if set, and otherwise 2MB, the
+// smallest block size that hugetlbfs pages support. A mode whose pages cannot
+// be mapped, e.g. 2mb without reserved huge pages, is reported as
+// unavailable. For example:
+//
+//   ./arena-benchmark 1024 5
+//   KLLVM_HUGE_PAGES=thp perf stat -e dTLB-load-misses ./arena-benchmark 1024
+//
+// The arguments are the size of the heap in megabytes (default 512) and the
+// number of runs of each mode (default 3).
+
+REGISTER_ARENA(benchmark_arena, 0);
+
+struct node {
+  node *next;
+  uint64_t payload[3];
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+struct timings {
+  double alloc;
+  double chase;
+  double scan;
+};
+
+// Runs the benchmark once on the page size and geometry of the current process.
+static timings run(size_t count) {
+  timings result;
+  auto start = bench_clock::now();
+  std::vector<node *> nodes(count);
+  for (size_t i = 0; i < count; i++) {
+    nodes[i] = (node *)arenaAlloc(&benchmark_arena, sizeof(node));
+    nodes[i]->payload[0] = i;
+  }
+  result.alloc = seconds_since(start);
+
+  std::mt19937_64 rng(0);
+  std::shuffle(nodes.begin(), nodes.end(), rng);
+  for (size_t i = 0; i < count; i++) {
+    nodes[i]->next = nodes[(i + 1) % count];
+  }
+  node *first = nodes[0];
+  nodes.clear();
+  nodes.shrink_to_fit();
+
+  start = bench_clock::now();
+  uint64_t sum = 0;
+  node *curr = first;
+  for (size_t i = 0; i < count; i++) {
+    sum += curr->payload[0];
+    curr = curr->next;
+  }
+  result.chase = seconds_since(start);
+
+  start = bench_clock::now();
+  char *end = *arenaEndPtr(&benchmark_arena);
+  for (char *block = benchmark_arena.first_block; block; block = ((memory_block_header *)block)->next_block) {
+    char *scan = block + sizeof(memory_block_header);
+    while (scan + sizeof(node) <= block + BLOCK_SIZE && scan != end) {
+      sum += ((node *)scan)->payload[0];
+      scan += sizeof(node);
+    }
+    if (scan == end) {
+      break;
+    }
+  }
+  result.scan = seconds_since(start);
+  // keeps the traversals from being optimized away
+  if (sum == 0) {
+    result.scan = -1;
+  }
+  return result;
+}
+
+// Runs the benchmark in a new process with KLLVM_HUGE_PAGES set to mode, and
+// reads its timings from a pipe. Returns false if the process failed.
+static bool run_mode(char **argv, const char *mode, timings *result) {
+  int fds[2];
+  if (pipe(fds)) {
+    perror("pipe");
+    exit(1);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    setenv("KLLVM_HUGE_PAGES", mode, 1);
+    setenv("KLLVM_ARENA_BENCHMARK_RAW", "1", 1);
+    execv("/proc/self/exe", argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  FILE *out = fdopen(fds[0], "r");
+  int read = fscanf(out, "%lf %lf %lf", &result->alloc, &result->chase, &result->scan);
+  fclose(out);
+  int status;
+  waitpid(pid, &status, 0);
+  return read == 3 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 512;
+  size_t runs = argc > 2 ? strtoull(argv[2], nullptr, 10) : 3;
+  size_t count = megabytes * 1024 * 1024 / sizeof(node);
+
+  if (getenv("KLLVM_ARENA_BENCHMARK_RAW")) {
+    timings result = run(count);
+    printf("%f %f %f\n", result.alloc, result.chase, result.scan);
+    return result.scan < 0;
+  }
+  if (const char *mode = getenv("KLLVM_HUGE_PAGES")) {
+    timings result = run(count);
+    printf("pages: %s, block size: %zu bytes, heap: %zu MB, blocks: %zu\n",
+           mode, BLOCK_SIZE, megabytes, arenaBlocksUsed(&benchmark_arena));
+    printf("allocation: %.3fs\npointer chasing: %.3fs (%.1fns per node)\nscan: %.3fs\n",
+           result.alloc, result.chase, result.chase * 1e9 / count, result.scan);
+    return result.scan < 0;
+  }
+
+  if (!getenv("KLLVM_BLOCK_SIZE")) {
+    setenv("KLLVM_BLOCK_SIZE", "2097152", 1);
+  }
+  printf("block size: %s bytes, heap: %zu MB, fastest of %zu runs\n",
+         getenv("KLLVM_BLOCK_SIZE"), megabytes, runs);
+  printf("%-6s %14s %24s %10s\n", "pages", "allocation", "pointer chasing", "scan");
+  const char *modes[] = {"none", "thp", "2mb"};
+  for (const char *mode : modes) {
+    timings best;
+    bool available = false;
+    for (size_t i = 0; i < runs; i++) {
+      timings result;
+      if (!run_mode(argv, mode, &result)) {
+        available = false;
+        break;
+      }
+      if (!available) {
+        best = result;
+        available = true;
+      } else {
+        best.alloc = std::min(best.alloc, result.alloc);
+        best.chase = std::min(best.chase, result.chase);
+        best.scan = std::min(best.scan, result.scan);
+      }
+    }
+    if (available) {
+      printf("%-6s %13.3fs %11.3fs (%5.1fns/node) %9.3fs\n",
+             mode, best.alloc, best.chase, best.chase * 1e9 / count, best.scan);
+    } else {
+      printf("%-6s %14s\n", mode, "unavailable");
+    }
+  }
+  return 0;
+}
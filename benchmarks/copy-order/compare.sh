@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Compares the running time of the mutator of interpreters whose heap is copied
+# in breadth-first and in depth-first order by the garbage collector, cf
+# KLLVM_GC_COPY_ORDER in runtime/collect/collect.cpp. The mutator traverses
+# terms whose subterms are closer to them in the depth-first order, while the
+# collections themselves may take longer in that order, so the two are
+# reported separately: the time of the collections is the sum of the pauses
+# recorded in the KLLVM_GC_STATS file of each run, cf
+# runtime/collect/telemetry.cpp, and the time of the mutator is the rest of
+# the run time recorded there.
+#
+# By default, the interpreters of test/defn built by running make in test/ are
+# run on their inputs from test/input, with the matching .stdin.txt file, if
+# any, as their standard input. For example:
+#
+#   make -C test all
+#   benchmarks/copy-order/compare.sh
+#   benchmarks/copy-order/compare.sh test/int/imp.interpreter test/input/imp.in.kore
+#
+# Each program is run $RUNS times (default 5) in each order, and the fastest
+# run is reported. The exit code of the programs is ignored, since it is the
+# result of the program, but a run which does not record its total run time,
+# e.g. because it crashed, is reported as failed. Programs which do not run
+# long enough to collect garbage a few times show no difference.
+
+root="$(dirname "$0")/../.."
+runs=${RUNS:-5}
+stats=$(mktemp)
+trap 'rm -f "$stats"' EXIT
+
+# Prints the mutator and collector times in seconds of the run whose mutator
+# was fastest, or nothing if every run failed.
+best_time() {
+  local order="$1" interpreter="$2" input="$3" stdin="$4" best=
+  for ((i = 0; i < runs; i++)); do
+    local times
+    KLLVM_GC_STATS="$stats" KLLVM_GC_COPY_ORDER="$order" "$interpreter" "$input" -1 /dev/null < "$stdin"
+    times=$(awk -F, '
+      /^# total_ns=/ { split($0, total, "="); done = 1 }
+      NR > 1 && !/^#/ { gc += $2 }
+      END { if (done) printf "%.6f %.6f\n", (total[2] - gc) / 1e9, gc / 1e9 }' "$stats")
+    if [ -n "$times" ] && { [ -z "$best" ] || awk "BEGIN { exit !(${times% *} < ${best% *}) }"; }; then
+      best=$times
+    fi
+  done
+  echo "$best"
+}
+
+compare() {
+  local interpreter="$1" input="$2" stdin="$3"
+  local bfs dfs
+  bfs=$(best_time breadth-first "$interpreter" "$input" "$stdin")
+  dfs=$(best_time depth-first "$interpreter" "$input" "$stdin")
+  if [ -z "$bfs" ] || [ -z "$dfs" ]; then
+    printf "%-40s failed\n" "$(basename "$input")"
+    return
+  fi
+  set -- $bfs $dfs
+  printf "%-40s %10.3f %10.3f %8.2fx %10.3f %10.3f\n" "$(basename "$input")" "$1" "$3" \
+    "$(awk "BEGIN { print $1 / $3 }")" "$2" "$4"
+}
+
+printf "%-40s %10s %10s %9s %10s %10s\n" input "mutator bf" "mutator df" speedup "gc bf" "gc df"
+if [ $# -ge 2 ]; then
+  compare "$1" "$2" "${3:-/dev/null}"
+else
+  for interpreter in "$root"/test/int/*.interpreter; do
+    name=$(basename "$interpreter" .interpreter)
+    input="$root/test/input/$name.in.kore"
+    stdin="$root/test/input/$name.stdin.txt"
+    if [ ! -f "$stdin" ]; then
+      stdin=/dev/null
+    fi
+    if [ -f "$input" ]; then
+      compare "$interpreter" "$input" "$stdin"
+    fi
+  done
+fi
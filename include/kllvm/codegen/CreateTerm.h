@@ -3,11 +3,14 @@
 
 #include "kllvm/ast/AST.h"
 #include "kllvm/codegen/DecisionParser.h"
+#include "kllvm/codegen/GCFrame.h"
 
 #include "llvm/ADT/StringMap.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
 
+#include <set>
+
 namespace kllvm {
 
 class CreateTerm {
@@ -18,7 +21,12 @@ private:
   llvm::Module *Module;
   llvm::LLVMContext &Ctx;
   bool isAnywhereOwise;
+  GCFrame *Frame;
+  llvm::StringMap<llvm::Value *> RootedVariables;
+  llvm::Value *Reserved;
 
+  bool mayCollect(KOREPattern *pattern);
+  bool allocatedSize(KOREPattern *pattern, uint64_t &size, unsigned &blocks);
   llvm::Value *createHook(KORECompositePattern *hookAtt, KORECompositePattern *pattern);
   llvm::Value *createFunctionCall(std::string name, KORECompositePattern *pattern, bool sret, bool fastcc);
   llvm::Value *notInjectionCase(KORECompositePattern *constructor, llvm::Value *val);
@@ -34,12 +42,26 @@ public:
       CurrentBlock(EntryBlock),
       Module(Module),
       Ctx(Module->getContext()),
-      isAnywhereOwise(isAnywhereOwise) {}
+      isAnywhereOwise(isAnywhereOwise),
+      Frame(nullptr),
+      Reserved(nullptr) {}
 
 /* adds code to the specified basic block in the specified module which constructs
    an llvm value corresponding to the specified KORE RHS pattern and substitution in the
    specified definition, and returns the value itself, along with a boolean indicating whether the resulting term could be an injection. */
   std::pair<llvm::Value *, bool> operator()(KOREPattern *pattern);
+  /* constructs the values of the specified patterns in order, except for the first one if first is
+     not null, in which case it is its value. If a frame is set, the values which would otherwise be
+     held across a call which may run the garbage collector are kept in the frame instead. */
+  std::vector<llvm::Value *> createTerms(const std::vector<KOREPattern *> &patterns, llvm::Value *first = nullptr);
+  /* keeps terms held across calls in the specified frame. Variables of the substitution holding
+     terms must be moved to the frame with rootVariable. */
+  void setFrame(GCFrame *frame) { Frame = frame; }
+  /* moves the value of the specified variable of the substitution to a new root of the frame,
+     from which it is loaded at each use, if it is a term. */
+  void rootVariable(std::string name);
+  /* specifies that the value of the specified variable is held in the specified root of the frame. */
+  void rootVariable(std::string name, llvm::Value *slot) { RootedVariables[name] = slot; }
   llvm::Value *createToken(ValueType sort, std::string contents);
   /* creates a call instructin calling a particular llvm function, abstracting certain abi and calling convention details. 
    * name: the nmae of the function to call in llvm
@@ -62,9 +84,33 @@ public:
 std::unique_ptr<llvm::Module> newModule(std::string name, llvm::LLVMContext &Context);
 void addKompiledDirSymbol(llvm::LLVMContext &Context, std::string dir, llvm::Module *mod);
 
+/* if true, every block of a symbol with arguments ends with a word holding a lazily computed
+   hash of the term it represents, and zero until that hash has been computed. */
+extern bool CACHE_TERM_HASHES;
+/* if true, every block constructed on the right hand side of a rule is replaced by the
+   canonical block structurally equal to it. cf hash_cons in runtime/collect/hash_cons.cpp */
+extern bool HASH_CONS_TERMS;
+/* if true, functions keep the terms they hold across calls in a frame of the shadow stack
+   (cf GCFrame), and the evaluation of a function may run the garbage collector. */
+extern bool GC_SAFEPOINTS;
+/* if true, every block constructed on the right hand side of a rule records its allocation
+   site, and the number of blocks of each site promoted to the old generation is written out
+   at exit. cf runtime/collect/pretenure.cpp */
+extern bool PROFILE_ALLOCATION_SITES;
+/* the allocation sites whose blocks are allocated directly in the old generation. */
+extern std::set<std::string> PRETENURED_SITES;
+/* adds the sites of the specified profile written by a program kompiled with
+   PROFILE_ALLOCATION_SITES whose blocks are almost always promoted to PRETENURED_SITES. */
+void loadPretenuringProfile(std::string filename);
+
 llvm::StructType *getBlockType(llvm::Module *Module, KOREDefinition *definition, const KORESymbol *symbol);
+/* adds code to the specified basic block which marks the cached hash of a newly allocated block
+   as not yet computed. Does nothing unless CACHE_TERM_HASHES is set. */
+void clearCachedHash(llvm::StructType *BlockType, llvm::Value *Block, llvm::BasicBlock *block);
+/* returns the header of a block of the specified symbol, which is allocated in the old
+   generation if old is true. */
 llvm::Value *getBlockHeader(llvm::Module *Module, KOREDefinition *definition,
-    const KORESymbol *symbol, llvm::Type *BlockType);
+    const KORESymbol *symbol, llvm::Type *BlockType, bool old = false);
 
 /* returns the llvm::Type corresponding to the type of the result of calling createTerm
    on the specified pattern. */
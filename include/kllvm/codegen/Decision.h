@@ -9,6 +9,7 @@
 #include "llvm/IR/Value.h"
 
 #include "kllvm/codegen/DecisionParser.h"
+#include "kllvm/codegen/GCFrame.h"
 
 #include <unordered_set>
 
@@ -332,12 +333,14 @@ private:
   ValueType Cat;
   llvm::PHINode *FailSubject, *FailPattern, *FailSort;
   llvm::Value *ResultBuffer, *ResultCount, *ResultCapacity;
+  GCFrame *Frame;
 
-  std::map<var_type, llvm::AllocaInst *> symbols;
+  std::map<var_type, llvm::Value *> symbols;
 
   llvm::Value *getTag(llvm::Value *);
 
-  llvm::AllocaInst *decl(var_type name);
+  llvm::Value *decl(var_type name);
+  llvm::Value *root(var_type name);
 
   llvm::Constant *stringLiteral(std::string name);
   llvm::Value *ptrTerm(llvm::Value *val);
@@ -373,7 +376,8 @@ public:
       FailSort(FailSort),
       ResultBuffer(ResultBuffer),
       ResultCount(ResultCount),
-      ResultCapacity(ResultCapacity)
+      ResultCapacity(ResultCapacity),
+      Frame(nullptr)
        {}
 
   /* adds code to the specified basic block to take a single step based on
@@ -381,6 +385,11 @@ public:
   void operator()(DecisionNode *entry);
   void store(var_type name, llvm::Value *val);
   llvm::Value *load(var_type name);
+  /* adds code to the specified basic block which loads the value of the specified variable. */
+  llvm::Value *load(var_type name, llvm::BasicBlock *block);
+  /* keeps the variables holding terms in the specified frame. Must be set before any variable
+     is stored to. */
+  void setFrame(GCFrame *frame) { Frame = frame; }
 
   friend class SwitchNode;
   friend class MakePatternNode;
@@ -400,6 +409,10 @@ void makeAnywhereFunction(KORESymbol *function, KOREDefinition *definition, llvm
 void makeStepFunction(KOREDefinition *definition, llvm::Module *module, DecisionNode *dt, bool search);
 void makeStepFunction(KOREAxiomDeclaration *axiom, KOREDefinition *definition, llvm::Module *module, PartialStep res);
 void makeMatchReasonFunction(KOREDefinition *definition, llvm::Module *module, KOREAxiomDeclaration *axiom, DecisionNode *dt);
+/* generates the function match_search_goal, which logs whether the configuration
+   passed to it matches the search goal compiled into the specified decision
+   tree, like the match_N functions log whether it matches rule N. */
+void makeSearchGoalFunction(KOREDefinition *definition, llvm::Module *module, DecisionNode *dt);
 
 }
 #endif // DECISION_H
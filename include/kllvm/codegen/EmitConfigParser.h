@@ -5,10 +5,41 @@
 
 #include "llvm/IR/Module.h"
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 namespace kllvm {
 
 void emitConfigParserFunctions(KOREDefinition *definition, llvm::Module *module);
 
+/* bounds the search for the displacements of a name table of n keys to
+   NAME_TABLE_ATTEMPTS_PER_KEY * n + NAME_TABLE_MIN_ATTEMPTS attempts. */
+const uint64_t NAME_TABLE_ATTEMPTS_PER_KEY = 1024;
+const uint64_t NAME_TABLE_MIN_ATTEMPTS = 1 << 20;
+
+/* computes a minimal perfect hash of the keys with the specified hashes (cf
+   runtime/name_table.h): the keys are distributed into nbuckets buckets, which
+   are placed largest first by searching for a displacement that sends each of
+   their keys to a distinct free slot. On success, stores the displacement of
+   each bucket and the index of the key of each slot. Fails if two keys have the
+   same hash or if no displacements were found within maxAttempts attempts. */
+bool buildNameTable(const std::vector<uint64_t> &hashes, uint64_t nbuckets, uint64_t maxAttempts, std::vector<uint32_t> &displacements, std::vector<int64_t> &slots);
+
+struct NameTableEntry {
+  std::string name;
+  llvm::Constant *ptr;
+  uint32_t value;
+};
+
+/* emits a global of type %name_table mapping the name of each entry to its
+   value, to be queried at runtime with lookupNameTable (cf
+   runtime/name_table.h). The ptr of each entry, a pointer to its name, is
+   stored as its key. If buildNameTable finds no perfect hash within
+   maxAttempts attempts, the table has no buckets and its keys are searched one
+   by one. */
+llvm::Constant *emitNameTable(std::string name, const std::vector<NameTableEntry> &entries, llvm::Module *module, uint64_t maxAttempts);
+
 }
 
 #endif // EMIT_CONFIG_PARSER_H 
@@ -0,0 +1,72 @@
+#ifndef GC_FRAME_H
+#define GC_FRAME_H
+
+#include "kllvm/ast/AST.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#include <vector>
+
+namespace kllvm {
+
+/* A frame of the shadow stack, holding the roots of the garbage collector live
+   in one invocation of a function. The frame is pushed in the entry block of
+   the function and popped before each of its returns. Since the frame lives in
+   memory managed by the runtime rather than on the stack, functions with a
+   frame can still make tail calls: the frame is popped before a call in tail
+   position rather than after it.
+
+   A frame which is not safe inhibits collection at safepoints for as long as
+   it is on the shadow stack. A safe frame can instead inhibit collection over
+   a span of its function, from a call to beginUnsafe until a call to
+   endUnsafe or the return of the function. Functions holding pointers the
+   collector does not know about across calls (e.g. map iterators) must do so
+   in an unsafe frame or span. */
+class GCFrame {
+private:
+  llvm::Function *Function;
+  llvm::Module *Module;
+  llvm::LLVMContext &Ctx;
+  bool Safe;
+  llvm::Instruction *Frame;
+  llvm::Instruction *Prologue;
+  llvm::Value *Live;
+  std::vector<ValueType> Roots;
+  std::vector<llvm::Value *> Slots;
+
+  llvm::Value *address(uint64_t offset, llvm::Type *Type);
+  template <typename Position>
+  void setUnsafe(bool unsafe, Position pos);
+
+public:
+  GCFrame(llvm::Function *Function, bool Safe = true);
+
+  /* returns the address of a new root of the frame, which holds a value of
+     type Type of the specified category and is null until it is stored to. */
+  llvm::Value *slot(ValueType cat, llvm::Type *Type);
+  /* returns the address of memory in the frame holding a value of type Type,
+     which the collector does not scan. A collection stored there can be
+     rooted by storing its address in a slot. */
+  llvm::Value *storage(llvm::Type *Type);
+  /* adds code to the end of the specified basic block which begins or ends
+     the unsafe span of the function. Beginning a span which is already live
+     and ending one which is not have no effect. */
+  void beginUnsafe(llvm::BasicBlock *block);
+  void endUnsafe(llvm::BasicBlock *block);
+  /* adds code to the specified basic block at which the garbage collector
+     runs if the young generation is full. */
+  void safepoint(llvm::BasicBlock *block);
+  /* adds the code pushing and popping the frame. Must be called once the
+     function is complete. */
+  void finalize();
+
+  /* returns true and sets cat if values of the specified type are pointers to
+     terms which must be kept in a frame. */
+  static bool isRoot(llvm::Module *Module, llvm::Type *Type, ValueType &cat);
+};
+
+}
+
+#endif // GC_FRAME_H
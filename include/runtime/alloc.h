@@ -5,15 +5,43 @@ extern "C" {
 
 // The maximum single allocation size in bytes.
 // A contiguous area larger than that size cannot be allocated in any arena.
-extern const size_t BLOCK_SIZE;
+// Configured once at startup, cf initArenaGeometry in runtime/alloc/arena.cpp
+extern size_t BLOCK_SIZE;
 
 #define YOUNGSPACE_ID 0
 #define OLDSPACE_ID 1
+#define STATICSPACE_ID 2
 #define ALWAYSGCSPACE_ID 3
+#define SEARCHSPACE_ID 4
+
+// Each thread has a heap of its own: the arenas below, its large objects, and
+// the state of its garbage collector are thread-local, so that several threads
+// can rewrite independent configurations at once. The heap of a thread is
+// freed when the thread exits, and its blocks are reused by the heaps of other
+// threads, cf arenaFree. Terms must not be shared between threads, except for
+// the static objects of initStaticObjects and the terms allocated between
+// koreAllocSearchBegin and koreAllocSearchEnd.
+
+// The arena of the young generation. Generated code allocates terms into it
+// without calling into the runtime, cf allocateTerm in
+// lib/codegen/CreateTerm.cpp.
+extern thread_local struct arena youngspace;
+
+// The arenas of the heap of a thread.
+typedef struct {
+  struct arena *youngspace;
+  struct arena *oldspace;
+} kore_heap;
+
+// Returns the heap of the current thread, or during a parallel collection, the
+// heap being collected. cf koreAllocGCBegin
+kore_heap koreCurrentHeap(void);
 
 char youngspace_collection_id(void);
 char oldspace_collection_id(void);
 size_t youngspace_size(void);
+// the number of bytes allocated in the young generation since the last collection
+size_t youngspace_used(void);
 
 // allocates exactly requested bytes into the young generation
 void* koreAlloc(size_t requested);
@@ -31,7 +59,44 @@ void* koreAllocTokenOld(size_t requested);
 void* koreAllocAlwaysGC(size_t requested);
 // swaps the two semispace of the young generation as part of garbage collection
 // if the swapOld flag is set, it also swaps the two semispaces of the old generation
-void koreAllocSwap(bool swapOld);
+// if the clearAlwaysGC flag is set, it also clears the always garbage-collected arena
+void koreAllocSwap(bool swapOld, bool clearAlwaysGC);
+// returns the memory of the blocks of the collection semispace of the young
+// generation (and of the old generation if releaseOld is set) which exceed
+// their recent high-water mark to the OS. Called at the end of a collection.
+void koreAllocReleaseUnused(bool releaseOld);
+// allocate requested bytes into the young generation, or into the old
+// generation if old is set, on behalf of the garbage collector. During a
+// parallel collection, each thread allocates from buffers of its own, which it
+// must set up with koreAllocGCBegin and fill up with koreAllocGCEnd.
+void* koreAllocGC(size_t requested, bool old);
+// same as koreAllocGC, rounding up like koreAllocToken
+void* koreAllocTokenGC(size_t requested, bool old);
+// Called by each thread taking part in a parallel collection of the specified
+// heap, which is the heap of the thread which triggered the collection, and
+// which the other threads adopt until koreAllocGCEnd.
+void koreAllocGCBegin(kore_heap heap);
+void koreAllocGCEnd(void);
+// Between these calls, the current thread allocates into an arena shared by
+// every thread which is never collected. Used to allocate the static objects.
+void koreAllocStaticBegin(void);
+void koreAllocStaticEnd(void);
+// Between these calls, the current thread allocates into an arena of its own
+// which is never collected, and whose objects stay valid until the thread
+// calls koreAllocSearchClear, even once the thread has exited. The objects
+// allocated there must be immutable, and may then be read by any thread. Must
+// not be called while the current thread is allocating into another such
+// arena. Used by the parallel search to share states between threads, cf
+// runtime/util/search.cpp.
+void koreAllocSearchBegin(void);
+void koreAllocSearchEnd(void);
+// Frees every object allocated by the current thread between
+// koreAllocSearchBegin and koreAllocSearchEnd, whose blocks are reused by the
+// next ones. Nothing may reference them anymore.
+void koreAllocSearchClear(void);
+// Called when the young generation of the current thread gets its first
+// block. The heap of the thread is then freed when the thread exits.
+void koreAllocHeapUsed(void);
 // resizes the last allocation into the young generation
 void* koreResizeLastAlloc(void* oldptr, size_t newrequest, size_t oldrequest);
 // allocator hook for the GMP library
@@ -41,6 +106,59 @@ void* koreReallocMP(void*, size_t, size_t);
 // deallocator hook for the GMP library
 void koreFree(void*, size_t);
 
+// The large-object space, cf runtime/alloc/large_object.cpp. Allocations which do
+// not fit in a block of an arena are mapped separately and never move. The
+// large objects of every thread are registered in a single table, which
+// records the heap each object belongs to.
+// number of bytes of large objects of the heap of the current thread
+extern thread_local size_t largeObjectBytes;
+// number of bytes of large objects freed by the last collection
+extern thread_local size_t largeObjectBytesFreed;
+void* largeObjectAlloc(size_t requested);
+// returns true if ptr is the start of an object in the large-object space
+bool isLargeObject(void *ptr);
+// returns true if the large object at ptr was allocated into a region, i.e.
+// the staticspace or a searchspace, and is thus never collected
+bool largeObjectInRegion(void *ptr);
+// marks a large object reached by the garbage collector. Returns true if the
+// object was not marked yet and is collected by the current collection, in
+// which case the caller must migrate its children.
+bool largeObjectMark(void *ptr, bool collectOld);
+// returns true if the large object will survive the current collection, i.e.
+// if it was marked or is not collected by it. Only meaningful before
+// largeObjectSweep, which clears the marks.
+bool largeObjectLive(void *ptr, bool collectOld);
+// frees the large objects collected by the current collection which were not
+// marked, and ages the others
+void largeObjectSweep(bool collectOld);
+// frees every large object of the specified heap, which must be a region or the
+// young generation of an exiting thread, cf koreAllocSearchClear and heap_owner
+// in runtime/alloc/alloc.cpp
+void largeObjectFreeHeap(struct arena *heap);
+void largeObjectFreeAll(void);
+// must be called before starting a thread which may use the large-object
+// space concurrently with the current one, i.e. a thread of the parallel
+// collector or of the parallel search. Until then the operations on the table
+// do not synchronize.
+void largeObjectSpaceShared(void);
+
+// The mark-region old generation, cf runtime/alloc/mark_region.cpp. Enabled by
+// setting KLLVM_OLD_GEN=mark-region, in which case it replaces the old arena.
+extern bool markRegionOldGen;
+void* markRegionAlloc(size_t requested);
+// marks the lines spanned by a live object of the old generation
+void markRegionMarkLive(void *ptr, size_t size);
+// records an object of the old generation whose header was marked in place,
+// so that the mark is cleared by the sweep
+void markRegionRecordMarked(void *obj);
+// called at the start of a collection of the old generation, before any object
+// is marked
+void markRegionStartMajor(void);
+// called at the end of a collection of the old generation: clears the marks
+// and collects the unmarked lines for allocation
+void markRegionSweep(void);
+size_t markRegionBytesUsed(void);
+
 // helper allocators for integers and floats
 // they allocate enough space into the corresponding generation and initialize the blockheader
 // with the correct length. The size argument is ignored but exists for uniformity with
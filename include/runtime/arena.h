@@ -20,11 +20,23 @@ typedef struct {
   char* next_block;
   char* next_superblock;
   char semispace;
+  // true if the pages of the block after its header were returned to the OS by
+  // arenaReleaseCollectionBlocks since the block was last allocated into.
+  bool released;
 } memory_block_header;
 
 // Macro to define a new arena with the given ID. Supports IDs ranging from 0 to
-// 127.
+// 127. Each thread has an arena of its own, cf runtime/alloc/alloc.cpp.
 #define REGISTER_ARENA(name, id) \
+  static thread_local struct arena name = { .allocation_semispace_id = id }
+
+// Same as REGISTER_ARENA, for an arena which is also accessed outside of the
+// file defining it.
+#define REGISTER_EXTERN_ARENA(name, id) \
+  thread_local struct arena name = { .allocation_semispace_id = id }
+
+// Same as REGISTER_ARENA, for an arena shared by every thread.
+#define REGISTER_SHARED_ARENA(name, id) \
   static struct arena name = { .allocation_semispace_id = id }
 
 #define mem_block_start(ptr) \
@@ -51,9 +63,15 @@ char getArenaSemispaceIDOfObject(void *);
 // Allocates the requested number of bytes as a contiguous region and returns a
 // pointer to the first allocated byte.
 // If called with requested size greater than the maximun single allocation size,
-// the space is allocated in a general (not garbage collected pool).
+// the space is allocated in the large-object space, cf largeObjectAlloc.
 void *arenaAlloc(struct arena *, size_t);
 
+// The slow path of arenaAlloc, called when the requested number of bytes does
+// not fit in the current block of the arena. Generated code inlines the fast
+// path of arenaAlloc and only calls this function out of line, cf allocateTerm
+// in lib/codegen/CreateTerm.cpp.
+void *doAllocSlow(size_t, struct arena *);
+
 // Resizes the last allocation as long as the resize does not require a new
 // block allocation.
 // Returns the address of the byte following the last newlly allocated byte when
@@ -95,7 +113,37 @@ ssize_t ptrDiff(char *, char *);
 // return the total number of allocatable bytes currently in the arena in its active semispace.
 size_t arenaSize(const struct arena *);
 
-// Deallocates all the memory allocated for registered arenas.
+// Returns the number of blocks of the active semispace of the arena, up to and
+// including the block currently being allocated into.
+size_t arenaBlocksUsed(const struct arena *);
+
+// Returns the memory of every block of the collection semispace of the arena
+// after the first keep blocks to the OS. The blocks remain part of the
+// semispace and their memory is mapped again, zeroed, when they are next
+// allocated into. Must only be called once the collection semispace holds no
+// live objects, i.e. after a garbage collection has finished.
+void arenaReleaseCollectionBlocks(struct arena *, size_t keep);
+
+// Allocates a block which does not belong to any arena, for the allocators which
+// manage their own blocks (cf runtime/alloc/mark_region.cpp). The block is
+// aligned on BLOCK_SIZE and starts with a memory_block_header whose semispace is
+// the given ID, so that mem_block_start and getArenaSemispaceIDOfObject work on
+// the objects allocated in it.
+char *arenaStandaloneBlock(char semispace);
+
+// Returns every block of both semispaces of the arena to a free list shared by
+// every thread, from which blocks are allocated before any new memory is
+// mapped, and resets the arena. Nothing may reference the objects of the arena
+// anymore. Used to free the heap of a thread when it exits, cf heap_owner in
+// runtime/alloc/alloc.cpp.
+void arenaFree(struct arena *);
+
+// Returns a block allocated by arenaStandaloneBlock to the free list.
+void arenaFreeBlock(char *);
+
+// Deallocates all the memory allocated for registered arenas and for the
+// large-object space, by every thread. Must only be called while no other
+// thread uses the runtime.
 void freeAllMemory(void);
 
 }
@@ -1,9 +1,11 @@
 #ifndef RUNTIME_COLLECT_H
 #define RUNTIME_COLLECT_H
 
+#include <cstring>
 #include <type_traits>
 #include <iterator>
 #include <vector>
+#include <sched.h>
 #include "runtime/header.h"
 
 struct block;
@@ -11,7 +13,8 @@ using block_iterator = std::vector<block **>::iterator;
 typedef std::pair<block_iterator, block_iterator> (*BlockEnumerator)(void);
 
 // This function is exported to the rest of the runtime to enable registering
-// more GC roots other than the top cell of the configuration.
+// more GC roots other than the top cell of the configuration. The enumerator
+// is only called by the collections of the heap of the current thread.
 //
 // Example usage:
 void registerGCRootsEnumerator(BlockEnumerator);
@@ -24,17 +27,182 @@ using set_node = set::iterator::node_t;
 using set_impl = set::iterator::tree_t;
 
 extern "C" {
-  extern size_t numBytesLiveAtCollection[1 << AGE_WIDTH];
+  // The state of the collector is thread-local, like the heap it collects, cf
+  // include/runtime/alloc.h. The threads of a parallel collection copy the
+  // state of the thread which triggered it, cf parallel.cpp
+  extern thread_local size_t numBytesLiveAtCollection[1 << AGE_WIDTH];
+  // Number of bytes of blocks which the current collection did not copy into
+  // the old generation, since it already had a copy of them, cf dedup_lookup
+  extern thread_local size_t numBytesDeduplicated;
   bool during_gc(void);
-  extern bool collect_old;
+  extern thread_local bool collect_old;
+  // set while the collector promotes every young object reachable from the
+  // blocks pretenured since the last collection
+  extern thread_local bool promote_all;
   size_t get_size(uint64_t, uint16_t);
+  void migrate(block **);
   void migrate_once(block **);
+  void migrate_string_buffer(stringbuffer **);
+  void migrate_mpz(mpz_ptr *);
+  void migrate_floating(floating **);
   void migrate_list(void *l);
   void migrate_map(void *m);
   void migrate_set(void *s);
-  void migrate_collection_node(void **nodePtr);
+  // Migrates a node of an immer collection. Returns true if the current thread
+  // must migrate the slots of the node, cf migrate_collection.cpp
+  bool migrate_collection_node(void **nodePtr);
   void setKoreMemoryFunctionsForGMP(void);
   void koreCollect(void**, uint8_t, layoutitem *);
+
+  // The policy deciding when to collect the old generation and the size of the
+  // young generation, cf runtime/collect/policy.cpp
+  size_t oldspace_used(void);
+  bool shouldCollectOldGen(void);
+  void startCollection(void);
+  void recordCollection(bool collectedOld, size_t oldBytesBefore, size_t oldBytesAfter);
+  size_t nextYoungThreshold(bool collectedOld);
+  // Removes dead blocks from the hash-consing table and updates the address and
+  // hash of the blocks which survived. Called at the end of each collection,
+  // before the large objects and the mark-region old generation are swept.
+  void pruneHashConsTable(void);
+  // Deduplication of the old generation, if dedupOldGen is set, cf dedup.cpp:
+  // before copying a block into the old generation, migrate calls dedup_lookup,
+  // which returns the copy of a block with the same contents if there is one,
+  // and otherwise sets *hash for the call to dedup_record on the new copy.
+  // dedup_end forgets the copies at the end of each collection.
+  extern bool dedupOldGen;
+  block *dedup_lookup(block *b, uint64_t hdr, size_t lenInBytes, size_t *hash);
+  void dedup_record(block *b, uint64_t hdr, size_t lenInBytes, size_t hash, block *copy);
+  void dedup_end(void);
+
+  // Generated at kompile time: for each layout code, a function which migrates
+  // every child of a block with that layout. cf emitScavengers in
+  // lib/codegen/EmitConfigParser.cpp
+  typedef void (*scavenger)(block *);
+  extern scavenger scavenge_table[];
+
+  // The parallel collector, cf runtime/collect/parallel.cpp. parallelGC is set
+  // between parallelCollectBegin and the end of parallelCollectRun.
+  extern thread_local bool parallelGC;
+  bool parallelCollectEnabled(void);
+  void parallelCollectBegin(void);
+  // Records a block copied by the current thread whose children remain to be
+  // migrated.
+  void pushGrey(block *);
+  // Migrates the children of every block pushed so far, and of every block
+  // copied while doing so, using all the threads of the collector.
+  void parallelCollectRun(void);
+
+  // The shadow stack of the functions of a definition compiled with
+  // --gc-safepoints, cf runtime/collect/shadow_stack.cpp and GCFrame in
+  // lib/codegen. Each frame holds the terms a function keeps across calls.
+  typedef struct {
+    layoutitem *layout;
+    uint64_t nroots;
+    void *roots[];
+  } gc_frame;
+  extern thread_local char *gc_frame_top;
+  // the number of frames on the shadow stack whose function holds terms the
+  // collector does not know about, during which no collection may happen at
+  // a safepoint
+  extern thread_local uint64_t gc_unsafe_frames;
+  char *gc_frames_begin(void);
+  // Sets up the shadow stack of the current thread, if it has none yet. Called
+  // on entry to the rewriter by take_steps and take_search_step, since
+  // generated code pushes frames without checking.
+  void initGCFrames(void);
+  // Collects if the young generation is full and no unsafe frame is on the
+  // shadow stack. Called on entry to every function compiled with
+  // --gc-safepoints, which collects the terms held by every frame.
+  void koreSafepoint(void);
+
+  // Allocation-site pretenuring, cf runtime/collect/pretenure.cpp. Generated
+  // code allocates the blocks of pretenured sites with koreAllocPretenured,
+  // and records the site of every block it constructs with
+  // koreRecordAllocationSite when kompiled with --profile-allocation-sites.
+  void *koreAllocPretenured(size_t requested);
+  void koreRecordAllocationSite(block *, const char *site);
+  // Counts the recorded blocks promoted by the current collection. Called at
+  // the end of each collection, while the forwarding addresses of the copied
+  // blocks can still be read.
+  void allocationSitesAfterCollection(void);
+
+  // The telemetry of the collector, cf runtime/collect/telemetry.cpp.
+  // gcTelemetryStart is called at the start of each collection and
+  // gcTelemetryRecord at its end. Each thread of the parallel collector other
+  // than the one which triggered the collection calls gcTelemetryFlushThread
+  // once out of work, and the thread which triggered it then adds the bytes
+  // they copied to its own with gcTelemetryGatherThreads.
+  void gcTelemetryStart(void);
+  void gcTelemetryFlushThread(void);
+  void gcTelemetryGatherThreads(void);
+  void gcTelemetryRecord(bool major);
+
+  // The heap census, cf runtime/collect/census.cpp. censusBegin is called at
+  // the start of each collection and returns true if the collection takes a
+  // census, in which case it is a serial collection of the old generation
+  // which calls censusEnd at its end. While censusActive is set, each live
+  // object is counted by census_record when the collection first reaches it.
+  typedef enum {
+    CENSUS_SYMBOL,
+    CENSUS_STRING,
+    CENSUS_STRINGBUFFER,
+    CENSUS_INT,
+    CENSUS_FLOAT,
+    CENSUS_COLLECTION_NODE,
+  } census_category;
+  extern thread_local bool censusActive;
+  bool censusBegin(void);
+  void censusRecord(census_category category, uint32_t tag, size_t bytes);
+  void censusEnd(void);
+}
+
+// the number of bytes copied and promoted by the current thread during the
+// current collection, cf count_copy
+extern thread_local size_t gcBytesCopied;
+extern thread_local size_t gcBytesPromoted;
+
+// the blocks allocated by koreAllocPretenured since the last collection
+extern thread_local std::vector<block *> pretenuredBlocks;
+
+// During a parallel collection, the thread which copies an object first
+// replaces its header with GC_BUSY_HDR, and then with the original header and
+// FWD_PTR_BIT once the forwarding address is stored. Other threads reaching the
+// object in the meantime wait for the forwarding address. Outside of a
+// parallel collection, these are plain reads and writes of the header.
+#define GC_BUSY_HDR UINT64_MAX
+
+static inline uint64_t load_hdr(blockheader *h) {
+  if (!parallelGC) {
+    return h->hdr;
+  }
+  uint64_t hdr;
+  while ((hdr = __atomic_load_n(&h->hdr, __ATOMIC_ACQUIRE)) == GC_BUSY_HDR) {
+    // the copying thread may have been preempted
+    sched_yield();
+  }
+  return hdr;
+}
+
+// Returns true if the current thread is the one which copies the object whose
+// header was hdr when it was loaded.
+static inline bool claim_hdr(blockheader *h, uint64_t hdr) {
+  if (!parallelGC) {
+    return true;
+  }
+  return __atomic_compare_exchange_n(&h->hdr, &hdr, GC_BUSY_HDR, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void publish_hdr(blockheader *h, uint64_t hdr) {
+  __atomic_store_n(&h->hdr, hdr | FWD_PTR_BIT, __ATOMIC_RELEASE);
+}
+
+// Waits until the forwarding address of an object claimed by another thread
+// is available.
+static inline void await_forwarding(blockheader *h) {
+  if (parallelGC) {
+    load_hdr(h);
+  }
 }
 
 #ifdef GC_DBG
@@ -62,8 +230,43 @@ extern "C" {
   if (!(isInYoungGen || (isInOldGen && collect_old))) { \
     return; \
   } \
-  bool shouldPromote = isInYoungGen && age; \
+  bool shouldPromote = isInYoungGen && (age || promote_all); \
   increment_age() \
   bool hasForwardingAddress = hdr & FWD_PTR_BIT
 
+// Counts bytes copied by the current collection. Must follow
+// initialize_migrate.
+#define count_copy(bytes) \
+  gcBytesCopied += (bytes); \
+  if (shouldPromote) gcBytesPromoted += (bytes)
+
+// Counts a live object in the current census, if any. The tag is that of the
+// symbol for CENSUS_SYMBOL, and ignored otherwise.
+#define census_record(category, tag, bytes) \
+  if (censusActive) censusRecord(category, tag, bytes)
+
+// Shallow comparison of blocks, used by hash-consing, cf hash_cons.cpp: two
+// blocks of symbols are shallowly equal if they have the same header and the
+// same child words, i.e. the same children rather than equal ones. The GC bits
+// of the header and the cached hash, which may not have been computed for both
+// blocks, are not compared.
+static inline size_t shallow_size(block *b) {
+  return size_hdr(b->h.hdr) - (cache_term_hashes ? sizeof(uint64_t) : 0);
+}
+
+static inline size_t shallow_hash(block *b) {
+  size_t hash = 14695981039346656037ULL;
+  hash = (hash ^ (b->h.hdr & HDR_MASK)) * 1099511628211ULL;
+  uint64_t *words = (uint64_t *)b;
+  for (size_t i = 1; i < shallow_size(b) / sizeof(uint64_t); i++) {
+    hash = (hash ^ words[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static inline bool shallow_equal(block *b1, block *b2) {
+  return (b1->h.hdr & HDR_MASK) == (b2->h.hdr & HDR_MASK)
+    && memcmp(b1->children, b2->children, shallow_size(b1) - sizeof(blockheader)) == 0;
+}
+
 #endif // RUNTIME_COLLECT_H
@@ -207,6 +207,7 @@ extern "C" {
   // The following functions have to be generated at kompile time
   // and linked with the interpreter.
   uint32_t getTagForSymbolName(const char *symbolname);
+  uint32_t getTagForFreshSort(const char *sort);
   struct blockheader getBlockHeaderForSymbol(uint32_t tag);
   bool isSymbolAFunction(uint32_t tag);
   bool isSymbolABinder(uint32_t tag);
@@ -216,6 +217,11 @@ extern "C" {
   layout *getLayoutData(uint16_t);
   uint32_t getInjectionForSortOfTag(uint32_t tag);
 
+  // Tables backing getLayoutData and getBlockHeaderForSymbol, indexed
+  // directly by layout code and by tag respectively.
+  extern layout *const layout_table[];
+  extern const blockheader table_getBlockHeaderForSymbol[];
+
   bool hook_STRING_eq(SortString, SortString);
 
   const char *getSymbolNameForTag(uint32_t tag);
@@ -257,6 +263,54 @@ extern "C" {
 
   extern const uint32_t first_inj_tag, last_inj_tag;
 
+  // True if the definition was compiled with --cache-hashes, in which case
+  // every block of a symbol with arguments ends with a word caching the hash of
+  // the term it represents. cf cached_hash in runtime/collections/hash.cpp
+  extern const bool cache_term_hashes;
+
+  // True if the definition was compiled with --hash-cons, in which case the
+  // blocks constructed by rewriting and by parsing the initial configuration
+  // are shared through hash_cons.
+  extern const bool hash_cons_terms;
+
+  // Returns the canonical block with the same header and children as term,
+  // registering term as canonical if there is none yet. Since the children of
+  // term are themselves canonical, this is the canonical block structurally
+  // equal to term.
+  block *hash_cons(block *term);
+
+}
+
+// Inlinable equivalents of getLayoutData and getBlockHeaderForSymbol for the
+// hot paths of the runtime (garbage collection, hashing, substitution). Unlike
+// the generated functions, they do not check that their argument is in range.
+static inline layout *get_layout_data(uint16_t layout_code) {
+  return layout_table[layout_code];
+}
+
+static inline blockheader get_block_header_for_symbol(uint32_t tag) {
+  return table_getBlockHeaderForSymbol[tag];
+}
+
+// The cached hash of a block is stored in its last word, and is zero if it has
+// not been computed yet. Only meaningful if cache_term_hashes is true.
+#define cached_hash_slot(b) (((uint64_t *)((char *)(b) + size_hdr((b)->h.hdr))) - 1)
+
+static inline void clear_cached_hash(block *b) {
+  if (cache_term_hashes) {
+    *cached_hash_slot(b) = 0;
+  }
+}
+
+// Allocates a block of the size described by hdr on the young generation and
+// initializes its header. Blocks of symbols constructed by the runtime must be
+// allocated this way rather than by the size of their C struct, since the block
+// may also hold a cached hash.
+static inline block *alloc_block(blockheader hdr) {
+  block *result = (block *)koreAlloc(size_hdr(hdr.hdr));
+  result->h = hdr;
+  clear_cached_hash(result);
+  return result;
 }
 
 std::string floatToString(const floating *);
@@ -0,0 +1,80 @@
+#ifndef RUNTIME_NAME_TABLE_H
+#define RUNTIME_NAME_TABLE_H
+
+#include <cstdint>
+#include <cstring>
+
+// A name table maps a fixed set of strings known at kompile time (symbol names,
+// sort names) to 32-bit values. It is a minimal perfect hash: the high half of
+// the hash of a key selects a bucket, and the displacement stored for that
+// bucket is mixed into the hash to obtain the slot of the key. A lookup thus
+// costs one hash of the key and a single string comparison, independently of
+// the number of keys in the table. If no perfect hash of the keys was found,
+// the table has no buckets, and a lookup compares the name with every key.
+//
+// The tables are generated by llvm-kompile-codegen (see emitNameTable in
+// lib/codegen/EmitConfigParser.cpp), which uses the hash functions below, so
+// the two must be kept in sync.
+
+extern "C" {
+  // llvm: name_table = type { i64, i64, i32 *, i8 **, i32 * }
+  typedef struct name_table {
+    uint64_t nkeys;
+    uint64_t nbuckets;
+    const uint32_t *displacements;
+    const char *const *keys;
+    const uint32_t *values;
+  } name_table;
+
+  // Looks up name in the table. Returns true and stores the associated value in
+  // result if it is found, returns false otherwise.
+  bool lookupNameTable(const name_table *table, const char *name, uint32_t *result);
+}
+
+// 64-bit FNV-1a hash of a null-terminated string.
+static inline uint64_t hash_name(const char *str) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *str; str++) {
+    hash = (hash ^ (unsigned char)*str) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static inline uint64_t name_table_bucket(uint64_t hash, uint64_t nbuckets) {
+  return (hash >> 32) % nbuckets;
+}
+
+static inline uint64_t name_table_slot(uint64_t hash, uint32_t displacement, uint64_t nkeys) {
+  hash ^= (uint64_t)displacement * 0x9e3779b97f4a7c15ULL;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash % nkeys;
+}
+
+static inline bool name_table_lookup(const name_table *table, const char *name, uint32_t *result) {
+  if (table->nkeys == 0) {
+    return false;
+  }
+  if (table->nbuckets == 0) {
+    for (uint64_t i = 0; i < table->nkeys; i++) {
+      if (strcmp(table->keys[i], name) == 0) {
+        *result = table->values[i];
+        return true;
+      }
+    }
+    return false;
+  }
+  uint64_t hash = hash_name(name);
+  uint32_t displacement = table->displacements[name_table_bucket(hash, table->nbuckets)];
+  uint64_t slot = name_table_slot(hash, displacement, table->nkeys);
+  if (strcmp(table->keys[slot], name) != 0) {
+    return false;
+  }
+  *result = table->values[slot];
+  return true;
+}
+
+#endif // RUNTIME_NAME_TABLE_H
@@ -0,0 +1,54 @@
+#ifndef RUNTIME_TERM_ENCODING_H
+#define RUNTIME_TERM_ENCODING_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "runtime/header.h"
+
+// A compact, pointer-free encoding of terms, used by the compressed frontier
+// of the search (cf runtime/util/search.cpp). Decoding the encoding of a term
+// yields a term structurally equal to it, whose subterms are shared as they
+// are in it.
+
+// Layout items of machine integers are SortCategory::MInt plus their width in
+// bits, cf GCFrame::finalize.
+static inline size_t mintBytes(uint16_t cat) {
+  return (cat - VARIABLE_LAYOUT - 1 + 7) / 8;
+}
+
+// Appends the encoding of terms to a string. The subterms shared between the
+// terms encoded by the same encoder are encoded once.
+class term_encoder {
+  std::string &out;
+  // the index of each block encoded so far
+  std::unordered_map<block *, uint64_t> shared;
+
+  void encodeInt(mpz_ptr i);
+  void encodeFloat(floating *f);
+
+public:
+  term_encoder(std::string &out) : out(out) {}
+
+  void encode(block *term);
+};
+
+// Rebuilds the terms encoded by term_encoder on the young generation of the
+// current thread. Decoding does not collect garbage, so the blocks decoded
+// stay where they are allocated.
+class term_decoder {
+  const char *in;
+  std::vector<block *> shared;
+
+  mpz_ptr decodeInt();
+  floating *decodeFloat();
+  stringbuffer *decodeStringBuffer();
+
+public:
+  term_decoder(const char *in) : in(in) {}
+
+  block *decode();
+};
+
+#endif // RUNTIME_TERM_ENCODING_H
@@ -3,6 +3,7 @@
 #include "kllvm/codegen/Debug.h"
 
 #include <gmp.h>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 
@@ -76,6 +77,8 @@ target triple = "x86_64-unknown-linux-gnu"
 %layout = type { i8, %layoutitem* } ; number of children, array of children
 %layoutitem = type { i64, i16 } ; offset, category
 
+%name_table = type { i64, i64, i32 *, i8 **, i32 * } ; number of keys, number of buckets, displacements, keys, values
+
 ; The layout of a block uniquely identifies the categories of its children as
 ; well as how to allocate/deallocate them and whether to follow their pointers
 ; during gc. Roughly speaking, the following rules apply:
@@ -97,6 +100,44 @@ target triple = "x86_64-unknown-linux-gnu"
 ; Interface to the configuration parser
 declare %block* @parseConfiguration(i8*)
 declare void @printConfiguration(i32, %block *)
+
+; Terms are allocated into the young generation by the following functions,
+; which are inlined by llvm-kompile. They bump the pointer of the arena of the
+; young generation and only call into the runtime when its current block is
+; full, cf koreAlloc and koreAllocToken in runtime/alloc/alloc.cpp.
+
+%arena = type { i8 *, i8 *, i8 *, i8 *, i8 *, i64, i64, i8 } ; struct arena
+@youngspace = external thread_local global %arena
+declare i8* @doAllocSlow(i64, %arena *)
+
+define internal i8* @koreAllocInline(i64 %requested) alwaysinline {
+entry:
+  %blockPtr = getelementptr %arena, %arena* @youngspace, i64 0, i32 1
+  %block = load i8*, i8** %blockPtr
+  %endPtr = getelementptr %arena, %arena* @youngspace, i64 0, i32 3
+  %end = load i8*, i8** %endPtr
+  %next = getelementptr i8, i8* %block, i64 %requested
+  %fits = icmp ule i8* %next, %end
+  br i1 %fits, label %fast, label %slow, !prof !0
+fast:
+  store i8* %next, i8** %blockPtr
+  ret i8* %block
+slow:
+  %result = call i8* @doAllocSlow(i64 %requested, %arena* @youngspace)
+  ret i8* %result
+}
+
+define internal i8* @koreAllocTokenInline(i64 %requested) alwaysinline {
+entry:
+  %padded = add i64 %requested, 7
+  %rounded = and i64 %padded, -8
+  %small = icmp ult i64 %rounded, 16
+  %size = select i1 %small, i64 16, i64 %rounded
+  %result = call i8* @koreAllocInline(i64 %size)
+  ret i8* %result
+}
+
+!0 = !{!"branch_weights", i32 2000, i32 1}
 )LLVM";
 
 std::unique_ptr<llvm::Module> newModule(std::string name, llvm::LLVMContext &Context) {
@@ -129,6 +170,11 @@ static std::string BUFFER_STRUCT = "stringbuffer";
 static std::string BLOCK_STRUCT = "block";
 static std::string BLOCKHEADER_STRUCT = "blockheader";
 
+// the largest number of bytes allocated at once for the blocks of a term and of
+// its subterms, which must fit in any block of an arena, cf KLLVM_BLOCK_SIZE in
+// runtime/alloc/arena.cpp
+static const uint64_t MAX_RESERVATION = 4096;
+
 llvm::Type *getParamType(ValueType sort, llvm::Module *Module) {
   llvm::Type *type = getValueType(sort, Module);
   switch(sort.cat) {
@@ -170,6 +216,51 @@ llvm::Type *getValueType(ValueType sort, llvm::Module *Module) {
 }
 
 
+bool CACHE_TERM_HASHES = false;
+bool HASH_CONS_TERMS = false;
+bool GC_SAFEPOINTS = false;
+bool PROFILE_ALLOCATION_SITES = false;
+std::set<std::string> PRETENURED_SITES;
+
+// a site is pretenured if at least PRETENURE_MIN_ALLOCATED blocks were
+// allocated there and at least PRETENURE_MIN_PERCENT percent of them were
+// promoted to the old generation
+static const uint64_t PRETENURE_MIN_ALLOCATED = 1000;
+static const uint64_t PRETENURE_MIN_PERCENT = 90;
+
+void loadPretenuringProfile(std::string filename) {
+  std::ifstream in(filename);
+  if (!in) {
+    std::cerr << "could not open pretenuring profile " << filename << std::endl;
+    abort();
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t tab1 = line.find('\t');
+    size_t tab2 = line.find('\t', tab1 + 1);
+    if (tab1 == std::string::npos || tab2 == std::string::npos) {
+      std::cerr << "invalid line in pretenuring profile " << filename << ": " << line << std::endl;
+      abort();
+    }
+    uint64_t allocated = std::stoull(line.substr(0, tab1));
+    uint64_t promoted = std::stoull(line.substr(tab1 + 1, tab2 - tab1 - 1));
+    if (allocated >= PRETENURE_MIN_ALLOCATED && promoted * 100 >= allocated * PRETENURE_MIN_PERCENT) {
+      PRETENURED_SITES.insert(line.substr(tab2 + 1));
+    }
+  }
+}
+
+// the number of allocation sites of each function so far
+static llvm::StringMap<unsigned> numAllocationSites;
+
+// returns the name of the allocation site of the block constructed by the
+// specified function after the following skip blocks. Sites are numbered in
+// the order their blocks are constructed in, so that the names are the same
+// each time a definition is kompiled.
+static std::string allocationSite(llvm::Function *function, unsigned skip = 0) {
+  return function->getName().str() + ":" + std::to_string(numAllocationSites.lookup(function->getName()) + skip);
+}
+
 llvm::StructType *getBlockType(llvm::Module *Module, KOREDefinition *definition, const KORESymbol *symbol) {
   llvm::StructType *BlockHeaderType = getTypeByName(Module, BLOCKHEADER_STRUCT);
   llvm::ArrayType *EmptyArrayType = llvm::ArrayType::get(llvm::Type::getInt64Ty(Module->getContext()), 0);
@@ -181,12 +272,28 @@ llvm::StructType *getBlockType(llvm::Module *Module, KOREDefinition *definition,
     llvm::Type *type = getValueType(sort->getCategory(definition), Module);
     Types.push_back(type);
   }
+  if (CACHE_TERM_HASHES) {
+    // cf cached_hash in runtime/collections/hash.cpp
+    Types.push_back(llvm::Type::getInt64Ty(Module->getContext()));
+  }
   return llvm::StructType::get(Module->getContext(), Types);
 }
 
-llvm::Value *getBlockHeader(llvm::Module *Module, KOREDefinition *definition, const KORESymbol *symbol, llvm::Type *BlockType) {
+void clearCachedHash(llvm::StructType *BlockType, llvm::Value *Block, llvm::BasicBlock *block) {
+  if (!CACHE_TERM_HASHES) {
+    return;
+  }
+  auto &Ctx = block->getContext();
+  llvm::Value *HashPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, Block, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0), llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), BlockType->getNumElements() - 1)}, "", block);
+  new llvm::StoreInst(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0), HashPtr, block);
+}
+
+llvm::Value *getBlockHeader(llvm::Module *Module, KOREDefinition *definition, const KORESymbol *symbol, llvm::Type *BlockType, bool old) {
   llvm::StructType *BlockHeaderType = getTypeByName(Module, BLOCKHEADER_STRUCT);
   uint64_t headerVal = symbol->getTag();
+  if (old) {
+    headerVal |= NOT_YOUNG_OBJECT_BIT | AGE_MASK;
+  }
   uint64_t sizeInBytes = llvm::DataLayout(Module).getTypeAllocSize(BlockType);
   assert(sizeInBytes % 8 == 0);
   headerVal |= (sizeInBytes / 8) << 32;
@@ -198,8 +305,18 @@ llvm::Value *allocateTerm(llvm::Type *AllocType, llvm::BasicBlock *block, const
   return allocateTerm(AllocType, llvm::ConstantExpr::getSizeOf(AllocType), block, allocFn);
 }
 
+// the allocators of the young generation have their fast path defined in every
+// module, cf LLVM_HEADER, so that allocating a term does not depend on LTO to
+// inline the allocator of the runtime
+static std::string inlineAllocator(std::string allocFn) {
+  if (allocFn == "koreAlloc" || allocFn == "koreAllocToken") {
+    return allocFn + "Inline";
+  }
+  return allocFn;
+}
+
 llvm::Value *allocateTerm(llvm::Type *AllocType, llvm::Value *Len, llvm::BasicBlock *block, const char *allocFn) {
-  llvm::Instruction *Malloc = llvm::CallInst::CreateMalloc(block, llvm::Type::getInt64Ty(block->getContext()), AllocType, Len, nullptr, koreHeapAlloc(allocFn, block->getModule()));
+  llvm::Instruction *Malloc = llvm::CallInst::CreateMalloc(block, llvm::Type::getInt64Ty(block->getContext()), AllocType, Len, nullptr, koreHeapAlloc(inlineAllocator(allocFn), block->getModule()));
   setDebugLoc(&block->getInstList().back());
   block->getInstList().push_back(Malloc);
   return Malloc;
@@ -675,10 +792,15 @@ llvm::Value *CreateTerm::createFunctionCall(std::string name, KORECompositePatte
   std::vector<llvm::Value *> args;
   auto returnSort = dynamic_cast<KORECompositeSort *>(pattern->getConstructor()->getSort().get());
   auto returnCat = returnSort->getCategory(Definition);
+  std::vector<KOREPattern *> children;
+  for (auto &child : pattern->getArguments()) {
+    children.push_back(child.get());
+  }
+  std::vector<llvm::Value *> values = createTerms(children);
   int i = 0;
   for (auto sort : pattern->getConstructor()->getArguments()) {
     auto concreteSort = dynamic_cast<KORECompositeSort *>(sort.get());
-    llvm::Value *arg = (*this)(pattern->getArguments()[i++].get()).first;
+    llvm::Value *arg = values[i++];
     switch(concreteSort->getCategory(Definition).cat) {
     case SortCategory::Map:
     case SortCategory::List:
@@ -757,18 +879,45 @@ llvm::Value *CreateTerm::notInjectionCase(KORECompositePattern *constructor, llv
   const KORESymbol *symbol = constructor->getConstructor();
   KORESymbolDeclaration *symbolDecl = Definition->getSymbolDeclarations().at(symbol->getName());
   llvm::StructType *BlockType = getBlockType(Module, Definition, symbol);
-  llvm::Value *BlockHeader = getBlockHeader(Module, Definition, symbol, BlockType);
-  llvm::Value *Block = allocateTerm(BlockType, CurrentBlock);
+  // the children are constructed before the block, which would otherwise be
+  // held across their construction
+  std::vector<KOREPattern *> children;
+  for (auto &child : constructor->getArguments()) {
+    children.push_back(child.get());
+  }
+  // the blocks of the term and of its subterms are allocated at once when
+  // possible, and each of them then takes its space from the reservation
+  bool reserves = false;
+  uint64_t size = 0;
+  unsigned blocks = 0;
+  if (!Reserved && !val && allocatedSize(constructor, size, blocks)
+      && size > llvm::DataLayout(Module).getTypeAllocSize(BlockType) && size <= MAX_RESERVATION) {
+    Reserved = allocateTerm(llvm::Type::getInt8Ty(Ctx), llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), size), CurrentBlock);
+    reserves = true;
+  }
+  std::vector<llvm::Value *> values = createTerms(children, val);
+  llvm::Function *function = CurrentBlock->getParent();
+  std::string site = allocationSite(function);
+  numAllocationSites[function->getName()]++;
+  bool pretenure = PRETENURED_SITES.count(site);
+  llvm::Value *BlockHeader = getBlockHeader(Module, Definition, symbol, BlockType, pretenure);
+  llvm::Value *Block;
+  if (pretenure) {
+    Block = allocateTerm(BlockType, CurrentBlock, "koreAllocPretenured");
+  } else if (Reserved) {
+    Block = new llvm::BitCastInst(Reserved, llvm::PointerType::getUnqual(BlockType), "", CurrentBlock);
+    Reserved = llvm::GetElementPtrInst::CreateInBounds(llvm::Type::getInt8Ty(Ctx), Reserved, {llvm::ConstantExpr::getSizeOf(BlockType)}, "", CurrentBlock);
+  } else {
+    Block = allocateTerm(BlockType, CurrentBlock);
+  }
+  if (reserves) {
+    Reserved = nullptr;
+  }
   llvm::Value *BlockHeaderPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, Block, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0), llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 0)}, symbol->getName(), CurrentBlock);
   new llvm::StoreInst(BlockHeader, BlockHeaderPtr, CurrentBlock);
+  clearCachedHash(BlockType, Block, CurrentBlock);
   int idx = 2;
-  for (auto &child : constructor->getArguments()) {
-    llvm::Value *ChildValue;
-    if (idx == 2 && val != nullptr) {
-      ChildValue = val;
-    } else {
-      ChildValue = (*this)(child.get()).first;
-    }
+  for (llvm::Value *ChildValue : values) {
     llvm::Value *ChildPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, Block, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0), llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), idx++)}, "", CurrentBlock);
     if (ChildValue->getType() == ChildPtr->getType()) {
       ChildValue = new llvm::LoadInst(ChildValue->getType()->getPointerElementType(), ChildValue, "", CurrentBlock);
@@ -776,19 +925,33 @@ llvm::Value *CreateTerm::notInjectionCase(KORECompositePattern *constructor, llv
     new llvm::StoreInst(ChildValue, ChildPtr, CurrentBlock);
   }
   auto BlockPtr = llvm::PointerType::getUnqual(getTypeByName(Module, BLOCK_STRUCT));
-  auto bitcast = new llvm::BitCastInst(Block, BlockPtr, "", CurrentBlock);
+  llvm::Value *result = new llvm::BitCastInst(Block, BlockPtr, "", CurrentBlock);
+  if (PROFILE_ALLOCATION_SITES) {
+    auto name = llvm::ConstantDataArray::getString(Ctx, site);
+    auto global = new llvm::GlobalVariable(*Module, name->getType(), true, llvm::GlobalValue::PrivateLinkage, name, "site_" + site);
+    auto siteName = llvm::ConstantExpr::getBitCast(global, llvm::Type::getInt8PtrTy(Ctx));
+    auto call = llvm::CallInst::Create(getOrInsertFunction(Module, "koreRecordAllocationSite", llvm::Type::getVoidTy(Ctx), BlockPtr, llvm::Type::getInt8PtrTy(Ctx)), {result, siteName}, "", CurrentBlock);
+    setDebugLoc(call);
+  }
   if (symbolDecl->getAttributes().count("binder")) {
-    auto call = llvm::CallInst::Create(getOrInsertFunction(Module, "debruijnize", BlockPtr, BlockPtr), bitcast, "withIndices", CurrentBlock);
+    auto call = llvm::CallInst::Create(getOrInsertFunction(Module, "debruijnize", BlockPtr, BlockPtr), result, "withIndices", CurrentBlock);
     setDebugLoc(call);
-    return call; 
-  } else {
-    return bitcast;
+    result = call;
   }
+  if (HASH_CONS_TERMS) {
+    auto call = llvm::CallInst::Create(getOrInsertFunction(Module, "hash_cons", BlockPtr, BlockPtr), result, "canonical", CurrentBlock);
+    setDebugLoc(call);
+    result = call;
+  }
+  return result;
 }
 
 // returns a value and a boolean indicating whether that value could be an injection
 std::pair<llvm::Value *, bool> CreateTerm::operator()(KOREPattern *pattern) {
   if (auto variable = dynamic_cast<KOREVariablePattern *>(pattern)) {
+    if (llvm::Value *slot = RootedVariables.lookup(variable->getName())) {
+      return std::make_pair(new llvm::LoadInst(slot->getType()->getPointerElementType(), slot, variable->getName(), CurrentBlock), true);
+    }
     auto val = Substitution.lookup(variable->getName());
     if (!val) {
       std::cerr << variable->getName() << std::endl;
@@ -862,6 +1025,150 @@ std::pair<llvm::Value *, bool> CreateTerm::operator()(KOREPattern *pattern) {
   }
 }
 
+// returns true if constructing the specified pattern may call a function
+// which runs the garbage collector, i.e. a function which is not hooked
+bool CreateTerm::mayCollect(KOREPattern *pattern) {
+  auto constructor = dynamic_cast<KORECompositePattern *>(pattern);
+  if (!constructor || constructor->getConstructor()->getName() == "\\dv") {
+    return false;
+  }
+  const KORESymbol *symbol = constructor->getConstructor();
+  KORESymbolDeclaration *symbolDecl = Definition->getSymbolDeclarations().at(symbol->getName());
+  if (symbolDecl->getAttributes().count("function") || (symbolDecl->getAttributes().count("anywhere") && !isAnywhereOwise)) {
+    if (!symbolDecl->getAttributes().count("hook")) {
+      return true;
+    }
+    auto hookAtt = symbolDecl->getAttributes().at("hook").get();
+    auto strPattern = dynamic_cast<KOREStringPattern *>(hookAtt->getArguments()[0].get());
+    if (!strPattern->getContents().compare(0, 6, "ARRAY.")) {
+      return true;
+    }
+  }
+  for (auto &child : constructor->getArguments()) {
+    if (mayCollect(child.get())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// returns true if constructing the specified pattern allocates the same blocks
+// every time, in the young generation, and cannot run the garbage collector, in
+// which case the total size of these blocks is added to size, and their number
+// to blocks
+bool CreateTerm::allocatedSize(KOREPattern *pattern, uint64_t &size, unsigned &blocks) {
+  auto constructor = dynamic_cast<KORECompositePattern *>(pattern);
+  if (!constructor || constructor->getConstructor()->getName() == "\\dv") {
+    return true;
+  }
+  const KORESymbol *symbol = constructor->getConstructor();
+  KORESymbolDeclaration *symbolDecl = Definition->getSymbolDeclarations().at(symbol->getName());
+  if (symbolDecl->getAttributes().count("function") || (symbolDecl->getAttributes().count("anywhere") && !isAnywhereOwise)) {
+    return false;
+  }
+  if (symbol->getArguments().empty()) {
+    return true;
+  }
+  if (symbolDecl->getAttributes().count("sortInjection")
+      && dynamic_cast<KORECompositeSort *>(symbol->getArguments()[0].get())->getCategory(Definition).cat == SortCategory::Symbol) {
+    // an injection is only allocated if its child is known not to be an
+    // injection itself, i.e. if its child is a constructor other than an
+    // injection into a sort of terms
+    auto child = dynamic_cast<KORECompositePattern *>(constructor->getArguments()[0].get());
+    if (!child) {
+      return false;
+    }
+    const KORESymbol *childSymbol = child->getConstructor();
+    KORESymbolDeclaration *childDecl = Definition->getSymbolDeclarations().at(childSymbol->getName());
+    if (childDecl->getAttributes().count("sortInjection")
+        && dynamic_cast<KORECompositeSort *>(childSymbol->getArguments()[0].get())->getCategory(Definition).cat == SortCategory::Symbol) {
+      return false;
+    }
+  }
+  for (auto &child : constructor->getArguments()) {
+    if (!allocatedSize(child.get(), size, blocks)) {
+      return false;
+    }
+  }
+  // the block is constructed after those of its children
+  if (PRETENURED_SITES.count(allocationSite(CurrentBlock->getParent(), blocks))) {
+    return false;
+  }
+  blocks++;
+  size += llvm::DataLayout(Module).getTypeAllocSize(getBlockType(Module, Definition, symbol));
+  return true;
+}
+
+std::vector<llvm::Value *> CreateTerm::createTerms(const std::vector<KOREPattern *> &patterns, llvm::Value *first) {
+  std::vector<llvm::Value *> values(patterns.size());
+  // collectsLater[i] is true if constructing a pattern after the ith may run the
+  // garbage collector
+  std::vector<bool> collectsLater(patterns.size());
+  bool collects = false;
+  for (size_t i = patterns.size(); i > 0; i--) {
+    collectsLater[i-1] = collects;
+    collects = collects || (Frame && mayCollect(patterns[i-1]));
+  }
+  std::vector<llvm::Value *> slots(patterns.size());
+  std::vector<bool> byValue(patterns.size());
+  for (size_t i = 0; i < patterns.size(); i++) {
+    if (i == 0 && first) {
+      values[i] = first;
+      continue;
+    }
+    if (collectsLater[i]) {
+      auto variable = dynamic_cast<KOREVariablePattern *>(patterns[i]);
+      if (variable && RootedVariables.count(variable->getName())) {
+        // loaded once every pattern is constructed
+        continue;
+      }
+    }
+    llvm::Value *value = (*this)(patterns[i]).first;
+    ValueType cat;
+    if (!collectsLater[i]) {
+      values[i] = value;
+    } else if (value->getType()->isStructTy()) {
+      // a map, list or set passed by value
+      auto ptr = Frame->storage(value->getType());
+      new llvm::StoreInst(value, ptr, CurrentBlock);
+      GCFrame::isRoot(Module, ptr->getType(), cat);
+      slots[i] = Frame->slot(cat, ptr->getType());
+      new llvm::StoreInst(ptr, slots[i], CurrentBlock);
+      byValue[i] = true;
+    } else if (GCFrame::isRoot(Module, value->getType(), cat)) {
+      slots[i] = Frame->slot(cat, value->getType());
+      new llvm::StoreInst(value, slots[i], CurrentBlock);
+    } else {
+      values[i] = value;
+    }
+  }
+  for (size_t i = 0; i < patterns.size(); i++) {
+    if (values[i]) {
+      continue;
+    }
+    if (slots[i]) {
+      values[i] = new llvm::LoadInst(slots[i]->getType()->getPointerElementType(), slots[i], "", CurrentBlock);
+      if (byValue[i]) {
+        values[i] = new llvm::LoadInst(values[i]->getType()->getPointerElementType(), values[i], "", CurrentBlock);
+      }
+    } else {
+      values[i] = (*this)(patterns[i]).first;
+    }
+  }
+  return values;
+}
+
+void CreateTerm::rootVariable(std::string name) {
+  llvm::Value *val = Substitution.lookup(name);
+  ValueType cat;
+  if (!GCFrame::isRoot(Module, val->getType(), cat)) {
+    return;
+  }
+  llvm::Value *slot = Frame->slot(cat, val->getType());
+  new llvm::StoreInst(val, slot, CurrentBlock);
+  RootedVariables[name] = slot;
+}
+
 void addAbort(llvm::BasicBlock *block, llvm::Module *Module) {
     llvm::FunctionType *AbortType = llvm::FunctionType::get(llvm::Type::getVoidTy(Module->getContext()), false);
     llvm::Function *AbortFunc = getOrInsertFunction(Module, "abort", AbortType);
@@ -937,6 +1244,14 @@ bool makeFunction(std::string name, KOREPattern *pattern, KOREDefinition *defini
       }
     }
     CreateTerm creator = CreateTerm(subst, definition, block, Module, false);
+    ptr<GCFrame> frame;
+    if (GC_SAFEPOINTS) {
+      frame = ptr<GCFrame>(new GCFrame(applyRule));
+      creator.setFrame(frame.get());
+      for (auto &name : paramNames) {
+        creator.rootVariable(name);
+      }
+    }
     llvm::Value *retval = creator(pattern).first;
     if (funcType->getReturnType() == llvm::PointerType::getUnqual(retval->getType())) {
       auto tempAlloc = allocateTerm(retval->getType(), creator.getCurrentBlock(), "koreAllocAlwaysGC");
@@ -952,6 +1267,9 @@ bool makeFunction(std::string name, KOREPattern *pattern, KOREDefinition *defini
       retval = call;
     }
     llvm::ReturnInst::Create(Module->getContext(), retval, creator.getCurrentBlock());
+    if (frame) {
+      frame->finalize();
+    }
     return true;
 }
 
@@ -1018,10 +1336,24 @@ std::string makeApplyRuleFunction(KOREAxiomDeclaration *axiom, KOREDefinition *d
       }
     }
     CreateTerm creator = CreateTerm(subst, definition, block, Module, false);
+    ptr<GCFrame> frame;
+    if (GC_SAFEPOINTS) {
+      frame = ptr<GCFrame>(new GCFrame(applyRule));
+      creator.setFrame(frame.get());
+      for (auto &name : paramNames) {
+        creator.rootVariable(name);
+      }
+    }
+    std::vector<KOREPattern *> patterns;
+    for (auto residual : residuals) {
+      patterns.push_back(residual.pattern);
+    }
+    std::vector<llvm::Value *> values = creator.createTerms(patterns);
     std::vector<llvm::Value *> args;
     std::vector<llvm::Type *> types;
+    i = 0;
     for (auto residual : residuals) {
-      llvm::Value *arg = creator(residual.pattern).first;
+      llvm::Value *arg = values[i++];
       auto sort = dynamic_cast<KORECompositeSort *>(residual.pattern->getSort().get());
       auto cat = sort->getCategory(definition);
       switch (cat.cat) {
@@ -1046,6 +1378,9 @@ std::string makeApplyRuleFunction(KOREAxiomDeclaration *axiom, KOREDefinition *d
     setDebugLoc(retval);
     retval->setCallingConv(llvm::CallingConv::Fast);
     llvm::ReturnInst::Create(Module->getContext(), retval, creator.getCurrentBlock());
+    if (frame) {
+      frame->finalize();
+    }
     return name;
 }
 
@@ -189,7 +189,15 @@ void SwitchNode::codegen(Decision *d) {
         case SortCategory::Map:
         case SortCategory::List:
         case SortCategory::Set:
-          Child = ChildPtr;
+          if (d->Frame) {
+            // the block may move while the collection is held in the frame,
+            // so the frame holds a copy of it rather than its address
+            llvm::Type *CollectionType = ChildPtr->getType()->getPointerElementType();
+            Child = d->Frame->storage(CollectionType);
+            new llvm::StoreInst(new llvm::LoadInst(CollectionType, ChildPtr, "", d->CurrentBlock), Child, d->CurrentBlock);
+          } else {
+            Child = ChildPtr;
+          }
           break;
         default:
           Child = new llvm::LoadInst(ChildPtr->getType()->getPointerElementType(), ChildPtr, binding.first.substr(0, max_name_length), d->CurrentBlock);
@@ -248,10 +256,15 @@ void MakePatternNode::codegen(Decision *d) {
     return;
   }
   llvm::StringMap<llvm::Value *> finalSubst;
+  CreateTerm creator(finalSubst, d->Definition, d->CurrentBlock, d->Module, false);
   for (auto use : uses) {
-    finalSubst[use.first] = d->load(use);
+    if (llvm::Value *slot = d->root(use)) {
+      creator.rootVariable(use.first, slot);
+    } else {
+      finalSubst[use.first] = d->load(use);
+    }
   }
-  CreateTerm creator(finalSubst, d->Definition, d->CurrentBlock, d->Module, false);
+  creator.setFrame(d->Frame);
   llvm::Value *val = creator(pattern).first;
   d->CurrentBlock = creator.getCurrentBlock();
   d->store(std::make_pair(name, type), val);
@@ -316,6 +329,11 @@ void MakeIteratorNode::codegen(Decision *d) {
   args.push_back(arg);
   types.push_back(arg->getType());
   llvm::Type *sretType = getTypeByName(d->Module, "iter");
+  if (d->Frame) {
+    // the iterator points into the collection, which must not move until the
+    // function commits to one of its choices
+    d->Frame->beginUnsafe(d->CurrentBlock);
+  }
   llvm::Value *AllocSret = allocateTerm(sretType, d->CurrentBlock, "koreAllocAlwaysGC");
   AllocSret->setName(name.substr(0, max_name_length));
   args.insert(args.begin(), AllocSret);
@@ -365,6 +383,10 @@ void LeafNode::codegen(Decision *d) {
     setCompleted();
     return;
   }
+  if (d->Frame && child == nullptr) {
+    // the function no longer backtracks once it reaches a leaf
+    d->Frame->endUnsafe(d->CurrentBlock);
+  }
   std::vector<llvm::Value *> args;
   std::vector<llvm::Type *> types;
   for (auto arg : bindings) {
@@ -396,18 +418,42 @@ llvm::Value *Decision::getTag(llvm::Value *val) {
   return res;
 }
 
-llvm::AllocaInst *Decision::decl(var_type name) {
-  auto sym = new llvm::AllocaInst(name.second, 0, "", this->CurrentBlock->getParent()->getEntryBlock().getFirstNonPHI());
+llvm::Value *Decision::decl(var_type name) {
+  llvm::Value *sym;
+  ValueType cat;
+  if (Frame && GCFrame::isRoot(Module, name.second, cat)) {
+    sym = Frame->slot(cat, name.second);
+  } else {
+    sym = new llvm::AllocaInst(name.second, 0, "", this->CurrentBlock->getParent()->getEntryBlock().getFirstNonPHI());
+  }
   this->symbols[name] = sym;
   return sym;
 }
 
+// returns the root of the frame holding the specified variable, or null if it
+// is not held in the frame
+llvm::Value *Decision::root(var_type name) {
+  ValueType cat;
+  if (!Frame || !GCFrame::isRoot(Module, name.second, cat)) {
+    return nullptr;
+  }
+  auto sym = this->symbols[name];
+  if (!sym) {
+    sym = this->decl(name);
+  }
+  return sym;
+}
+
 llvm::Value *Decision::load(var_type name) {
+  return load(name, this->CurrentBlock);
+}
+
+llvm::Value *Decision::load(var_type name, llvm::BasicBlock *block) {
   auto sym = this->symbols[name];
   if (!sym) {
     sym = this->decl(name);
   }
-  return new llvm::LoadInst(sym->getType()->getPointerElementType(), sym, name.first.substr(0, max_name_length), this->CurrentBlock);
+  return new llvm::LoadInst(sym->getType()->getPointerElementType(), sym, name.first.substr(0, max_name_length), block);
 }
 
 void Decision::store(var_type name, llvm::Value *val) {
@@ -501,6 +547,11 @@ void makeEvalOrAnywhereFunction(KORESymbol *function, KOREDefinition *definition
 
   int i = 0;
   Decision codegen(definition, block, fail, jump, choiceBuffer, choiceDepth, module, returnSort, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
+  ptr<GCFrame> frame;
+  if (GC_SAFEPOINTS) {
+    frame = ptr<GCFrame>(new GCFrame(matchFunc));
+    codegen.setFrame(frame.get());
+  }
   for (auto val = matchFunc->arg_begin(); val != matchFunc->arg_end(); ++val, ++i) {
     val->setName("_" + std::to_string(i+1));
     codegen.store(std::make_pair(val->getName().str(), val->getType()), val);
@@ -508,9 +559,15 @@ void makeEvalOrAnywhereFunction(KORESymbol *function, KOREDefinition *definition
     function->getArguments()[i]->print(Out);
     initDebugParam(matchFunc, i, val->getName().str(), cats[i], Out.str());
   }
+  if (frame) {
+    frame->safepoint(block);
+  }
   addStuck(stuck, module, function, codegen, definition);
 
   codegen(dt);
+  if (frame) {
+    frame->finalize();
+  }
 }
 
 void abortWhenStuck(llvm::BasicBlock *CurrentBlock, llvm::Module *Module, KORESymbol *symbol, Decision &codegen, KOREDefinition *d) {
@@ -528,6 +585,7 @@ void abortWhenStuck(llvm::BasicBlock *CurrentBlock, llvm::Module *Module, KORESy
     llvm::Value *Block = allocateTerm(BlockType, CurrentBlock);
     llvm::Value *BlockHeaderPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, Block, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0), llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 0)}, symbol->getName(), CurrentBlock);
     new llvm::StoreInst(BlockHeader, BlockHeaderPtr, CurrentBlock);
+    clearCachedHash(BlockType, Block, CurrentBlock);
     for (int idx = 0; idx < symbol->getArguments().size(); idx++) {
       auto cat = dynamic_cast<KORECompositeSort *>(symbol->getArguments()[idx].get())->getCategory(d);
       auto type = getParamType(cat, Module);
@@ -629,6 +687,7 @@ std::pair<std::vector<llvm::Value *>, llvm::BasicBlock *> stepFunctionHeader(uns
     i++;
   }
   auto arr = module->getOrInsertGlobal("gc_roots", llvm::ArrayType::get(llvm::Type::getInt8PtrTy(module->getContext()), 256));
+  llvm::cast<llvm::GlobalVariable>(arr)->setThreadLocal(true);
   std::vector<llvm::Value *> rootPtrs;
   for (unsigned i = 0; i < nroots; i++) {
     auto ptr = llvm::GetElementPtrInst::CreateInBounds(llvm::dyn_cast<llvm::PointerType>(arr->getType())->getElementType(), arr, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(module->getContext()), 0), llvm::ConstantInt::get(llvm::Type::getInt64Ty(module->getContext()), i)}, "", collect);
@@ -744,11 +803,19 @@ void makeStepFunction(KOREDefinition *definition, llvm::Module *module, Decision
   initChoiceBuffer(dt, module, block, pre_stuck, fail, &choiceBuffer, &choiceDepth, &jump);
 
   initDebugParam(matchFunc, 0, "subject", {SortCategory::Symbol, 0}, "SortGeneratedTopCell{}");
-  llvm::BranchInst::Create(stuck, pre_stuck);
+  ptr<GCFrame> frame;
+  // the results of a search are not held in the frame
+  bool safe = !search;
+  if (GC_SAFEPOINTS) {
+    frame = ptr<GCFrame>(new GCFrame(matchFunc, safe));
+  }
   auto result = stepFunctionHeader(0, module, definition, block, stuck, {val}, {{SortCategory::Symbol, 0}});
   auto collectedVal = result.first[0];
   collectedVal->setName("_1");
   Decision codegen(definition, result.second, fail, jump, choiceBuffer, choiceDepth, module, {SortCategory::Symbol, 0}, nullptr, nullptr, nullptr, resultBuffer, resultCount, resultCapacity);
+  if (frame && safe) {
+    codegen.setFrame(frame.get());
+  }
   codegen.store(std::make_pair(collectedVal->getName().str(), collectedVal->getType()), collectedVal);
   if (search) {
     auto result = new llvm::LoadInst(bufType, resultBuffer, "", stuck);
@@ -756,26 +823,28 @@ void makeStepFunction(KOREDefinition *definition, llvm::Module *module, Decision
   }  else {
     auto phi = llvm::PHINode::Create(collectedVal->getType(), 2, "phi_1", stuck);
     phi->addIncoming(val, block);
-    phi->addIncoming(collectedVal, pre_stuck);
+    // the subject may have been moved by a collection since it was stored
+    phi->addIncoming(codegen.load(std::make_pair(collectedVal->getName().str(), collectedVal->getType()), pre_stuck), pre_stuck);
     llvm::ReturnInst::Create(module->getContext(), phi, stuck);
   }
+  llvm::BranchInst::Create(stuck, pre_stuck);
 
   codegen(dt);
+  if (frame) {
+    frame->finalize();
+  }
 }
 
-void makeMatchReasonFunction(KOREDefinition *definition, llvm::Module *module, KOREAxiomDeclaration *axiom, DecisionNode *dt) {
+static void makeMatchFunction(KOREDefinition *definition, llvm::Module *module, std::string name, std::string debugName, DecisionNode *dt, bool fastcc) {
   auto blockType = getValueType({SortCategory::Symbol, 0}, module);
   llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getVoidTy(module->getContext()), {blockType}, false);
-  std::string name = "match_" + std::to_string(axiom->getOrdinal());
   llvm::Function *matchFunc = getOrInsertFunction(module, name, funcType);
-  std::string debugName = name;
-  if (axiom->getAttributes().count("label")) {
-    debugName = axiom->getStringAttribute("label") + ".match";
-  }
   auto debugType = getDebugType({SortCategory::Symbol, 0}, "SortGeneratedTopCell{}");
   resetDebugLoc();
   initDebugFunction(debugName, debugName, getDebugFunctionType(getVoidDebugType(), {debugType}), definition, matchFunc);
-  matchFunc->setCallingConv(llvm::CallingConv::Fast);
+  if (fastcc) {
+    matchFunc->setCallingConv(llvm::CallingConv::Fast);
+  }
   auto val = matchFunc->arg_begin();
   llvm::BasicBlock *block = llvm::BasicBlock::Create(module->getContext(), "entry", matchFunc);
   llvm::BasicBlock *stuck = llvm::BasicBlock::Create(module->getContext(), "stuck", matchFunc);
@@ -795,13 +864,33 @@ void makeMatchReasonFunction(KOREDefinition *definition, llvm::Module *module, K
   llvm::BranchInst::Create(stuck, pre_stuck);
   val->setName("_1");
   Decision codegen(definition, block, fail, jump, choiceBuffer, choiceDepth, module, {SortCategory::Symbol, 0}, FailSubject, FailPattern, FailSort, nullptr, nullptr, nullptr);
+  ptr<GCFrame> frame;
+  if (GC_SAFEPOINTS) {
+    // the reasons for failing to match refer to the terms they are about
+    frame = ptr<GCFrame>(new GCFrame(matchFunc, false));
+  }
   codegen.store(std::make_pair(val->getName().str(), val->getType()), val);
   llvm::ReturnInst::Create(module->getContext(), stuck);
 
   codegen(dt);
+  if (frame) {
+    frame->finalize();
+  }
 }
 
+void makeMatchReasonFunction(KOREDefinition *definition, llvm::Module *module, KOREAxiomDeclaration *axiom, DecisionNode *dt) {
+  std::string name = "match_" + std::to_string(axiom->getOrdinal());
+  std::string debugName = name;
+  if (axiom->getAttributes().count("label")) {
+    debugName = axiom->getStringAttribute("label") + ".match";
+  }
+  makeMatchFunction(definition, module, name, debugName, dt, true);
+}
 
+void makeSearchGoalFunction(KOREDefinition *definition, llvm::Module *module, DecisionNode *dt) {
+  // called by the search in the runtime, hence the C calling convention
+  makeMatchFunction(definition, module, "match_search_goal", "search_goal.match", dt, false);
+}
 
 // TODO: actually collect the return value of this function. Right now it
 // assumes that it will never be collected and constructs a unique_ptr pointing
@@ -867,7 +956,10 @@ void makeStepFunction(KOREAxiomDeclaration *axiom, KOREDefinition *definition, l
   llvm::IndirectBrInst *jump;
   initChoiceBuffer(res.dt, module, block, pre_stuck, fail, &choiceBuffer, &choiceDepth, &jump);
 
-  llvm::BranchInst::Create(stuck, pre_stuck);
+  ptr<GCFrame> frame;
+  if (GC_SAFEPOINTS) {
+    frame = ptr<GCFrame>(new GCFrame(matchFunc));
+  }
   std::vector<llvm::PHINode *> phis;
   int i = 0;
   std::vector<llvm::Value *> args;
@@ -887,21 +979,34 @@ void makeStepFunction(KOREAxiomDeclaration *axiom, KOREDefinition *definition, l
   auto header = stepFunctionHeader(axiom->getOrdinal(), module, definition, block, stuck, args, types);
   i = 0;
   Decision codegen(definition, header.second, fail, jump, choiceBuffer, choiceDepth, module, {SortCategory::Symbol, 0}, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
+  if (frame) {
+    codegen.setFrame(frame.get());
+  }
   for (auto val : header.first) {
     val->setName(res.residuals[i].occurrence.substr(0, max_name_length));
     codegen.store(std::make_pair(val->getName().str(), val->getType()), val);
     stuckSubst.insert({val->getName(), phis[i]});
-    phis[i++]->addIncoming(val, pre_stuck);
+    phis[i++]->addIncoming(codegen.load(std::make_pair(val->getName().str(), val->getType()), pre_stuck), pre_stuck);
   }
+  llvm::BranchInst::Create(stuck, pre_stuck);
   std::set<std::string> occurrences;
   for (auto residual : res.residuals) {
     occurrences.insert(residual.occurrence);
   }
   KOREPattern *partialTerm = makePartialTerm(dynamic_cast<KOREPattern *>(axiom->getRightHandSide()), occurrences, "_1");
   CreateTerm creator(stuckSubst, definition, stuck, module, false);
+  if (frame) {
+    creator.setFrame(frame.get());
+    for (auto &entry : stuckSubst) {
+      creator.rootVariable(entry.first().str());
+    }
+  }
   llvm::Value *retval = creator(partialTerm).first;
   llvm::ReturnInst::Create(module->getContext(), retval, creator.getCurrentBlock());
 
   codegen(res.dt);
+  if (frame) {
+    frame->finalize();
+  }
 }
 }
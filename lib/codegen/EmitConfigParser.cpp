@@ -7,6 +7,9 @@
 #include "llvm/IR/Instructions.h"
 
 #include "runtime/header.h"
+#include "runtime/name_table.h"
+
+#include <algorithm>
 
 namespace kllvm {
 
@@ -29,13 +32,6 @@ static llvm::Constant *getSymbolNamePtr(KORESymbol *symbol, llvm::BasicBlock *Se
   return Ptr;
 }
 
-static llvm::Function *getStrcmp(llvm::Module *module) {
-llvm::LLVMContext &Ctx = module->getContext();
-  auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(Ctx),
-      {llvm::Type::getInt8PtrTy(Ctx), llvm::Type::getInt8PtrTy(Ctx)}, false);
-  return getOrInsertFunction(module, "strcmp", type);
-}
-
 static llvm::Function *getPuts(llvm::Module *module) {
 llvm::LLVMContext &Ctx = module->getContext();
   auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(Ctx),
@@ -43,38 +39,154 @@ llvm::LLVMContext &Ctx = module->getContext();
   return getOrInsertFunction(module, "puts", type);
 }
 
+static llvm::Constant *getSortNamePtr(std::string name, llvm::Module *module) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto Str = llvm::ConstantDataArray::getString(Ctx, name, true);
+  auto global = module->getOrInsertGlobal("sort_name_" + name, Str->getType());
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(Str);
+  }
+  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
+  auto indices = std::vector<llvm::Constant *>{zero, zero};
+  return llvm::ConstantExpr::getInBoundsGetElementPtr(Str->getType(), globalVar, indices);
+}
 
-static void emitGetTagForSymbolName(KOREDefinition *definition, llvm::Module *module) {
+static std::string NAME_TABLE_STRUCT = "name_table";
+
+static llvm::Constant *getArrayPtr(std::string name, llvm::Constant *Arr, llvm::Module *module) {
   llvm::LLVMContext &Ctx = module->getContext();
-  auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(Ctx), {llvm::Type::getInt8PtrTy(Ctx)}, false);
-  auto func = getOrInsertFunction(module, "getTagForSymbolNameInternal",
-      type);
-  auto CurrentBlock = llvm::BasicBlock::Create(Ctx, "");
-  auto MergeBlock = llvm::BasicBlock::Create(Ctx, "exit");
-  auto Phi = llvm::PHINode::Create(llvm::Type::getInt32Ty(Ctx), definition->getSymbols().size(), "phi", MergeBlock);
-  auto &syms = definition->getAllSymbols();
-  llvm::Function *Strcmp = getStrcmp(module);
-  for (auto iter = syms.begin(); iter != syms.end(); ++iter) {
-    auto &entry = *iter;
-    uint32_t tag = entry.second->getTag();
+  auto global = module->getOrInsertGlobal(name, Arr->getType());
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
+  globalVar->setConstant(true);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(Arr);
+  }
+  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
+  auto indices = std::vector<llvm::Constant *>{zero, zero};
+  return llvm::ConstantExpr::getInBoundsGetElementPtr(Arr->getType(), globalVar, indices);
+}
+
+bool buildNameTable(const std::vector<uint64_t> &hashes, uint64_t nbuckets, uint64_t maxAttempts, std::vector<uint32_t> &displacements, std::vector<int64_t> &slots) {
+  uint64_t nkeys = hashes.size();
+  std::vector<std::vector<size_t>> buckets(nbuckets);
+  for (size_t i = 0; i < nkeys; i++) {
+    buckets[name_table_bucket(hashes[i], nbuckets)].push_back(i);
+  }
+  std::vector<size_t> order;
+  for (size_t i = 0; i < nbuckets; i++) {
+    order.push_back(i);
+    auto &bucket = buckets[i];
+    for (size_t j = 0; j < bucket.size(); j++) {
+      for (size_t k = j + 1; k < bucket.size(); k++) {
+        if (hashes[bucket[j]] == hashes[bucket[k]]) {
+          // no displacement can separate them
+          return false;
+        }
+      }
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+  displacements.assign(nbuckets, 0);
+  slots.assign(nkeys, -1);
+  uint64_t attempts = 0;
+  for (size_t b : order) {
+    auto &bucket = buckets[b];
+    if (bucket.empty()) {
+      break;
+    }
+    std::vector<uint64_t> candidate;
+    for (uint32_t d = 0;; d++) {
+      if (attempts++ == maxAttempts) {
+        return false;
+      }
+      candidate.clear();
+      bool ok = true;
+      for (size_t i : bucket) {
+        uint64_t slot = name_table_slot(hashes[i], d, nkeys);
+        if (slots[slot] != -1 || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+          ok = false;
+          break;
+        }
+        candidate.push_back(slot);
+      }
+      if (ok) {
+        displacements[b] = d;
+        for (size_t j = 0; j < bucket.size(); j++) {
+          slots[candidate[j]] = bucket[j];
+        }
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+llvm::Constant *emitNameTable(std::string name, const std::vector<NameTableEntry> &entries, llvm::Module *module, uint64_t maxAttempts) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  uint64_t nkeys = entries.size();
+  uint64_t nbuckets = nkeys / 4 + 1;
+  std::vector<uint64_t> hashes;
+  for (auto &entry : entries) {
+    hashes.push_back(hash_name(entry.name.c_str()));
+  }
+  std::vector<uint32_t> displacements;
+  std::vector<int64_t> slots;
+  if (!buildNameTable(hashes, nbuckets, maxAttempts, displacements, slots)) {
+    nbuckets = 0;
+    displacements.clear();
+    slots.clear();
+    for (size_t i = 0; i < nkeys; i++) {
+      slots.push_back(i);
+    }
+  }
+  std::vector<llvm::Constant *> displacementValues, keys, values;
+  for (uint32_t d : displacements) {
+    displacementValues.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), d));
+  }
+  for (int64_t i : slots) {
+    keys.push_back(entries[i].ptr);
+    values.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), entries[i].value));
+  }
+  llvm::Constant *DisplacementsPtr = llvm::ConstantPointerNull::get(llvm::Type::getInt32PtrTy(Ctx));
+  if (nbuckets) {
+    DisplacementsPtr = getArrayPtr(name + "_displacements", llvm::ConstantArray::get(llvm::ArrayType::get(llvm::Type::getInt32Ty(Ctx), nbuckets), displacementValues), module);
+  }
+  auto KeysPtr = getArrayPtr(name + "_keys", llvm::ConstantArray::get(llvm::ArrayType::get(llvm::Type::getInt8PtrTy(Ctx), nkeys), keys), module);
+  auto ValuesPtr = getArrayPtr(name + "_values", llvm::ConstantArray::get(llvm::ArrayType::get(llvm::Type::getInt32Ty(Ctx), nkeys), values), module);
+  auto TableType = getTypeByName(module, NAME_TABLE_STRUCT);
+  auto global = module->getOrInsertGlobal(name, TableType);
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
+  globalVar->setConstant(true);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(llvm::ConstantStruct::get(TableType,
+        llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), nkeys),
+        llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), nbuckets),
+        DisplacementsPtr, KeysPtr, ValuesPtr));
+  }
+  return globalVar;
+}
+
+static llvm::Constant *emitNameTable(std::string name, const std::vector<NameTableEntry> &entries, llvm::Module *module) {
+  return emitNameTable(name, entries, module, NAME_TABLE_ATTEMPTS_PER_KEY * entries.size() + NAME_TABLE_MIN_ATTEMPTS);
+}
+
+static llvm::Function *getLookupNameTable(llvm::Module *module) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto type = llvm::FunctionType::get(llvm::Type::getInt1Ty(Ctx),
+      {llvm::PointerType::getUnqual(getTypeByName(module, NAME_TABLE_STRUCT)), llvm::Type::getInt8PtrTy(Ctx), llvm::Type::getInt32PtrTy(Ctx)}, false);
+  return getOrInsertFunction(module, "lookupNameTable", type);
+}
+
+static void emitGetTagForSymbolName(KOREDefinition *definition, llvm::Module *module) {
+  std::vector<NameTableEntry> entries;
+  for (auto &entry : definition->getAllSymbols()) {
     auto symbol = entry.second;
-    CurrentBlock->insertInto(func);
-    auto Ptr = getSymbolNamePtr(symbol, CurrentBlock, module);
-    auto compare = llvm::CallInst::Create(Strcmp, {func->arg_begin(), Ptr}, "", CurrentBlock);
-    auto icmp = new llvm::ICmpInst(*CurrentBlock, llvm::CmpInst::ICMP_EQ, 
-       compare, llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 0));
-    auto FalseBlock = llvm::BasicBlock::Create(Ctx, "");
-    llvm::BranchInst::Create(MergeBlock, FalseBlock, icmp, CurrentBlock);
-    Phi->addIncoming(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), tag), CurrentBlock);
-    CurrentBlock = FalseBlock;
+    entries.push_back({entry.first, getSymbolNamePtr(symbol, nullptr, module), symbol->getTag()});
   }
-  llvm::ReturnInst::Create(Ctx, Phi, MergeBlock);
-  MergeBlock->insertInto(func);
-  llvm::Function *Puts = getPuts(module);
-  llvm::CallInst::Create(Puts, {func->arg_begin()}, "", CurrentBlock);
-  addAbort(CurrentBlock, module);
-  CurrentBlock->setName("stuck");
-  CurrentBlock->insertInto(func);
+  emitNameTable("symbol_name_table", entries, module);
 }
 
 static std::string BLOCKHEADER_STRUCT = "blockheader";
@@ -102,6 +214,7 @@ static void emitDataTableForSymbol(std::string name, llvm::Type *ty, llvm::DITyp
   auto tableType = llvm::ArrayType::get(ty, syms.size());
   auto table = module->getOrInsertGlobal("table_" + name, tableType);
   llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(table);
+  globalVar->setConstant(true);
   initDebugGlobal("table_" + name, getArrayDebugType(dity, syms.size(), llvm::DataLayout(module).getABITypeAlignment(ty)), globalVar);
   std::vector<llvm::Constant *> values;
   for (auto iter = syms.begin(); iter != syms.end(); ++iter) {
@@ -140,6 +253,12 @@ static void emitDataForSymbol(std::string name, llvm::Type *ty, llvm::DIType *di
     initDebugFunction(name, name, getDebugFunctionType(dity, {getIntDebugType()}), definition, func);
   }
   auto EntryBlock = llvm::BasicBlock::Create(Ctx, "entry", func);
+  ptr<GCFrame> frame;
+  if (isEval && GC_SAFEPOINTS) {
+    // the callers of evaluateFunctionSymbol in the runtime hold terms the
+    // garbage collector does not know about
+    frame = ptr<GCFrame>(new GCFrame(func, false));
+  }
   auto MergeBlock = llvm::BasicBlock::Create(Ctx, "exit");
   auto stuck = llvm::BasicBlock::Create(Ctx, "stuck");
   auto &syms = definition->getSymbols();
@@ -164,17 +283,20 @@ static void emitDataForSymbol(std::string name, llvm::Type *ty, llvm::DIType *di
   MergeBlock->insertInto(func);
   addAbort(stuck, module);
   stuck->insertInto(func);
+  if (frame) {
+    frame->finalize();
+  }
 }
 
-static std::pair<llvm::Value *, llvm::BasicBlock *> getHeader(KOREDefinition *definition, llvm::Module *module,
-    KORESymbol *symbol, llvm::Instruction *inst) {
+static llvm::Constant *getHeader(KOREDefinition *definition, llvm::Module *module,
+    KORESymbol *symbol) {
   auto BlockType = getBlockType(module, definition, symbol);
-  return std::make_pair(getBlockHeader(module, definition, symbol, BlockType), inst->getParent());
+  return llvm::cast<llvm::Constant>(getBlockHeader(module, definition, symbol, BlockType));
 }
 
 static void emitGetBlockHeaderForSymbol(KOREDefinition *def, llvm::Module *mod) {
-  emitDataForSymbol("getBlockHeaderForSymbol", getTypeByName(mod, BLOCKHEADER_STRUCT), getForwardDecl(BLOCKHEADER_STRUCT),
-      def, mod, false, getHeader);
+  emitDataTableForSymbol("getBlockHeaderForSymbol", getTypeByName(mod, BLOCKHEADER_STRUCT), getForwardDecl(BLOCKHEADER_STRUCT),
+      def, mod, getHeader);
 }
 
 static std::pair<llvm::Value *, llvm::BasicBlock *> getFunction(KOREDefinition *def, llvm::Module *mod,
@@ -313,53 +435,15 @@ static void emitEvaluateFunctionSymbol(KOREDefinition *def, llvm::Module *mod) {
 }
 
 static void emitGetTagForFreshSort(KOREDefinition *definition, llvm::Module *module) {
-  llvm::LLVMContext &Ctx = module->getContext();
-  auto func = getOrInsertFunction(module,
-      "getTagForFreshSort", llvm::Type::getInt32Ty(Ctx), llvm::Type::getInt8PtrTy(Ctx));
-  auto CurrentBlock = llvm::BasicBlock::Create(Ctx, "");
-  auto MergeBlock = llvm::BasicBlock::Create(Ctx, "exit");
-  auto Phi = llvm::PHINode::Create(llvm::Type::getInt32Ty(Ctx), definition->getSortDeclarations().size(), "phi", MergeBlock);
-  auto &sorts = definition->getSortDeclarations();
-  llvm::Function *Strcmp = getStrcmp(module);
-  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
-  llvm::Constant *zero32 = llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 0);
-  bool hasCase = false;
-  for (auto iter = sorts.begin(); iter != sorts.end(); ++iter) {
-    auto &entry = *iter;
+  std::vector<NameTableEntry> entries;
+  for (auto &entry : definition->getFreshFunctions()) {
     std::string name = entry.first;
-    if (!definition->getFreshFunctions().count(name)) {
-      continue;
-    }
-    hasCase = true;
-    CurrentBlock->insertInto(func);
-    CurrentBlock->setName("is_" + name);
-    auto Str = llvm::ConstantDataArray::getString(Ctx, name, true);
-    auto global = module->getOrInsertGlobal("sort_name_" + name, Str->getType());
-    llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
-    if (!globalVar->hasInitializer()) {
-      globalVar->setInitializer(Str);
-    }
-    auto indices = std::vector<llvm::Constant *>{zero, zero};
-    auto Ptr = llvm::ConstantExpr::getInBoundsGetElementPtr(Str->getType(), globalVar, indices);
-    auto compare = llvm::CallInst::Create(Strcmp, {func->arg_begin(), Ptr}, "", CurrentBlock);
-    auto icmp = new llvm::ICmpInst(*CurrentBlock, llvm::CmpInst::ICMP_EQ, 
-       compare, zero32);
-    auto FalseBlock = llvm::BasicBlock::Create(Ctx, "");
-    auto CaseBlock = llvm::BasicBlock::Create(Ctx, name, func);
-    llvm::BranchInst::Create(CaseBlock, FalseBlock, icmp, CurrentBlock);
-    auto symbol = definition->getFreshFunctions().at(name);
+    auto symbol = entry.second;
     std::ostringstream Out;
     symbol->print(Out);
-    Phi->addIncoming(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), definition->getAllSymbols().at(Out.str())->getTag()), CaseBlock);
-    llvm::BranchInst::Create(MergeBlock, CaseBlock);
-    CurrentBlock = FalseBlock;
-  }
-  CurrentBlock->insertInto(func);
-  addAbort(CurrentBlock, module);
-  if (hasCase) {
-    llvm::ReturnInst::Create(Ctx, Phi, MergeBlock);
-    MergeBlock->insertInto(func);
+    entries.push_back({name, getSortNamePtr(name, module), definition->getAllSymbols().at(Out.str())->getTag()});
   }
+  emitNameTable("fresh_sort_table", entries, module);
 }
 
 
@@ -368,11 +452,16 @@ static void emitGetToken(KOREDefinition *definition, llvm::Module *module) {
   auto getTokenType = llvm::FunctionType::get(llvm::Type::getInt8PtrTy(Ctx), { llvm::Type::getInt8PtrTy(Ctx),
       llvm::Type::getInt64Ty(Ctx), llvm::Type::getInt8PtrTy(Ctx) }, false);
   auto func = getOrInsertFunction(module, "getToken", getTokenType);
-  auto CurrentBlock = llvm::BasicBlock::Create(Ctx, "");
+  auto EntryBlock = llvm::BasicBlock::Create(Ctx, "entry", func);
+  auto DispatchBlock = llvm::BasicBlock::Create(Ctx, "dispatch", func);
+  auto SymbolBlock = llvm::BasicBlock::Create(Ctx, "symbol");
   auto MergeBlock = llvm::BasicBlock::Create(Ctx, "exit");
   auto Phi = llvm::PHINode::Create(llvm::Type::getInt8PtrTy(Ctx), definition->getSortDeclarations().size(), "phi", MergeBlock);
   auto &sorts = definition->getSortDeclarations();
-  llvm::Function *Strcmp = getStrcmp(module);
+  auto SortIdx = new llvm::AllocaInst(llvm::Type::getInt32Ty(Ctx), 0, "sort_idx", EntryBlock);
+  auto Idx = new llvm::LoadInst(llvm::Type::getInt32Ty(Ctx), SortIdx, "", DispatchBlock);
+  auto Switch = llvm::SwitchInst::Create(Idx, SymbolBlock, sorts.size(), DispatchBlock);
+  std::vector<NameTableEntry> entries;
   llvm::Function *StringEqual = getOrInsertFunction(module, "string_equal", 
       llvm::Type::getInt1Ty(Ctx), llvm::Type::getInt8PtrTy(Ctx),
       llvm::Type::getInt8PtrTy(Ctx), llvm::Type::getInt64Ty(Ctx),
@@ -391,22 +480,9 @@ static void emitGetToken(KOREDefinition *definition, llvm::Module *module) {
     if (cat.cat == SortCategory::Symbol || cat.cat == SortCategory::Variable) {
       continue;
     }
-    CurrentBlock->insertInto(func);
-    CurrentBlock->setName("is_" + name);
-    auto Str = llvm::ConstantDataArray::getString(Ctx, name, true);
-    auto global = module->getOrInsertGlobal("sort_name_" + name, Str->getType());
-    llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
-    if (!globalVar->hasInitializer()) {
-      globalVar->setInitializer(Str);
-    }
-    auto indices = std::vector<llvm::Constant *>{zero, zero};
-    auto Ptr = llvm::ConstantExpr::getInBoundsGetElementPtr(Str->getType(), globalVar, indices);
-    auto compare = llvm::CallInst::Create(Strcmp, {func->arg_begin(), Ptr}, "", CurrentBlock);
-    auto icmp = new llvm::ICmpInst(*CurrentBlock, llvm::CmpInst::ICMP_EQ, 
-       compare, zero32);
-    auto FalseBlock = llvm::BasicBlock::Create(Ctx, "");
     auto CaseBlock = llvm::BasicBlock::Create(Ctx, name, func);
-    llvm::BranchInst::Create(CaseBlock, FalseBlock, icmp, CurrentBlock);
+    Switch->addCase(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), entries.size()), CaseBlock);
+    entries.push_back({name, getSortNamePtr(name, module), (uint32_t)entries.size()});
     switch(cat.cat) {
     case SortCategory::Map:
     case SortCategory::List:
@@ -425,6 +501,7 @@ static void emitGetToken(KOREDefinition *definition, llvm::Module *module) {
       if (!globalVar->hasInitializer()) {
         globalVar->setInitializer(Str);
       }
+      auto indices = std::vector<llvm::Constant *>{zero, zero};
       auto Ptr = llvm::ConstantExpr::getInBoundsGetElementPtr(Str->getType(), globalVar, indices);
       auto Len = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 4);
       auto compare = llvm::CallInst::Create(StringEqual,
@@ -491,9 +568,11 @@ static void emitGetToken(KOREDefinition *definition, llvm::Module *module) {
     case SortCategory::Uncomputed:
       abort();
     }
-    CurrentBlock = FalseBlock;
   }
-  CurrentBlock->setName("symbol");
+  auto table = emitNameTable("token_sort_table", entries, module);
+  auto Found = llvm::CallInst::Create(getLookupNameTable(module), {table, func->arg_begin(), SortIdx}, "", EntryBlock);
+  llvm::BranchInst::Create(DispatchBlock, SymbolBlock, Found, EntryBlock);
+  auto CurrentBlock = SymbolBlock;
   CurrentBlock->insertInto(func);
   auto StringType = getTypeByName(module, STRING_STRUCT);
   auto Len = llvm::BinaryOperator::Create(llvm::Instruction::Add,
@@ -613,6 +692,7 @@ static void getStore(KOREDefinition *definition, llvm::Module *module, KORESymbo
     }
     new llvm::StoreInst(arg, ChildPtr, CaseBlock);
   }
+  clearCachedHash(BlockType, cast, CaseBlock);
 }
 
 static void emitStoreSymbolChildren(KOREDefinition *definition, llvm::Module *module) {
@@ -776,30 +856,331 @@ static void emitLayouts(KOREDefinition *definition, llvm::Module *module) {
     layouts[entry.second->getLayout()] = entry.second;
   }
   llvm::LLVMContext &Ctx = module->getContext();
+  auto ty = llvm::PointerType::getUnqual(getTypeByName(module, LAYOUT_STRUCT));
+  auto dity = getPointerDebugType(getForwardDecl(LAYOUT_STRUCT), "layout *");
+  uint16_t maxLayout = layouts.empty() ? 0 : layouts.rbegin()->first;
+  // layout_table is indexed directly by layout code; codes that do not
+  // correspond to any symbol (e.g. 0, used for strings) map to null.
+  std::vector<llvm::Constant *> values(maxLayout + 1, llvm::ConstantPointerNull::get(ty));
+  for (auto iter = layouts.begin(); iter != layouts.end(); ++iter) {
+    auto entry = *iter;
+    values[entry.first] = getLayoutData(entry.first, entry.second, module, definition);
+  }
+  auto tableType = llvm::ArrayType::get(ty, values.size());
+  auto table = module->getOrInsertGlobal("layout_table", tableType);
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(table);
+  globalVar->setConstant(true);
+  initDebugGlobal("layout_table", getArrayDebugType(dity, values.size(), llvm::DataLayout(module).getABITypeAlignment(ty)), globalVar);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(llvm::ConstantArray::get(tableType, values));
+  }
+
   std::vector<llvm::Type *> argTypes;
   argTypes.push_back(llvm::Type::getInt16Ty(Ctx));
   auto func = llvm::dyn_cast<llvm::Function>(getOrInsertFunction(module,
-      "getLayoutData", llvm::FunctionType::get(llvm::PointerType::getUnqual(getTypeByName(module, LAYOUT_STRUCT)), argTypes, false)));
-  initDebugFunction("getLayoutData", "getLayoutData", getDebugFunctionType(getPointerDebugType(getForwardDecl(LAYOUT_STRUCT), "layout *"), {getShortDebugType()}), definition, func);
+      "getLayoutData", llvm::FunctionType::get(ty, argTypes, false)));
+  initDebugFunction("getLayoutData", "getLayoutData", getDebugFunctionType(dity, {getShortDebugType()}), definition, func);
   auto EntryBlock = llvm::BasicBlock::Create(Ctx, "entry", func);
   auto MergeBlock = llvm::BasicBlock::Create(Ctx, "exit");
   auto stuck = llvm::BasicBlock::Create(Ctx, "stuck");
-  auto Switch = llvm::SwitchInst::Create(func->arg_begin(), stuck, layouts.size(), EntryBlock);
-  auto Phi = llvm::PHINode::Create(llvm::PointerType::getUnqual(getTypeByName(module, LAYOUT_STRUCT)), layouts.size(), "phi", MergeBlock);
+  auto icmp = new llvm::ICmpInst(*EntryBlock, llvm::CmpInst::ICMP_ULE, func->arg_begin(), llvm::ConstantInt::get(llvm::Type::getInt16Ty(Ctx), maxLayout));
+  llvm::BranchInst::Create(MergeBlock, stuck, icmp, EntryBlock);
+  auto offset = new llvm::ZExtInst(func->arg_begin(), llvm::Type::getInt64Ty(Ctx), "", MergeBlock);
+  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
+  auto retval = llvm::GetElementPtrInst::Create(
+    tableType, globalVar, {zero, offset}, "", MergeBlock);
+  MergeBlock->insertInto(func);
+  auto load = new llvm::LoadInst(retval->getType()->getPointerElementType(), retval, "", MergeBlock);
+  llvm::ReturnInst::Create(Ctx, load, MergeBlock);
+  addAbort(stuck, module);
+  stuck->insertInto(func);
+}
+
+static void getScavenger(KOREDefinition *definition, llvm::Module *module, KORESymbol *symbol, llvm::BasicBlock *CaseBlock) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
+  llvm::Function *func = CaseBlock->getParent();
+  auto BlockType = getBlockType(module, definition, symbol);
+  auto cast = new llvm::BitCastInst(func->arg_begin(),
+      llvm::PointerType::getUnqual(BlockType), "", CaseBlock);
+  auto migrateType = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {llvm::Type::getInt8PtrTy(Ctx)}, false);
+  int idx = 2;
+  for (auto &sort : symbol->getArguments()) {
+    ValueType cat = dynamic_cast<KORECompositeSort *>(sort.get())->getCategory(definition);
+    // cf runtime/collect/collect.cpp migrate_child
+    const char *migrateFn;
+    switch(cat.cat) {
+    case SortCategory::Map:
+      migrateFn = "migrate_map";
+      break;
+    case SortCategory::List:
+      migrateFn = "migrate_list";
+      break;
+    case SortCategory::Set:
+      migrateFn = "migrate_set";
+      break;
+    case SortCategory::StringBuffer:
+      migrateFn = "migrate_string_buffer";
+      break;
+    case SortCategory::Symbol:
+    case SortCategory::Variable:
+      migrateFn = "migrate";
+      break;
+    case SortCategory::Int:
+      migrateFn = "migrate_mpz";
+      break;
+    case SortCategory::Float:
+      migrateFn = "migrate_floating";
+      break;
+    case SortCategory::Bool:
+    case SortCategory::MInt:
+      migrateFn = nullptr;
+      break;
+    case SortCategory::Uncomputed:
+      abort();
+    }
+    if (!migrateFn) {
+      idx++;
+      continue;
+    }
+    llvm::Value *ChildPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, cast,
+        {zero, llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), idx++)}, "", CaseBlock);
+    auto arg = new llvm::BitCastInst(ChildPtr, llvm::Type::getInt8PtrTy(Ctx), "", CaseBlock);
+    llvm::CallInst::Create(getOrInsertFunction(module, migrateFn, migrateType), {arg}, "", CaseBlock);
+  }
+  llvm::ReturnInst::Create(Ctx, CaseBlock);
+}
+
+// Emits, for each layout, a function <name>_layout_N built by getter, along
+// with a table <name>_table indexed by layout code. Entries for layout codes
+// which do not correspond to any symbol are null.
+static void emitLayoutFunctions(std::string name, llvm::FunctionType *fnType, KOREDefinition *definition, llvm::Module *module,
+    void getter(KOREDefinition *, llvm::Module *, KORESymbol *, llvm::BasicBlock *)) {
+  std::map<uint16_t, KORESymbol *> layouts;
+  for (auto entry : definition->getSymbols()) {
+    layouts[entry.second->getLayout()] = entry.second;
+  }
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto ty = llvm::PointerType::getUnqual(fnType);
+  uint16_t maxLayout = layouts.empty() ? 0 : layouts.rbegin()->first;
+  std::vector<llvm::Constant *> values(maxLayout + 1, llvm::ConstantPointerNull::get(ty));
   for (auto iter = layouts.begin(); iter != layouts.end(); ++iter) {
     auto entry = *iter;
     uint16_t layout = entry.first;
     auto symbol = entry.second;
-    auto CaseBlock = llvm::BasicBlock::Create(Ctx, "layout" + std::to_string(layout), func);
-    llvm::BranchInst::Create(MergeBlock, CaseBlock);
-    auto data = getLayoutData(layout, symbol, module, definition);
-    Phi->addIncoming(data, CaseBlock);
-    Switch->addCase(llvm::ConstantInt::get(llvm::Type::getInt16Ty(Ctx), layout), CaseBlock);
+    auto func = getOrInsertFunction(module, name + "_layout_" + std::to_string(layout), fnType);
+    auto EntryBlock = llvm::BasicBlock::Create(Ctx, "entry", func);
+    getter(definition, module, symbol, EntryBlock);
+    values[layout] = func;
   }
-  llvm::ReturnInst::Create(Ctx, Phi, MergeBlock);
-  MergeBlock->insertInto(func);
-  addAbort(stuck, module);
-  stuck->insertInto(func);
+  auto tableType = llvm::ArrayType::get(ty, values.size());
+  auto table = module->getOrInsertGlobal(name + "_table", tableType);
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(table);
+  globalVar->setConstant(true);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(llvm::ConstantArray::get(tableType, values));
+  }
+}
+
+// The scavenging functions migrate each child of a block of a given layout,
+// and are used by the garbage collector when evacuating a block instead of
+// interpreting its layoutitem array. cf runtime/collect/collect.cpp evacuate
+static void emitScavengers(KOREDefinition *definition, llvm::Module *module) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto fnType = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {getValueType({SortCategory::Symbol, 0}, module)}, false);
+  emitLayoutFunctions("scavenge", fnType, definition, module, getScavenger);
+}
+
+static llvm::Value *loadChild(llvm::StructType *BlockType, llvm::Value *Block, int idx, llvm::BasicBlock *CaseBlock) {
+  llvm::LLVMContext &Ctx = CaseBlock->getContext();
+  llvm::Constant *zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0);
+  llvm::Value *ChildPtr = llvm::GetElementPtrInst::CreateInBounds(BlockType, Block,
+      {zero, llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), idx)}, "", CaseBlock);
+  if (llvm::isa<llvm::StructType>(ChildPtr->getType()->getPointerElementType())) {
+    // collections are stored inline and passed by pointer
+    return ChildPtr;
+  }
+  return new llvm::LoadInst(ChildPtr->getType()->getPointerElementType(), ChildPtr, "", CaseBlock);
+}
+
+static void getEquals(KOREDefinition *definition, llvm::Module *module, KORESymbol *symbol, llvm::BasicBlock *CaseBlock) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  llvm::Function *func = CaseBlock->getParent();
+  auto BlockType = getBlockType(module, definition, symbol);
+  auto cast1 = new llvm::BitCastInst(func->arg_begin(),
+      llvm::PointerType::getUnqual(BlockType), "", CaseBlock);
+  auto cast2 = new llvm::BitCastInst(func->arg_begin()+1,
+      llvm::PointerType::getUnqual(BlockType), "", CaseBlock);
+  auto False = llvm::BasicBlock::Create(Ctx, "false");
+  // Children that are stored inline as scalars are compared first, without
+  // branching; layouts that contain only such children need no other work.
+  llvm::Value *scalarsEqual = llvm::ConstantInt::getTrue(Ctx);
+  std::vector<std::pair<int, ValueType>> others;
+  int idx = 2;
+  for (auto &sort : symbol->getArguments()) {
+    ValueType cat = dynamic_cast<KORECompositeSort *>(sort.get())->getCategory(definition);
+    if (cat.cat == SortCategory::Bool || cat.cat == SortCategory::MInt) {
+      auto child1 = loadChild(BlockType, cast1, idx, CaseBlock);
+      auto child2 = loadChild(BlockType, cast2, idx, CaseBlock);
+      auto icmp = new llvm::ICmpInst(*CaseBlock, llvm::CmpInst::ICMP_EQ, child1, child2);
+      scalarsEqual = llvm::BinaryOperator::Create(llvm::Instruction::And, scalarsEqual, icmp, "", CaseBlock);
+    } else {
+      others.push_back({idx, cat});
+    }
+    idx++;
+  }
+  if (others.empty()) {
+    llvm::ReturnInst::Create(Ctx, scalarsEqual, CaseBlock);
+    return;
+  }
+  auto CurrentBlock = llvm::BasicBlock::Create(Ctx, "children", func);
+  llvm::BranchInst::Create(CurrentBlock, False, scalarsEqual, CaseBlock);
+  for (auto &other : others) {
+    ValueType cat = other.second;
+    auto child1 = loadChild(BlockType, cast1, other.first, CurrentBlock);
+    auto child2 = loadChild(BlockType, cast2, other.first, CurrentBlock);
+    // cf runtime/equality.ll
+    const char *eqFn;
+    switch(cat.cat) {
+    case SortCategory::Map:
+      eqFn = "hook_MAP_eq";
+      break;
+    case SortCategory::List:
+      eqFn = "hook_LIST_eq";
+      break;
+    case SortCategory::Set:
+      eqFn = "hook_SET_eq";
+      break;
+    case SortCategory::Int:
+      eqFn = "hook_INT_eq";
+      break;
+    case SortCategory::Float:
+      eqFn = "hook_FLOAT_trueeq";
+      break;
+    case SortCategory::Symbol:
+      eqFn = "hook_KEQUAL_eq";
+      break;
+    case SortCategory::Variable:
+      eqFn = "hook_STRING_eq";
+      break;
+    case SortCategory::StringBuffer:
+      eqFn = nullptr;
+      break;
+    case SortCategory::Bool:
+    case SortCategory::MInt:
+    case SortCategory::Uncomputed:
+      abort();
+    }
+    if (!eqFn) {
+      addAbort(CurrentBlock, module);
+      llvm::ReturnInst::Create(Ctx, llvm::ConstantInt::getFalse(Ctx), False);
+      False->insertInto(func);
+      return;
+    }
+    auto eqType = llvm::FunctionType::get(llvm::Type::getInt1Ty(Ctx), {child1->getType(), child2->getType()}, false);
+    auto compare = llvm::CallInst::Create(getOrInsertFunction(module, eqFn, eqType), {child1, child2}, "", CurrentBlock);
+    auto NextBlock = llvm::BasicBlock::Create(Ctx, "children", func);
+    llvm::BranchInst::Create(NextBlock, False, compare, CurrentBlock);
+    CurrentBlock = NextBlock;
+  }
+  llvm::ReturnInst::Create(Ctx, llvm::ConstantInt::getTrue(Ctx), CurrentBlock);
+  llvm::ReturnInst::Create(Ctx, llvm::ConstantInt::getFalse(Ctx), False);
+  False->insertInto(func);
+}
+
+// The equality functions compare the children of two blocks with the same
+// header. cf runtime/equality.ll hook_KEQUAL_eq
+static void emitEquals(KOREDefinition *definition, llvm::Module *module) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto BlockPtr = getValueType({SortCategory::Symbol, 0}, module);
+  auto fnType = llvm::FunctionType::get(llvm::Type::getInt1Ty(Ctx), {BlockPtr, BlockPtr}, false);
+  emitLayoutFunctions("equals", fnType, definition, module, getEquals);
+}
+
+static void getHash(KOREDefinition *definition, llvm::Module *module, KORESymbol *symbol, llvm::BasicBlock *CaseBlock) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  llvm::Function *func = CaseBlock->getParent();
+  llvm::Value *Hash = func->arg_begin()+1;
+  auto BlockType = getBlockType(module, definition, symbol);
+  auto cast = new llvm::BitCastInst(func->arg_begin(),
+      llvm::PointerType::getUnqual(BlockType), "", CaseBlock);
+  int idx = 2;
+  for (auto &sort : symbol->getArguments()) {
+    ValueType cat = dynamic_cast<KORECompositeSort *>(sort.get())->getCategory(definition);
+    auto child = loadChild(BlockType, cast, idx++, CaseBlock);
+    // cf runtime/collections/hash.cpp k_hash
+    const char *hashFn;
+    switch(cat.cat) {
+    case SortCategory::Map:
+      hashFn = "map_hash";
+      break;
+    case SortCategory::List:
+      hashFn = "list_hash";
+      break;
+    case SortCategory::Set:
+      hashFn = "set_hash";
+      break;
+    case SortCategory::Int:
+      hashFn = "int_hash";
+      break;
+    case SortCategory::Float:
+      hashFn = "float_hash";
+      break;
+    case SortCategory::Symbol:
+    case SortCategory::Variable:
+      hashFn = "k_hash";
+      break;
+    case SortCategory::Bool:
+      child = new llvm::ZExtInst(child, llvm::Type::getInt8Ty(Ctx), "", CaseBlock);
+      hashFn = "add_hash8";
+      break;
+    case SortCategory::MInt: {
+      auto Add = getOrInsertFunction(module, "add_hash64", llvm::Type::getVoidTy(Ctx), llvm::Type::getInt8PtrTy(Ctx), llvm::Type::getInt64Ty(Ctx));
+      llvm::Value *accum = child;
+      for (size_t i = 0; i < (cat.bits + 63) / 64; i++) {
+        llvm::Value *Word;
+        if (cat.bits < 64) {
+          Word = new llvm::ZExtInst(accum, llvm::Type::getInt64Ty(Ctx), "", CaseBlock);
+        } else if (cat.bits == 64) {
+          Word = accum;
+        } else {
+          Word = new llvm::TruncInst(accum, llvm::Type::getInt64Ty(Ctx), "", CaseBlock);
+          accum = llvm::BinaryOperator::Create(llvm::Instruction::LShr, accum, llvm::ConstantInt::get(accum->getType(), 64), "", CaseBlock);
+        }
+        llvm::CallInst::Create(Add, {Hash, Word}, "", CaseBlock);
+      }
+      hashFn = nullptr;
+      break;
+    }
+    case SortCategory::StringBuffer: {
+      auto Abort = llvm::BasicBlock::Create(Ctx, "stuck", func);
+      llvm::BranchInst::Create(Abort, CaseBlock);
+      addAbort(Abort, module);
+      return;
+    }
+    case SortCategory::Uncomputed:
+      abort();
+    }
+    if (hashFn) {
+      auto hashType = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {child->getType(), llvm::Type::getInt8PtrTy(Ctx)}, false);
+      if (cat.cat == SortCategory::Bool) {
+        hashType = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {llvm::Type::getInt8PtrTy(Ctx), child->getType()}, false);
+        llvm::CallInst::Create(getOrInsertFunction(module, hashFn, hashType), {Hash, child}, "", CaseBlock);
+      } else {
+        llvm::CallInst::Create(getOrInsertFunction(module, hashFn, hashType), {child, Hash}, "", CaseBlock);
+      }
+    }
+  }
+  llvm::ReturnInst::Create(Ctx, CaseBlock);
+}
+
+// The hash functions add the children of a block to a hash being computed by
+// k_hash, whose header the caller has already hashed. cf
+// runtime/collections/hash.cpp
+static void emitHashes(KOREDefinition *definition, llvm::Module *module) {
+  llvm::LLVMContext &Ctx = module->getContext();
+  auto fnType = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {getValueType({SortCategory::Symbol, 0}, module), llvm::Type::getInt8PtrTy(Ctx)}, false);
+  emitLayoutFunctions("hash", fnType, definition, module, getHash);
 }
 
 static void emitVisitChildren(KOREDefinition *def, llvm::Module *mod) {
@@ -822,6 +1203,21 @@ static void emitInjTags(KOREDefinition *def, llvm::Module *mod) {
   }
 }
 
+static void emitFlag(std::string name, bool value, llvm::Module *mod) {
+  llvm::LLVMContext &Ctx = mod->getContext();
+  auto global = mod->getOrInsertGlobal(name, llvm::Type::getInt1Ty(Ctx));
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(global);
+  globalVar->setConstant(true);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(llvm::ConstantInt::get(llvm::Type::getInt1Ty(Ctx), value));
+  }
+}
+
+static void emitCodegenFlags(llvm::Module *mod) {
+  emitFlag("cache_term_hashes", CACHE_TERM_HASHES, mod);
+  emitFlag("hash_cons_terms", HASH_CONS_TERMS, mod);
+}
+
 static void emitSortTable(KOREDefinition *definition, llvm::Module *module) {
   llvm::LLVMContext &Ctx = module->getContext();
   auto &syms = definition->getSymbols();
@@ -876,8 +1272,12 @@ void emitConfigParserFunctions(KOREDefinition *definition, llvm::Module *module)
   emitVisitChildren(definition, module);
 
   emitLayouts(definition, module);
+  emitScavengers(definition, module);
+  emitEquals(definition, module);
+  emitHashes(definition, module);
 
   emitInjTags(definition, module);
+  emitCodegenFlags(module);
 
   emitSortTable(definition, module);
 }
@@ -0,0 +1,200 @@
+#include "kllvm/codegen/GCFrame.h"
+#include "kllvm/codegen/CreateTerm.h"
+#include "kllvm/codegen/Debug.h"
+#include "kllvm/codegen/Util.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+
+namespace kllvm {
+
+static std::string LAYOUTITEM_STRUCT = "layoutitem";
+
+// A frame is laid out as struct gc_frame in include/runtime/collect.h: the
+// layout of its roots, the number of its roots, then the roots themselves.
+static const uint64_t FRAME_HEADER_SIZE = 16;
+
+// returns the thread-local variable of the runtime with the specified name,
+// cf runtime/collect/shadow_stack.cpp
+static llvm::Constant *threadLocalGlobal(llvm::Module *Module, std::string name, llvm::Type *Type) {
+  auto global = Module->getOrInsertGlobal(name, Type);
+  llvm::cast<llvm::GlobalVariable>(global)->setThreadLocal(true);
+  return global;
+}
+
+GCFrame::GCFrame(llvm::Function *Function, bool Safe) :
+    Function(Function),
+    Module(Function->getParent()),
+    Ctx(Module->getContext()),
+    Safe(Safe),
+    Live(nullptr) {
+  auto top = threadLocalGlobal(Module, "gc_frame_top", llvm::Type::getInt8PtrTy(Ctx));
+  Frame = new llvm::LoadInst(llvm::Type::getInt8PtrTy(Ctx), top, "frame", &Function->getEntryBlock());
+  Prologue = Frame;
+}
+
+// returns the address of the word of the frame at the specified offset as a
+// pointer to Type
+llvm::Value *GCFrame::address(uint64_t offset, llvm::Type *Type) {
+  auto ptr = llvm::GetElementPtrInst::CreateInBounds(llvm::Type::getInt8Ty(Ctx), Frame, {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), offset)}, "root");
+  ptr->insertAfter(Prologue);
+  auto cast = new llvm::BitCastInst(ptr, llvm::PointerType::getUnqual(Type), "");
+  cast->insertAfter(ptr);
+  Prologue = cast;
+  return cast;
+}
+
+llvm::Value *GCFrame::slot(ValueType cat, llvm::Type *Type) {
+  auto cast = address(FRAME_HEADER_SIZE + Roots.size() * 8, Type);
+  Roots.push_back(cat);
+  Slots.push_back(cast);
+  return cast;
+}
+
+llvm::Value *GCFrame::storage(llvm::Type *Type) {
+  auto cast = address(FRAME_HEADER_SIZE + Roots.size() * 8, Type);
+  // the words of the storage are laid out as booleans, which the collector
+  // skips
+  uint64_t words = (llvm::DataLayout(Module).getTypeAllocSize(Type) + 7) / 8;
+  for (uint64_t i = 0; i < words; i++) {
+    Roots.push_back({SortCategory::Bool, 0});
+  }
+  return cast;
+}
+
+void GCFrame::safepoint(llvm::BasicBlock *block) {
+  auto call = llvm::CallInst::Create(getOrInsertFunction(Module, "koreSafepoint", llvm::Type::getVoidTy(Ctx)), {}, "", block);
+  setDebugLoc(call);
+}
+
+// adds code at the specified position (an instruction before which, or a basic
+// block at the end of which, to insert it) which adds delta to the number of
+// unsafe frames on the shadow stack
+template <typename Position>
+static void countUnsafeFrames(llvm::Module *Module, llvm::Value *delta, Position pos) {
+  auto Int64Ty = llvm::Type::getInt64Ty(Module->getContext());
+  auto count = threadLocalGlobal(Module, "gc_unsafe_frames", Int64Ty);
+  auto prev = new llvm::LoadInst(Int64Ty, count, "", pos);
+  auto next = llvm::BinaryOperator::Create(llvm::Instruction::Add, prev, delta, "", pos);
+  new llvm::StoreInst(next, count, pos);
+}
+
+// The unsafe span of a function counts as an unsafe frame while it is live.
+// Whether it is live is only known at run time, since the code beginning it
+// may or may not have run before the code ending it, so it is kept in a
+// variable of the function.
+template <typename Position>
+void GCFrame::setUnsafe(bool unsafe, Position pos) {
+  auto Int64Ty = llvm::Type::getInt64Ty(Ctx);
+  auto live = new llvm::LoadInst(Int64Ty, Live, "", pos);
+  auto delta = llvm::BinaryOperator::Create(llvm::Instruction::Sub, llvm::ConstantInt::get(Int64Ty, unsafe), live, "", pos);
+  countUnsafeFrames(Module, delta, pos);
+  new llvm::StoreInst(llvm::ConstantInt::get(Int64Ty, unsafe), Live, pos);
+}
+
+void GCFrame::beginUnsafe(llvm::BasicBlock *block) {
+  if (!Safe) {
+    return;
+  }
+  if (!Live) {
+    auto Int64Ty = llvm::Type::getInt64Ty(Ctx);
+    Live = new llvm::AllocaInst(Int64Ty, 0, "unsafe", Frame);
+    new llvm::StoreInst(llvm::ConstantInt::get(Int64Ty, 0), Live, Frame);
+  }
+  setUnsafe(true, block);
+}
+
+void GCFrame::endUnsafe(llvm::BasicBlock *block) {
+  if (Live) {
+    setUnsafe(false, block);
+  }
+}
+
+void GCFrame::finalize() {
+  // the code pushing the frame goes after the computation of the addresses of
+  // its roots, and before any other code of the function
+  llvm::Instruction *next = Prologue->getNextNode();
+  if (Roots.empty()) {
+    // a frame without roots only needs to be pushed if it is unsafe, in which
+    // case counting it is enough
+    Frame->eraseFromParent();
+    Frame = nullptr;
+    if (Safe && !Live) {
+      return;
+    }
+  }
+  auto Int64Ty = llvm::Type::getInt64Ty(Ctx);
+  auto top = threadLocalGlobal(Module, "gc_frame_top", llvm::Type::getInt8PtrTy(Ctx));
+  std::vector<llvm::ReturnInst *> returns;
+  for (auto &block : *Function) {
+    if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+      returns.push_back(ret);
+    }
+  }
+  if (!Safe) {
+    countUnsafeFrames(Module, llvm::ConstantInt::get(Int64Ty, 1), next);
+  }
+  for (auto ret : returns) {
+    // pop the frame before a tail call so that it remains a tail call
+    llvm::Instruction *before = ret;
+    if (auto call = llvm::dyn_cast_or_null<llvm::CallInst>(ret->getPrevNode())) {
+      if (!ret->getReturnValue() || ret->getReturnValue() == call) {
+        before = call;
+      }
+    }
+    if (Frame) {
+      new llvm::StoreInst(Frame, top, before);
+    }
+    if (!Safe) {
+      countUnsafeFrames(Module, llvm::ConstantInt::getSigned(Int64Ty, -1), before);
+    }
+    if (Live) {
+      setUnsafe(false, before);
+    }
+  }
+  if (!Frame) {
+    return;
+  }
+  std::vector<llvm::Constant *> elements;
+  unsigned i = 0;
+  for (auto cat : Roots) {
+    elements.push_back(llvm::ConstantStruct::get(getTypeByName(Module, LAYOUTITEM_STRUCT), llvm::ConstantInt::get(Int64Ty, i++ * 8), llvm::ConstantInt::get(llvm::Type::getInt16Ty(Ctx), (int)cat.cat + cat.bits)));
+  }
+  auto layoutArr = llvm::ConstantArray::get(llvm::ArrayType::get(getTypeByName(Module, LAYOUTITEM_STRUCT), elements.size()), elements);
+  auto layout = Module->getOrInsertGlobal("gc_frame_layout_" + Function->getName().str(), layoutArr->getType());
+  llvm::GlobalVariable *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(layout);
+  if (!globalVar->hasInitializer()) {
+    globalVar->setInitializer(layoutArr);
+  }
+  auto newTop = llvm::GetElementPtrInst::CreateInBounds(llvm::Type::getInt8Ty(Ctx), Frame, {llvm::ConstantInt::get(Int64Ty, FRAME_HEADER_SIZE + Roots.size() * 8)}, "", next);
+  new llvm::StoreInst(newTop, top, next);
+  auto layoutPtr = new llvm::BitCastInst(Frame, llvm::PointerType::getUnqual(llvm::Type::getInt8PtrTy(Ctx)), "", next);
+  new llvm::StoreInst(llvm::ConstantExpr::getBitCast(layout, llvm::Type::getInt8PtrTy(Ctx)), layoutPtr, next);
+  auto countPtr = llvm::GetElementPtrInst::CreateInBounds(llvm::Type::getInt8Ty(Ctx), Frame, {llvm::ConstantInt::get(Int64Ty, 8)}, "", next);
+  auto countCast = new llvm::BitCastInst(countPtr, llvm::Type::getInt64PtrTy(Ctx), "", next);
+  new llvm::StoreInst(llvm::ConstantInt::get(Int64Ty, Roots.size()), countCast, next);
+  // the collector scans every root of the frame, including those not yet
+  // stored to
+  for (auto slot : Slots) {
+    auto type = llvm::dyn_cast<llvm::PointerType>(slot->getType()->getPointerElementType());
+    new llvm::StoreInst(llvm::ConstantPointerNull::get(type), slot, next);
+  }
+}
+
+bool GCFrame::isRoot(llvm::Module *Module, llvm::Type *Type, ValueType &cat) {
+  for (auto sort : {SortCategory::Symbol, SortCategory::Int, SortCategory::Float, SortCategory::StringBuffer}) {
+    if (Type == getValueType({sort, 0}, Module)) {
+      cat = {sort, 0};
+      return true;
+    }
+  }
+  for (auto sort : {SortCategory::Map, SortCategory::List, SortCategory::Set}) {
+    if (Type == llvm::PointerType::getUnqual(getValueType({sort, 0}, Module))) {
+      cat = {sort, 0};
+      return true;
+    }
+  }
+  return false;
+}
+
+}
@@ -2,8 +2,10 @@ package org.kframework.backend.llvm.matching
 
 import org.kframework.backend.llvm.matching.dt._
 import org.kframework.parser.kore._
+import org.kframework.parser.kore.implementation.{DefaultBuilders => B}
 import org.kframework.parser.kore.parser.TextToKore
 import org.kframework.utils.errorsystem.KException
+import org.kframework.utils.errorsystem.KEMException
 
 import java.util.Optional
 import java.io.File
@@ -82,6 +84,30 @@ object Matching {
     writer.close
   }
 
+  // Writes to dt-goal.yaml the decision tree matching the configurations
+  // described by the rewrite axioms of goalFilename, which may refer to the
+  // sorts and symbols of the definition. The search stops at the states which
+  // match one of them (cf runtime/util/search.cpp).
+  def writeSearchGoalToFile(filename: File, goalFilename: File, heuristic: String, outputFolder: File) {
+    val defn = new TextToKore().parse(filename)
+    val goalDefn = new TextToKore().parse(goalFilename)
+    // numbered after the axioms of the definition, so that their leaves are not
+    // mistaken for its rules
+    val numAxioms = Parser.getAxioms(defn).size
+    val goals = Parser.parseTopAxioms(Parser.getAxioms(goalDefn).zipWithIndex.map(a => (a._1, a._2 + numAxioms)))
+    if (goals.isEmpty) {
+      throw KEMException.compilerError("No search goal found in " + goalFilename + ".")
+    }
+    if (goals.exists(_.sideCondition.isDefined)) {
+      throw KEMException.compilerError("Search goals with side conditions are not supported.")
+    }
+    val combined = B.Definition(defn.att, defn.modules ++ goalDefn.modules)
+    val symlib = Parser.parseSymbols(combined, heuristic)
+    val matrix = Generator.genClauseMatrix(symlib, combined, goals, Seq(goals.head.rewrite.sort))
+    outputFolder.mkdirs()
+    matrix.compile.serializeToYaml(new File(outputFolder, "dt-goal.yaml"))
+  }
+
   var logging = false
 
   def getThreshold(arg: String): Optional[(Int, Int)] = {
@@ -102,7 +128,9 @@ object Matching {
   def main(args: Array[String]): Unit = {
     val file = new File(args(0))
     val outputFolder = new File(args(2))
-    logging = args.size > 4
+    val (goalArgs, flags) = args.drop(4).partition(_.startsWith("--search-goal="))
+    logging = flags.nonEmpty
     writeDecisionTreeToFile(file, args(1), outputFolder, getThreshold(args(3)), true, true, true, (e) => ())
+    goalArgs.lastOption.foreach(goal => writeSearchGoalToFile(file, new File(goal.substring("--search-goal=".length)), args(1), outputFolder))
   }
 }
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <mutex>
 
 #include "runtime/alloc.h"
 #include "runtime/header.h"
@@ -11,39 +12,85 @@
 
 extern "C" {
 
-REGISTER_ARENA(youngspace, YOUNGSPACE_ID);
+REGISTER_EXTERN_ARENA(youngspace, YOUNGSPACE_ID);
 REGISTER_ARENA(oldspace, OLDSPACE_ID);
 REGISTER_ARENA(alwaysgcspace, ALWAYSGCSPACE_ID);
+// The objects allocated between koreAllocStaticBegin and koreAllocStaticEnd.
+// Its semispace is never the collection semispace of another arena, so the
+// collector never moves them.
+REGISTER_SHARED_ARENA(staticspace, STATICSPACE_ID);
+static std::mutex staticspaceLock;
+// The objects allocated by the current thread between koreAllocSearchBegin and
+// koreAllocSearchEnd, which are never collected either.
+REGISTER_ARENA(searchspace, SEARCHSPACE_ID);
 
-char *youngspace_ptr() {
-  return arenaStartPtr(&youngspace);
+// Frees the heap of a thread when it exits, cf gc_frames_region in
+// runtime/collect/shadow_stack.cpp: the blocks of its arenas go back to the
+// free list of runtime/alloc/arena.cpp, and its large objects are unmapped. The
+// arenas themselves have no destructor, so they are still valid at that point.
+// The searchspace is not freed, since its objects outlive the thread.
+struct heap_owner {
+  bool used = false;
+
+  ~heap_owner() {
+    if (used) {
+      largeObjectFreeHeap(&youngspace);
+      arenaFree(&youngspace);
+      arenaFree(&oldspace);
+      arenaFree(&alwaysgcspace);
+    }
+  }
+};
+
+static thread_local heap_owner heapOwner;
+
+void koreAllocHeapUsed(void) {
+  heapOwner.used = true;
 }
 
 char *oldspace_ptr() {
   return arenaStartPtr(&oldspace);
 }
 
-char **young_alloc_ptr() {
-  return arenaEndPtr(&youngspace);
-}
-
 char **old_alloc_ptr() {
   return arenaEndPtr(&oldspace);
 }
 
 char youngspace_collection_id() {
-  return getArenaCollectionSemispaceID(&youngspace);
+  return getArenaCollectionSemispaceID(koreCurrentHeap().youngspace);
 }
 
 char oldspace_collection_id() {
-  return getArenaCollectionSemispaceID(&oldspace);
+  // the mark-region old generation is collected in place
+  return markRegionOldGen ? OLDSPACE_ID : getArenaCollectionSemispaceID(koreCurrentHeap().oldspace);
 }
 
 size_t youngspace_size(void) {
   return arenaSize(&youngspace);
 }
 
+// The number of bytes allocated in the young generation since the last
+// collection. The offset of the current block is cached, since blocks are never
+// reordered within a semispace.
+size_t youngspace_used(void) {
+  if (!youngspace.block_start) {
+    return 0;
+  }
+  static thread_local char *cachedBlockStart = nullptr;
+  static thread_local size_t cachedOffset = 0;
+  if (youngspace.block_start != cachedBlockStart) {
+    cachedBlockStart = youngspace.block_start;
+    cachedOffset = ptrDiff(youngspace.block_start + sizeof(memory_block_header), arenaStartPtr(&youngspace));
+  }
+  return cachedOffset + (youngspace.block - youngspace.block_start - sizeof(memory_block_header));
+}
+
 bool youngspaceAlmostFull(size_t threshold) {
+  if (youngspace.block_start && threshold < youngspace_size()) {
+    // the young generation was made smaller than its arena by the heap sizing
+    // policy, cf nextYoungThreshold in runtime/collect/policy.cpp
+    return youngspace_used() * 100 > threshold * 95;
+  }
   char *nextBlock = *(char **)youngspace.block_start;
   if (nextBlock) {
     // not on the last block, so short circuit and assume that we can keep allocating for now.
@@ -54,14 +101,176 @@ bool youngspaceAlmostFull(size_t threshold) {
   return (totalBytes - freeBytes) * 100 > threshold * 95;
 }
 
-void koreAllocSwap(bool swapOld) {
+// The number of blocks kept in each semispace of an arena after a collection is
+// the largest number of blocks used by the arena during the last
+// HIGH_WATER_WINDOW collections of it. The memory of the remaining blocks is
+// returned to the OS, so that a transient peak in memory use does not stay
+// resident for the rest of the run.
+#define HIGH_WATER_WINDOW 8
+
+typedef struct {
+  size_t blocks[HIGH_WATER_WINDOW];
+  unsigned next;
+} high_water_mark;
+
+static thread_local high_water_mark young_high_water, old_high_water;
+
+static void recordBlocksUsed(high_water_mark *mark, size_t blocks) {
+  mark->blocks[mark->next] = blocks;
+  mark->next = (mark->next + 1) % HIGH_WATER_WINDOW;
+}
+
+static size_t highWaterMark(const high_water_mark *mark) {
+  size_t result = 1;
+  for (int i = 0; i < HIGH_WATER_WINDOW; i++) {
+    if (mark->blocks[i] > result) {
+      result = mark->blocks[i];
+    }
+  }
+  return result;
+}
+
+void koreAllocSwap(bool swapOld, bool clearAlwaysGC) {
+  recordBlocksUsed(&young_high_water, arenaBlocksUsed(&youngspace));
   arenaSwapAndClear(&youngspace);
-  arenaClear(&alwaysgcspace);
-  if (swapOld) {
+  if (clearAlwaysGC) {
+    arenaClear(&alwaysgcspace);
+  }
+  if (swapOld && !markRegionOldGen) {
+    recordBlocksUsed(&old_high_water, arenaBlocksUsed(&oldspace));
     arenaSwapAndClear(&oldspace);
   }
 }
 
+void koreAllocReleaseUnused(bool releaseOld) {
+  arenaReleaseCollectionBlocks(&youngspace, highWaterMark(&young_high_water));
+  if (releaseOld && !markRegionOldGen) {
+    arenaReleaseCollectionBlocks(&oldspace, highWaterMark(&old_high_water));
+  }
+}
+
+// The allocation buffer of a thread taking part in a parallel collection: a
+// chunk of an arena into which it copies objects without synchronizing with the
+// other threads. Objects larger than a quarter of a chunk are allocated
+// directly in the arena.
+typedef struct {
+  char *ptr;
+  char *end;
+} gc_buffer;
+
+static const size_t GC_CHUNK_SIZE = 32 * 1024;
+static std::mutex gcArenaLock;
+static thread_local bool gcBuffersActive = false;
+static thread_local gc_buffer youngBuffer, oldBuffer;
+// the heap which the current thread collects while its buffers are active
+static thread_local kore_heap gcHeap;
+// the arena which the current thread allocates into in place of its young
+// generation, if any
+static thread_local struct arena *allocationRegion;
+
+kore_heap koreCurrentHeap(void) {
+  if (gcBuffersActive) {
+    return gcHeap;
+  }
+  // the large objects allocated into a region are owned by it rather than by
+  // the young generation, and are never swept, cf largeObjectSweep
+  return {allocationRegion ? allocationRegion : &youngspace, &oldspace};
+}
+
+// Fills the unused end of a buffer with a dummy object, so that the arena can
+// still be traversed. cf freshBlock
+static void fillBuffer(gc_buffer *buffer) {
+  size_t remaining = buffer->end - buffer->ptr;
+  if (remaining == 8) {
+    *(uint64_t *)buffer->ptr = NOT_YOUNG_OBJECT_BIT;
+  } else if (remaining) {
+    *(uint64_t *)buffer->ptr = remaining - 8;
+  }
+  buffer->ptr = buffer->end = 0;
+}
+
+static void *bufferAlloc(gc_buffer *buffer, struct arena *Arena, size_t requested) {
+  if (buffer->ptr + requested <= buffer->end) {
+    void *result = buffer->ptr;
+    buffer->ptr += requested;
+    return result;
+  }
+  std::lock_guard<std::mutex> guard(gcArenaLock);
+  if (requested > GC_CHUNK_SIZE / 4) {
+    return arenaAlloc(Arena, requested);
+  }
+  fillBuffer(buffer);
+  buffer->ptr = (char *)arenaAlloc(Arena, GC_CHUNK_SIZE);
+  buffer->end = buffer->ptr + GC_CHUNK_SIZE;
+  void *result = buffer->ptr;
+  buffer->ptr += requested;
+  return result;
+}
+
+void koreAllocGCBegin(kore_heap heap) {
+  gcHeap = heap;
+  youngBuffer.ptr = youngBuffer.end = 0;
+  oldBuffer.ptr = oldBuffer.end = 0;
+  gcBuffersActive = true;
+}
+
+void koreAllocGCEnd(void) {
+  fillBuffer(&youngBuffer);
+  fillBuffer(&oldBuffer);
+  gcBuffersActive = false;
+}
+
+void* koreAllocGC(size_t requested, bool old) {
+  if (!gcBuffersActive) {
+    return old ? koreAllocOld(requested) : koreAlloc(requested);
+  }
+  return old ? bufferAlloc(&oldBuffer, gcHeap.oldspace, requested) : bufferAlloc(&youngBuffer, gcHeap.youngspace, requested);
+}
+
+void* koreAllocTokenGC(size_t requested, bool old) {
+  size_t size = (requested + 7) & ~7;
+  return koreAllocGC(size < 16 ? 16 : size, old);
+}
+
+// The current thread allocates into a region (staticspace or searchspace) in
+// place of its young generation, which is set aside in the meantime.
+static thread_local struct arena savedYoungspace;
+
+static void allocationRegionBegin(struct arena *region) {
+  savedYoungspace = youngspace;
+  youngspace = *region;
+  allocationRegion = region;
+}
+
+static void allocationRegionEnd(void) {
+  *allocationRegion = youngspace;
+  youngspace = savedYoungspace;
+  allocationRegion = nullptr;
+}
+
+void koreAllocStaticBegin(void) {
+  staticspaceLock.lock();
+  allocationRegionBegin(&staticspace);
+}
+
+void koreAllocStaticEnd(void) {
+  allocationRegionEnd();
+  staticspaceLock.unlock();
+}
+
+void koreAllocSearchBegin(void) {
+  allocationRegionBegin(&searchspace);
+}
+
+void koreAllocSearchEnd(void) {
+  allocationRegionEnd();
+}
+
+void koreAllocSearchClear(void) {
+  arenaClear(&searchspace);
+  largeObjectFreeHeap(&searchspace);
+}
+
 void setKoreMemoryFunctionsForGMP() {
    mp_set_memory_functions(koreAllocMP, koreReallocMP, koreFree);
 }
@@ -76,12 +285,15 @@ __attribute__ ((always_inline)) void* koreAllocToken(size_t requested) {
 }
 
 __attribute__ ((always_inline)) void* koreAllocOld(size_t requested) {
+  if (markRegionOldGen) {
+    return markRegionAlloc(requested);
+  }
   return arenaAlloc(&oldspace, requested);
 }
 
 __attribute__ ((always_inline)) void* koreAllocTokenOld(size_t requested) {
   size_t size = (requested + 7) & ~7;
-  return arenaAlloc(&oldspace, size < 16 ? 16 : size);
+  return koreAllocOld(size < 16 ? 16 : size);
 }
 
 __attribute__ ((always_inline)) void* koreAllocAlwaysGC(size_t requested) {
@@ -3,12 +3,84 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <mutex>
 
 #include "runtime/arena.h"
 #include "runtime/header.h"
 #include "runtime/alloc.h"
  
-const size_t BLOCK_SIZE = 1024 * 1024;
+size_t BLOCK_SIZE = 1024 * 1024;
+static size_t BLOCKS_PER_SUPERBLOCK = 15;
+
+enum huge_page_mode {
+  NO_HUGE_PAGES,
+  // transparent huge pages, requested with madvise
+  TRANSPARENT_HUGE_PAGES,
+  // huge pages of 2MB or 1GB from hugetlbfs, which must have been reserved
+  HUGETLB_2MB,
+  HUGETLB_1GB,
+};
+
+static huge_page_mode HUGE_PAGES = NO_HUGE_PAGES;
+static const size_t HUGE_PAGE_2MB = 2 * 1024 * 1024;
+static const size_t HUGE_PAGE_1GB = 1024 * 1024 * 1024;
+
+static void invalidGeometry(const char *var, const char *value, const char *reason) {
+  fprintf(stderr, "Invalid value %s for %s: %s\n", value, var, reason);
+  abort();
+}
+
+// Reads the geometry of the arenas from the environment. This must happen
+// before anything is allocated in an arena, hence in a constructor.
+//
+// KLLVM_BLOCK_SIZE: the size in bytes of a block, which is also the maximum
+//   size of an object allocated in an arena. A power of two of at least 64KB
+//   (default 1MB).
+// KLLVM_SUPERBLOCK_BLOCKS: the number of blocks mapped at once (default 15).
+// KLLVM_HUGE_PAGES: "thp" to request transparent huge pages for the arenas,
+//   "2mb" or "1gb" to map them from hugetlbfs, or "none" (the default). The
+//   block size must then be a multiple of the huge page size, i.e. of 2MB for
+//   thp, so that each huge page backs a single block. With thp, the default
+//   block size is 2MB rather than 1MB.
+__attribute__ ((constructor)) static void initArenaGeometry() {
+  const char *blockSize = getenv("KLLVM_BLOCK_SIZE");
+  if (blockSize) {
+    char *end;
+    BLOCK_SIZE = strtoull(blockSize, &end, 10);
+    if (*end || BLOCK_SIZE < 64 * 1024 || (BLOCK_SIZE & (BLOCK_SIZE - 1))) {
+      invalidGeometry("KLLVM_BLOCK_SIZE", blockSize, "must be a power of two of at least 65536");
+    }
+  }
+  if (const char *env = getenv("KLLVM_SUPERBLOCK_BLOCKS")) {
+    char *end;
+    BLOCKS_PER_SUPERBLOCK = strtoull(env, &end, 10);
+    if (*end || *env == '-' || BLOCKS_PER_SUPERBLOCK == 0) {
+      invalidGeometry("KLLVM_SUPERBLOCK_BLOCKS", env, "must be a positive integer");
+    }
+  }
+  if (const char *env = getenv("KLLVM_HUGE_PAGES")) {
+    if (strcmp(env, "none") == 0) {
+      HUGE_PAGES = NO_HUGE_PAGES;
+    } else if (strcmp(env, "thp") == 0) {
+      HUGE_PAGES = TRANSPARENT_HUGE_PAGES;
+    } else if (strcmp(env, "2mb") == 0) {
+      HUGE_PAGES = HUGETLB_2MB;
+    } else if (strcmp(env, "1gb") == 0) {
+      HUGE_PAGES = HUGETLB_1GB;
+    } else {
+      invalidGeometry("KLLVM_HUGE_PAGES", env, "must be one of none, thp, 2mb or 1gb");
+    }
+    if (HUGE_PAGES == TRANSPARENT_HUGE_PAGES && !blockSize && BLOCK_SIZE < HUGE_PAGE_2MB) {
+      BLOCK_SIZE = HUGE_PAGE_2MB;
+    }
+    if (((HUGE_PAGES == HUGETLB_2MB || HUGE_PAGES == TRANSPARENT_HUGE_PAGES) && BLOCK_SIZE % HUGE_PAGE_2MB)
+        || (HUGE_PAGES == HUGETLB_1GB && BLOCK_SIZE % HUGE_PAGE_1GB)) {
+      invalidGeometry("KLLVM_HUGE_PAGES", env, "KLLVM_BLOCK_SIZE must be a multiple of the huge page size");
+    }
+  }
+}
 
 #define mem_block_header(ptr) \
   ((memory_block_header *)(((uintptr_t)(ptr) - 1) & ~(BLOCK_SIZE-1)))
@@ -43,18 +115,66 @@ __attribute__ ((always_inline)) char getArenaSemispaceIDOfObject(void *ptr) {
   return mem_block_header(ptr)->semispace;
 }
 
+// The superblocks are shared by the arenas of every thread, since the threads
+// of a parallel collection allocate blocks for the arenas of another thread.
 static void* first_superblock_ptr = 0;
 static void* superblock_ptr = 0;
 static char** next_superblock_ptr = 0;
 static unsigned blocks_left = 0;
+// The blocks returned by the heaps of exited threads, cf arenaFree, linked
+// through their next_block field. They are handed out again before any new
+// superblock is mapped.
+static char *free_blocks = 0;
+static std::mutex superblockLock;
+
+// Maps a superblock of BLOCKS_PER_SUPERBLOCK blocks aligned on BLOCK_SIZE. A
+// mapping is only guaranteed to be page aligned, so this maps one more block
+// than necessary and unmaps the unaligned ends.
+static void *map_superblock() {
+  size_t size = BLOCK_SIZE * BLOCKS_PER_SUPERBLOCK;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (HUGE_PAGES == HUGETLB_2MB || HUGE_PAGES == HUGETLB_1GB) {
+#ifdef MAP_HUGETLB
+    flags |= MAP_HUGETLB | ((HUGE_PAGES == HUGETLB_2MB ? 21 : 30) << MAP_HUGE_SHIFT);
+#else
+    fprintf(stderr, "hugetlbfs pages are not supported on this platform\n");
+    abort();
+#endif
+  }
+  char *mapping = (char *)mmap(NULL, size + BLOCK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (mapping == MAP_FAILED) {
+    perror("mmap");
+    if (HUGE_PAGES == HUGETLB_2MB || HUGE_PAGES == HUGETLB_1GB) {
+      fprintf(stderr, "Not enough huge pages reserved, cf /proc/sys/vm/nr_hugepages\n");
+    }
+    abort();
+  }
+  char *aligned = (char *)(((uintptr_t)mapping + BLOCK_SIZE - 1) & ~(BLOCK_SIZE-1));
+  if (aligned != mapping) {
+    munmap(mapping, aligned - mapping);
+  }
+  char *end = mapping + size + BLOCK_SIZE;
+  if (aligned + size != end) {
+    munmap(aligned + size, end - (aligned + size));
+  }
+  if (HUGE_PAGES == TRANSPARENT_HUGE_PAGES) {
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+  }
+  return aligned;
+}
 
 static void* megabyte_malloc() {
+  std::lock_guard<std::mutex> guard(superblockLock);
+  if (free_blocks) {
+    void *result = free_blocks;
+    free_blocks = ((memory_block_header *)free_blocks)->next_block;
+    return result;
+  }
   if (blocks_left == 0) {
-    blocks_left = 15;
-    if (int result = posix_memalign(&superblock_ptr, BLOCK_SIZE, BLOCK_SIZE * 15)) {
-      errno = result;
-      perror("posix_memalign");
-    }
+    blocks_left = BLOCKS_PER_SUPERBLOCK;
+    superblock_ptr = map_superblock();
     if (!first_superblock_ptr) {
       first_superblock_ptr = superblock_ptr;
     }
@@ -71,9 +191,20 @@ static void* megabyte_malloc() {
   return result;
 }
 
+char *arenaStandaloneBlock(char semispace) {
+  memory_block_header *hdr = (memory_block_header *)megabyte_malloc();
+  hdr->next_block = 0;
+  hdr->semispace = semispace;
+  hdr->released = false;
+  return (char *)hdr;
+}
+
 static void freshBlock(struct arena *Arena) {
     char *nextBlock;
     if (Arena->block_start == 0) {
+      if (Arena == &youngspace) {
+        koreAllocHeapUsed();
+      }
       nextBlock = (char *)megabyte_malloc();
       Arena->first_block = nextBlock;
       memory_block_header *nextHeader = (memory_block_header *)nextBlock;
@@ -99,17 +230,18 @@ static void freshBlock(struct arena *Arena) {
         Arena->num_blocks++;
       }
     }
+    ((memory_block_header *)nextBlock)->released = false;
     Arena->block = nextBlock + sizeof(memory_block_header);
     Arena->block_start = nextBlock;
     Arena->block_end = nextBlock + BLOCK_SIZE;
     MEM_LOG("New block at %p (remaining %zd)\n", Arena->block, BLOCK_SIZE - sizeof(memory_block_header));
 }
 
-static __attribute__ ((noinline))
+__attribute__ ((noinline))
 void *doAllocSlow(size_t requested, struct arena *Arena) {
   MEM_LOG("Block at %p too small, %zd remaining but %zd needed\n", Arena->block, Arena->block_end-Arena->block, requested);
   if (requested > BLOCK_SIZE - sizeof(memory_block_header)) {
-    return malloc(requested);
+    return largeObjectAlloc(requested);
   } else {
     freshBlock(Arena);
     void* result = Arena->block;
@@ -213,15 +345,89 @@ size_t arenaSize(const struct arena *Arena) {
   return (Arena->num_blocks > Arena->num_collection_blocks ? Arena->num_blocks : Arena->num_collection_blocks) * (BLOCK_SIZE - sizeof(memory_block_header));
 }
 
+size_t arenaBlocksUsed(const struct arena *Arena) {
+  size_t result = 0;
+  for (char *block = Arena->first_block; block; block = ((memory_block_header *)block)->next_block) {
+    result++;
+    if (block == Arena->block_start) {
+      break;
+    }
+  }
+  return result;
+}
+
+// Returns the memory of a block after its first page to the OS. The header of
+// a block is in its first page, which is kept so that the semispace can still
+// be traversed. Pages from hugetlbfs are reserved for the process anyway. With
+// transparent huge pages, this splits the huge page backing the block into
+// base pages, which the kernel may collapse again once the block is reused.
+static void release_block(char *block) {
+  if (HUGE_PAGES == HUGETLB_2MB || HUGE_PAGES == HUGETLB_1GB) {
+    return;
+  }
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  memory_block_header *hdr = (memory_block_header *)block;
+  if (page_size >= BLOCK_SIZE || hdr->released) {
+    return;
+  }
+  MEM_LOG("Releasing block at %p\n", block);
+  madvise(block + page_size, BLOCK_SIZE - page_size, MADV_DONTNEED);
+  hdr->released = true;
+}
+
+void arenaReleaseCollectionBlocks(struct arena *Arena, size_t keep) {
+  size_t i = 0;
+  for (char *block = Arena->first_collection_block; block; block = ((memory_block_header *)block)->next_block) {
+    if (i++ >= keep) {
+      release_block(block);
+    }
+  }
+}
+
+// Adds a list of blocks linked through their next_block field to the free
+// list. Does nothing once freeAllMemory has unmapped every block.
+static void free_block_list(char *first) {
+  if (!first) {
+    return;
+  }
+  char *last = first;
+  for (char *block = first; block; block = ((memory_block_header *)block)->next_block) {
+    release_block(block);
+    last = block;
+  }
+  std::lock_guard<std::mutex> guard(superblockLock);
+  if (!first_superblock_ptr) {
+    return;
+  }
+  ((memory_block_header *)last)->next_block = free_blocks;
+  free_blocks = first;
+}
+
+void arenaFree(struct arena *Arena) {
+  free_block_list(Arena->first_block);
+  free_block_list(Arena->first_collection_block);
+  arenaReset(Arena);
+}
+
+void arenaFreeBlock(char *block) {
+  ((memory_block_header *)block)->next_block = 0;
+  free_block_list(block);
+}
+
 void freeAllMemory() {
-  memory_block_header *superblock = (memory_block_header *)first_superblock_ptr;
-  while (superblock) {
-    memory_block_header* next_superblock = (memory_block_header *)superblock->next_superblock;
-    free(superblock);
-    superblock = next_superblock;
-  }
-  first_superblock_ptr = 0;
-  superblock_ptr = 0;
-  next_superblock_ptr = 0;
-  blocks_left = 0;
+  {
+    std::lock_guard<std::mutex> guard(superblockLock);
+    memory_block_header *superblock = (memory_block_header *)first_superblock_ptr;
+    while (superblock) {
+      memory_block_header* next_superblock = (memory_block_header *)superblock->next_superblock;
+      munmap(superblock, BLOCK_SIZE * BLOCKS_PER_SUPERBLOCK);
+      superblock = next_superblock;
+    }
+    first_superblock_ptr = 0;
+    superblock_ptr = 0;
+    next_superblock_ptr = 0;
+    blocks_left = 0;
+    free_blocks = 0;
+  }
+  largeObjectFreeAll();
 }
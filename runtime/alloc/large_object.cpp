@@ -0,0 +1,183 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "runtime/alloc.h"
+#include "runtime/arena.h"
+#include "runtime/header.h"
+
+// The large-object space holds the allocations which do not fit in a block of
+// an arena. Each object is mapped separately on page boundaries, never moves,
+// and is registered in a side table keyed by its address. The garbage collector
+// marks the large objects it reaches instead of copying them, and sweeps the
+// unmarked ones at the end of the collection.
+//
+// Large objects are aged like the blocks of the young generation: an object is
+// young until it has survived two collections, and only young objects are
+// marked and swept by a collection of the young generation. Since a term is
+// never older than its children, the children of a large object which becomes
+// old are promoted along with it, and an old large object never needs to be
+// traced by a collection of the young generation.
+//
+// The large objects of every thread share the side table. Each object records
+// the heap it belongs to, i.e. the young arena of its thread, and is only swept
+// by the collections of that heap.
+
+namespace {
+
+struct large_object {
+  size_t size;
+  unsigned age;
+  bool marked;
+  struct arena *heap;
+  // true if heap is a region rather than a young generation, cf largeObjectInRegion
+  bool region;
+};
+
+}
+
+static const unsigned LARGE_OBJECT_OLD_AGE = 2;
+
+static std::unordered_map<uintptr_t, large_object> largeObjects;
+// the size of the table, which isLargeObject reads without taking the lock
+static std::atomic<size_t> numLargeObjects(0);
+// taken by every operation on the table once the threads of a parallel
+// collection or of other heaps may use it concurrently, cf
+// largeObjectSpaceShared
+static std::mutex largeObjectsLock;
+static std::atomic<bool> largeObjectsShared(false);
+
+static std::unique_lock<std::mutex> lockLargeObjects() {
+  std::unique_lock<std::mutex> guard(largeObjectsLock, std::defer_lock);
+  if (largeObjectsShared.load(std::memory_order_acquire)) {
+    guard.lock();
+  }
+  return guard;
+}
+
+thread_local size_t largeObjectBytes = 0;
+thread_local size_t largeObjectBytesFreed = 0;
+
+static size_t page_size() {
+  static const size_t result = sysconf(_SC_PAGESIZE);
+  return result;
+}
+
+static size_t mapping_size(size_t requested) {
+  return (requested + page_size() - 1) & ~(page_size() - 1);
+}
+
+void *largeObjectAlloc(size_t requested) {
+  size_t size = mapping_size(requested);
+  void *result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (result == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  }
+  // an object allocated during a collection is the copy of a live object, which
+  // may be referenced from an object of the old generation that the next
+  // collections of the young generation will not trace
+  bool copy = during_gc();
+  struct arena *heap = koreCurrentHeap().youngspace;
+  char id = getArenaAllocationSemispaceID(heap);
+  bool region = id == STATICSPACE_ID || id == SEARCHSPACE_ID;
+  auto guard = lockLargeObjects();
+  largeObjects[(uintptr_t)result] = {size, copy ? LARGE_OBJECT_OLD_AGE : 0, copy, heap, region};
+  numLargeObjects.store(largeObjects.size(), std::memory_order_relaxed);
+  largeObjectBytes += size;
+  MEM_LOG("Allocating large object at %p (size %zd)\n", result, size);
+  return result;
+}
+
+bool isLargeObject(void *ptr) {
+  // large objects start on a page boundary, which rules out most other objects
+  // without looking them up
+  if ((uintptr_t)ptr & (page_size() - 1) || numLargeObjects.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  auto guard = lockLargeObjects();
+  return largeObjects.count((uintptr_t)ptr);
+}
+
+bool largeObjectInRegion(void *ptr) {
+  auto guard = lockLargeObjects();
+  return largeObjects.at((uintptr_t)ptr).region;
+}
+
+bool largeObjectMark(void *ptr, bool collectOld) {
+  auto guard = lockLargeObjects();
+  large_object &object = largeObjects.at((uintptr_t)ptr);
+  if (object.marked || (object.age >= LARGE_OBJECT_OLD_AGE && !collectOld)) {
+    return false;
+  }
+  object.marked = true;
+  return true;
+}
+
+bool largeObjectLive(void *ptr, bool collectOld) {
+  auto guard = lockLargeObjects();
+  const large_object &object = largeObjects.at((uintptr_t)ptr);
+  return object.marked || (object.age >= LARGE_OBJECT_OLD_AGE && !collectOld);
+}
+
+void largeObjectSweep(bool collectOld) {
+  auto guard = lockLargeObjects();
+  largeObjectBytesFreed = 0;
+  // recounted, since the threads of a parallel collection may have allocated
+  // large objects of this heap
+  largeObjectBytes = 0;
+  for (auto iter = largeObjects.begin(); iter != largeObjects.end();) {
+    large_object &object = iter->second;
+    if (object.heap != &youngspace) {
+      ++iter;
+      continue;
+    }
+    bool old = object.age >= LARGE_OBJECT_OLD_AGE;
+    if (object.marked || (old && !collectOld)) {
+      if (object.marked && !old) {
+        object.age++;
+      }
+      object.marked = false;
+      largeObjectBytes += object.size;
+      ++iter;
+    } else {
+      MEM_LOG("Freeing large object at %p (size %zd)\n", (void *)iter->first, object.size);
+      munmap((void *)iter->first, object.size);
+      largeObjectBytesFreed += object.size;
+      iter = largeObjects.erase(iter);
+    }
+  }
+  numLargeObjects.store(largeObjects.size(), std::memory_order_relaxed);
+}
+
+void largeObjectFreeHeap(struct arena *heap) {
+  auto guard = lockLargeObjects();
+  for (auto iter = largeObjects.begin(); iter != largeObjects.end();) {
+    if (iter->second.heap == heap) {
+      munmap((void *)iter->first, iter->second.size);
+      iter = largeObjects.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  numLargeObjects.store(largeObjects.size(), std::memory_order_relaxed);
+}
+
+void largeObjectFreeAll(void) {
+  auto guard = lockLargeObjects();
+  for (auto &entry : largeObjects) {
+    munmap((void *)entry.first, entry.second.size);
+  }
+  largeObjects.clear();
+  numLargeObjects.store(0, std::memory_order_relaxed);
+  largeObjectBytes = 0;
+}
+
+void largeObjectSpaceShared(void) {
+  largeObjectsShared.store(true, std::memory_order_release);
+}
@@ -0,0 +1,204 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "runtime/alloc.h"
+#include "runtime/arena.h"
+#include "runtime/header.h"
+
+// An alternative, non-moving, old generation, selected by setting the
+// KLLVM_OLD_GEN environment variable to "mark-region" ("copying", the default,
+// is the semispace old generation of alloc.cpp).
+//
+// The copying old generation needs room for a second copy of all its live data
+// whenever it is collected. The mark-region old generation instead marks its
+// live objects in place, Immix style. Each of its blocks is divided into lines
+// of LINE_SIZE bytes, with a table at the start of the block recording which
+// lines hold a live object. A collection of the old generation clears these
+// tables, marks the lines spanned by each object it reaches (cf
+// markRegionMarkLive), and then sweeps the blocks, collecting the runs of
+// unmarked lines as holes. Blocks left without any marked line are freed
+// instead. Objects promoted afterwards are bump-allocated into these holes,
+// then into fresh blocks once the holes are used up.
+//
+// An object of the old generation which was marked in place has the
+// FWD_PTR_BIT of its header set until the end of the collection, since it is
+// never forwarded. The garbage collector records these objects with
+// markRegionRecordMarked so that the sweep can clear the bit.
+//
+// Objects are never moved out of a fragmented block, so the old generation is
+// not compacted. Neither is it deduplicated (cf dedup.cpp), which happens when
+// blocks are copied into the old generation.
+
+static const size_t LINE_SIZE = 256;
+
+bool markRegionOldGen = false;
+
+__attribute__ ((constructor)) static void initOldGen() {
+  if (const char *env = getenv("KLLVM_OLD_GEN")) {
+    if (strcmp(env, "mark-region") == 0) {
+      markRegionOldGen = true;
+    } else if (strcmp(env, "copying") != 0) {
+      fprintf(stderr, "Invalid value %s for KLLVM_OLD_GEN: must be one of copying or mark-region\n", env);
+      abort();
+    }
+  }
+}
+
+typedef std::pair<char *, char *> hole;
+
+namespace {
+
+// The blocks of the old generation, which are returned to the free list of
+// runtime/alloc/arena.cpp when the thread exits, like the blocks of its arenas.
+struct region_blocks : std::vector<char *> {
+  ~region_blocks() {
+    for (char *block : *this) {
+      arenaFreeBlock(block);
+    }
+  }
+};
+
+}
+
+// the old generation of the heap of the current thread
+static thread_local region_blocks blocks;
+static thread_local std::vector<hole> holes;
+static thread_local size_t nextHole = 0;
+static thread_local char *cursor = nullptr;
+static thread_local char *limit = nullptr;
+// true between markRegionStartMajor and markRegionSweep
+static thread_local bool marking = false;
+static thread_local size_t bytesLive = 0;
+static thread_local size_t bytesAllocated = 0;
+static thread_local std::vector<blockheader *> markedObjects;
+
+static size_t lines_per_block() {
+  return BLOCK_SIZE / LINE_SIZE;
+}
+
+static uint8_t *line_table(char *block) {
+  return (uint8_t *)(block + sizeof(memory_block_header));
+}
+
+// The number of lines at the start of each block taken by its header and its
+// line table.
+static size_t metadata_lines() {
+  size_t metadata = sizeof(memory_block_header) + lines_per_block();
+  return (metadata + LINE_SIZE - 1) / LINE_SIZE;
+}
+
+static void clear_lines(char *block) {
+  uint8_t *lines = line_table(block);
+  memset(lines, 0, lines_per_block());
+  memset(lines, 1, metadata_lines());
+}
+
+static char *fresh_block() {
+  char *block = arenaStandaloneBlock(OLDSPACE_ID);
+  clear_lines(block);
+  blocks.push_back(block);
+  MEM_LOG("New mark-region block at %p\n", block);
+  return block;
+}
+
+static __attribute__ ((noinline)) void *markRegionAllocSlow(size_t requested) {
+  if (requested > BLOCK_SIZE - metadata_lines() * LINE_SIZE) {
+    return largeObjectAlloc(requested);
+  }
+  // holes too small for the request are skipped until the next sweep
+  while (nextHole < holes.size() && holes[nextHole].second - holes[nextHole].first < requested) {
+    nextHole++;
+  }
+  if (nextHole < holes.size()) {
+    cursor = holes[nextHole].first;
+    limit = holes[nextHole].second;
+    nextHole++;
+  } else {
+    char *block = fresh_block();
+    cursor = block + metadata_lines() * LINE_SIZE;
+    limit = block + BLOCK_SIZE;
+  }
+  return markRegionAlloc(requested);
+}
+
+void *markRegionAlloc(size_t requested) {
+  if (cursor + requested > limit) {
+    return markRegionAllocSlow(requested);
+  }
+  void *result = cursor;
+  cursor += requested;
+  bytesAllocated += requested;
+  if (marking) {
+    // an object promoted during a collection of the old generation is live,
+    // and its lines must survive the sweep
+    markRegionMarkLive(result, requested);
+  }
+  return result;
+}
+
+void markRegionMarkLive(void *ptr, size_t size) {
+  char *block = mem_block_start(ptr);
+  uint8_t *lines = line_table(block);
+  size_t first = ((char *)ptr - block) / LINE_SIZE;
+  size_t last = ((char *)ptr + size - 1 - block) / LINE_SIZE;
+  memset(lines + first, 1, last - first + 1);
+}
+
+void markRegionRecordMarked(void *obj) {
+  markedObjects.push_back((blockheader *)obj);
+}
+
+void markRegionStartMajor(void) {
+  for (char *block : blocks) {
+    clear_lines(block);
+  }
+  marking = true;
+}
+
+void markRegionSweep(void) {
+  for (blockheader *obj : markedObjects) {
+    obj->hdr &= ~FWD_PTR_BIT;
+  }
+  markedObjects.clear();
+  holes.clear();
+  bytesLive = 0;
+  size_t kept = 0;
+  for (char *block : blocks) {
+    uint8_t *lines = line_table(block);
+    size_t first = metadata_lines();
+    if (!memchr(lines + first, 1, lines_per_block() - first)) {
+      // nothing in the block survived, so it goes back to the free list of
+      // runtime/alloc/arena.cpp, which returns its memory to the OS
+      arenaFreeBlock(block);
+      continue;
+    }
+    blocks[kept++] = block;
+    size_t i = first;
+    while (i < lines_per_block()) {
+      if (lines[i]) {
+        bytesLive += LINE_SIZE;
+        i++;
+        continue;
+      }
+      size_t start = i;
+      while (i < lines_per_block() && !lines[i]) {
+        i++;
+      }
+      holes.emplace_back(block + start * LINE_SIZE, block + i * LINE_SIZE);
+    }
+  }
+  MEM_LOG("Swept mark-region old generation: %zd bytes live, %zd holes, %zd blocks freed\n", bytesLive, holes.size(), blocks.size() - kept);
+  blocks.resize(kept);
+  nextHole = 0;
+  cursor = limit = nullptr;
+  bytesAllocated = 0;
+  marking = false;
+}
+
+size_t markRegionBytesUsed(void) {
+  return bytesLive + bytesAllocated;
+}
@@ -3,7 +3,8 @@
 #include "runtime/header.h"
 #include "runtime/collect.h"
 
-std::vector<BlockEnumerator> blockEnumerators;
+// The enumerators are registered by each thread for the roots of its own heap.
+thread_local std::vector<BlockEnumerator> blockEnumerators;
 
 void registerGCRootsEnumerator(BlockEnumerator f) {
   blockEnumerators.push_back(f);
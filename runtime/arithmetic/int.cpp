@@ -358,8 +358,9 @@ void int_hash(mpz_t i, void *hasher) {
 
 static block * dotK = leaf_block(getTagForSymbolName("dotk{}"));
 
-gmp_randstate_t kllvm_randState;
-bool kllvm_randStateInitialized = false;
+// each thread has a random state of its own, allocated in its heap
+thread_local gmp_randstate_t kllvm_randState;
+thread_local bool kllvm_randStateInitialized = false;
 
 SortK hook_INT_srand(SortInt seed) {
   if (!kllvm_randStateInitialized) {
@@ -0,0 +1,137 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "runtime/alloc.h"
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// The heap census, enabled by setting the KLLVM_GC_CENSUS environment variable
+// to the file to write it to. A census counts the live objects and their bytes
+// per symbol, and per category for the objects which are not symbols: integers,
+// floats, strings (including bytes and tokens), string buffers and the nodes of
+// maps, lists and sets. It is taken by a collection of the old generation, whose
+// migration of the objects reached from the roots visits every live object
+// exactly once, and is requested:
+//
+// - every N collections, if KLLVM_GC_CENSUS_INTERVAL is set to N;
+// - at the next collection, on receipt of SIGUSR2 (e.g. `kill -USR2 <pid>`).
+//
+// Outside of a census, the collector only checks censusActive. A census
+// collection is serial, since the counts are not thread-safe. Each thread takes
+// censuses of its own heap, and the collections are numbered per thread.
+//
+// Each census appends the following lines to the file:
+//
+// # census collection=<number of the collection> timestamp_ns=<time since start>
+// <objects>\t<bytes>\t<name of the symbol or category>
+// ...
+//
+// `llvm-kompile-gc-stats census <file>` summarizes them.
+
+thread_local bool censusActive = false;
+
+namespace {
+
+struct census_counts {
+  uint64_t objects = 0;
+  uint64_t bytes = 0;
+};
+
+}
+
+static FILE *censusFile;
+static uint64_t censusInterval = 0;
+static thread_local uint64_t numCollections = 0;
+static volatile sig_atomic_t censusRequested = 0;
+static std::chrono::steady_clock::time_point programStart;
+
+// Allocated at the first census of the thread and never destroyed.
+static thread_local std::unordered_map<uint32_t, census_counts> *symbols;
+static thread_local census_counts categories[CENSUS_COLLECTION_NODE + 1];
+
+static const char *categoryNames[] = {
+  nullptr, "<string>", "<stringbuffer>", "<int>", "<float>", "<collection node>",
+};
+
+static void requestCensus(int) {
+  censusRequested = 1;
+}
+
+__attribute__ ((constructor)) static void initCensus() {
+  programStart = std::chrono::steady_clock::now();
+  const char *filename = getenv("KLLVM_GC_CENSUS");
+  if (!filename) {
+    return;
+  }
+  if (const char *env = getenv("KLLVM_GC_CENSUS_INTERVAL")) {
+    char *end;
+    long long interval = strtoll(env, &end, 10);
+    if (*end || interval < 0) {
+      fprintf(stderr, "Invalid value %s for KLLVM_GC_CENSUS_INTERVAL: must be a non-negative integer\n", env);
+      abort();
+    }
+    censusInterval = interval;
+  }
+  censusFile = fopen(filename, "w");
+  if (!censusFile) {
+    perror("fopen");
+    abort();
+  }
+  signal(SIGUSR2, requestCensus);
+}
+
+__attribute__ ((destructor)) static void finishCensus() {
+  if (censusFile) {
+    fclose(censusFile);
+  }
+}
+
+extern "C" {
+
+bool censusBegin(void) {
+  numCollections++;
+  if (!censusFile) {
+    return false;
+  }
+  if (!censusRequested && !(censusInterval && numCollections % censusInterval == 0)) {
+    return false;
+  }
+  censusRequested = 0;
+  if (!symbols) {
+    symbols = new std::unordered_map<uint32_t, census_counts>;
+  }
+  censusActive = true;
+  return true;
+}
+
+void censusRecord(census_category category, uint32_t tag, size_t bytes) {
+  census_counts &counts = category == CENSUS_SYMBOL ? (*symbols)[tag] : categories[category];
+  counts.objects++;
+  counts.bytes += bytes;
+}
+
+void censusEnd(void) {
+  censusActive = false;
+  uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - programStart).count();
+  // the census is written in one piece even if other threads take one
+  flockfile(censusFile);
+  fprintf(censusFile, "# census collection=%lu timestamp_ns=%lu\n", numCollections, timestamp);
+  for (auto &entry : *symbols) {
+    fprintf(censusFile, "%lu\t%lu\t%s\n", entry.second.objects, entry.second.bytes, getSymbolNameForTag(entry.first));
+  }
+  for (int i = CENSUS_STRING; i <= CENSUS_COLLECTION_NODE; i++) {
+    if (categories[i].objects) {
+      fprintf(censusFile, "%lu\t%lu\t%s\n", categories[i].objects, categories[i].bytes, categoryNames[i]);
+    }
+    categories[i] = census_counts();
+  }
+  // the file may be read while the program is still running
+  fflush(censusFile);
+  funlockfile(censusFile);
+  symbols->clear();
+}
+
+}
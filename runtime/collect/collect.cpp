@@ -4,6 +4,9 @@
 #include<cstdlib>
 #include<cstring>
 #include<cassert>
+#include<algorithm>
+#include<mutex>
+#include<vector>
 #include "runtime/alloc.h"
 #include "runtime/header.h"
 #include "runtime/arena.h"
@@ -11,26 +14,91 @@
 
 extern "C" {
 
-char **young_alloc_ptr(void);
 char **old_alloc_ptr(void);
-char* youngspace_ptr(void);
 char* oldspace_ptr(void);
 
-static bool is_gc = false;
-bool collect_old = false;
-#ifndef GC_DBG
-static uint8_t num_collection_only_young = 0;
-#else
-static char *last_alloc_ptr;
+static thread_local bool is_gc = false;
+thread_local bool collect_old = false;
+thread_local bool promote_all = false;
+
+// The order in which the serial collector copies the young generation, set by
+// the KLLVM_GC_COPY_ORDER environment variable. "breadth-first" is the order of
+// Cheney's scan of the to-space (the default), which copies the children of a
+// block far away from it once terms are more than a few levels deep.
+// "depth-first" scans the copied blocks from a stack instead, so that each block
+// is followed by its children, and the subterms of its first child come before
+// those of the others, which may suit the mutator's traversal of K sequences and
+// cons lists. It is opt-in until benchmarks/copy-order shows it to be faster.
+static bool depthFirstCopy = false;
+// the blocks copied into the young generation by a depth-first collection
+// whose children remain to be migrated
+static thread_local std::vector<block *> greyStack;
+#ifdef GC_DBG
+static thread_local char *last_alloc_ptr;
 #endif
 
-size_t numBytesLiveAtCollection[1 << AGE_WIDTH];
+thread_local size_t numBytesLiveAtCollection[1 << AGE_WIDTH];
+
+// Blocks of the mark-region old generation whose children remain to be
+// migrated: blocks promoted by the current collection, and blocks marked in
+// place by a collection of the old generation. The copying old generation is
+// scanned linearly instead.
+static thread_local std::vector<block *> markStack;
+
 void set_gc_threshold(size_t);
 size_t get_gc_threshold(void);
 bool youngspaceAlmostFull(size_t);
 
+// the threads of a parallel collection other than the one which triggered it
+// only set parallelGC
 bool during_gc() {
-  return is_gc;
+  return is_gc || parallelGC;
+}
+
+// Marks an object of the mark-region old generation reached by a collection of
+// the old generation. The object stays where it is, and the FWD_PTR_BIT of its
+// header records that it was marked until markRegionSweep clears it.
+static void mark_old_in_place(blockheader *h) {
+  h->hdr |= FWD_PTR_BIT;
+  markRegionRecordMarked(h);
+}
+
+// Keeps alive the memory of an object referenced by an object marked in place,
+// e.g. the limbs of an integer.
+static void mark_in_place(void *ptr, size_t size) {
+  if (isLargeObject(ptr)) {
+    largeObjectMark(ptr, true);
+  } else if (getArenaSemispaceIDOfObject(ptr) == OLDSPACE_ID) {
+    markRegionMarkLive(ptr, size);
+  }
+}
+
+__attribute__ ((constructor)) static void initCopyOrder() {
+  if (const char *env = getenv("KLLVM_GC_COPY_ORDER")) {
+    if (strcmp(env, "depth-first") == 0) {
+      depthFirstCopy = true;
+    } else if (strcmp(env, "breadth-first") == 0) {
+      depthFirstCopy = false;
+    } else {
+      fprintf(stderr, "Invalid value %s for KLLVM_GC_COPY_ORDER: must be depth-first or breadth-first\n", env);
+      abort();
+    }
+  }
+}
+
+// Prefetches the header of each child of a block pushed on the grey stack, which
+// is read when the block is popped and scavenged shortly afterwards.
+static void prefetch_children(block *currBlock, uint16_t layoutInt) {
+  layout *layoutData = get_layout_data(layoutInt);
+  for (unsigned i = 0; i < layoutData->nargs; i++) {
+    layoutitem *argData = layoutData->args + i;
+    if (argData->cat == SYMBOL_LAYOUT || argData->cat == VARIABLE_LAYOUT) {
+      block *child = *(block **)((char *)currBlock + argData->offset);
+      if (!is_leaf_block(child)) {
+        __builtin_prefetch(child);
+      }
+    }
+  }
 }
 
 size_t get_size(uint64_t hdr, uint16_t layout) {
@@ -47,27 +115,90 @@ void migrate(block** blockPtr) {
   if (is_leaf_block(currBlock)) {
     return;
   }
-  const uint64_t hdr = currBlock->h.hdr;
+  const uint64_t hdr = load_hdr(&currBlock->h);
+  if (isLargeObject(currBlock)) {
+    // large objects are marked in place rather than copied
+    uint16_t layout = layout_hdr(hdr);
+    if (largeObjectMark(currBlock, collect_old)) {
+      census_record(layout ? CENSUS_SYMBOL : CENSUS_STRING, tag_hdr(hdr), get_size(hdr, layout));
+      if (!layout) {
+        return;
+      }
+      if (parallelGC) {
+        pushGrey(currBlock);
+      } else {
+        scavenge_table[layout](currBlock);
+      }
+    }
+    return;
+  }
   initialize_migrate();
   uint16_t layout = layout_hdr(hdr);
   size_t lenInBytes = get_size(hdr, layout);
+  if (isInOldGen && markRegionOldGen) {
+    if (!hasForwardingAddress) {
+#ifdef GC_DBG
+      numBytesLiveAtCollection[oldAge] += lenInBytes;
+#endif
+      census_record(layout ? CENSUS_SYMBOL : CENSUS_STRING, tag_hdr(hdr), lenInBytes);
+      migrate_header(currBlock);
+      mark_old_in_place(&currBlock->h);
+      markRegionMarkLive(currBlock, lenInBytes);
+      if (layout) {
+        markStack.push_back(currBlock);
+      }
+    }
+    return;
+  }
   block** forwardingAddress = (block**)(currBlock + 1);
-  if (!hasForwardingAddress) {
-    block *newBlock;
-    if (shouldPromote || (isInOldGen && collect_old)) {
-      newBlock = (block *)koreAllocOld(lenInBytes);
-    } else {
-      newBlock = (block *)koreAlloc(lenInBytes);
+  if (!hasForwardingAddress && claim_hdr(&currBlock->h, hdr)) {
+    bool promote = shouldPromote || (isInOldGen && collect_old);
+    size_t hash = 0;
+    if (promote && dedupOldGen) {
+      // the block is not copied if the old generation already has a copy of
+      // it, cf dedup.cpp
+      if (block *canonical = dedup_lookup(currBlock, hdr, lenInBytes, &hash)) {
+        *forwardingAddress = canonical;
+        publish_hdr(&currBlock->h, hdr);
+        *blockPtr = canonical;
+        return;
+      }
     }
+    block *newBlock = (block *)koreAllocGC(lenInBytes, promote);
+    count_copy(lenInBytes);
+    census_record(layout ? CENSUS_SYMBOL : CENSUS_STRING, tag_hdr(hdr), lenInBytes);
 #ifdef GC_DBG
     numBytesLiveAtCollection[oldAge] += lenInBytes;
 #endif
+    // this also copies the cached hash of the block, if any, which does not
+    // depend on its address
     memcpy(newBlock, currBlock, lenInBytes);
+    newBlock->h.hdr = hdr;
     migrate_header(newBlock);
+    if (promote && dedupOldGen) {
+      dedup_record(currBlock, hdr, lenInBytes, hash, newBlock);
+    }
     *forwardingAddress = newBlock;
-    currBlock->h.hdr |= FWD_PTR_BIT;
+    publish_hdr(&currBlock->h, hdr);
     *blockPtr = newBlock;
+    if (parallelGC && layout) {
+      pushGrey(newBlock);
+    } else if (depthFirstCopy && layout && !promote) {
+      prefetch_children(newBlock, layout);
+      greyStack.push_back(newBlock);
+    }
+    if (markRegionOldGen && shouldPromote) {
+      if (collect_old) {
+        // the copy may be reached again through a collection, and must not be
+        // scavenged twice
+        mark_old_in_place(&newBlock->h);
+      }
+      if (layout) {
+        markStack.push_back(newBlock);
+      }
+    }
   } else {
+    await_forwarding(&currBlock->h);
     *blockPtr = *forwardingAddress;
   }
 }
@@ -79,94 +210,147 @@ void migrate_once(block** blockPtr) {
   if (is_leaf_block(currBlock)) {
     return;
   }
-  if (youngspace_collection_id() == getArenaSemispaceIDOfObject((void *)currBlock) ||
+  if (isLargeObject(currBlock) ||
+      youngspace_collection_id() == getArenaSemispaceIDOfObject((void *)currBlock) ||
       oldspace_collection_id() == getArenaSemispaceIDOfObject((void *)currBlock)) {
     migrate(blockPtr);
   }
 }
 
-static void migrate_string_buffer(stringbuffer** bufferPtr) {
+void migrate_string_buffer(stringbuffer** bufferPtr) {
   stringbuffer* buffer = *bufferPtr;
-  const uint64_t hdr = buffer->h.hdr;
+  const uint64_t hdr = load_hdr(&buffer->h);
   const uint64_t cap = len(buffer->contents);
   initialize_migrate();
-  if (!hasForwardingAddress) {
-    stringbuffer *newBuffer;
-    string *newContents;
-    if (shouldPromote || (isInOldGen && collect_old)) {
-      newBuffer = (stringbuffer *)koreAllocOld(sizeof(stringbuffer));
-      newContents = (string *)koreAllocTokenOld(sizeof(string) + cap);
-    } else {
-      newBuffer = (stringbuffer *)koreAlloc(sizeof(stringbuffer));
-      newContents = (string *)koreAllocToken(sizeof(string) + cap);
+  if (isInOldGen && markRegionOldGen) {
+    if (!hasForwardingAddress) {
+#ifdef GC_DBG
+      numBytesLiveAtCollection[oldAge] += cap + sizeof(stringbuffer) + sizeof(string);
+#endif
+      census_record(CENSUS_STRINGBUFFER, 0, cap + sizeof(stringbuffer) + sizeof(string));
+      migrate_header(buffer);
+      mark_old_in_place(&buffer->h);
+      markRegionMarkLive(buffer, sizeof(stringbuffer));
+      mark_in_place(buffer->contents, sizeof(string) + cap);
     }
+    return;
+  }
+  if (!hasForwardingAddress && claim_hdr(&buffer->h, hdr)) {
+    bool promote = shouldPromote || (isInOldGen && collect_old);
+    stringbuffer *newBuffer = (stringbuffer *)koreAllocGC(sizeof(stringbuffer), promote);
+    string *newContents = (string *)koreAllocTokenGC(sizeof(string) + cap, promote);
+    count_copy(cap + sizeof(stringbuffer) + sizeof(string));
+    census_record(CENSUS_STRINGBUFFER, 0, cap + sizeof(stringbuffer) + sizeof(string));
 #ifdef GC_DBG
     numBytesLiveAtCollection[oldAge] += cap + sizeof(stringbuffer) + sizeof(string);
 #endif
     memcpy(newContents, buffer->contents, sizeof(string) + buffer->strlen);
     memcpy(newBuffer, buffer, sizeof(stringbuffer));
+    newBuffer->h.hdr = hdr;
     migrate_header(newBuffer);
     newBuffer->contents = newContents;
     *(stringbuffer **)(buffer->contents) = newBuffer;
-    buffer->h.hdr |= FWD_PTR_BIT;
+    publish_hdr(&buffer->h, hdr);
   }
+  await_forwarding(&buffer->h);
   *bufferPtr = *(stringbuffer **)(buffer->contents);
 }
 
-static void migrate_mpz(mpz_ptr *mpzPtr) {
+// the number of bytes of an integer and its limbs
+static size_t mpz_census_size(mpz_hdr *intgr) {
+  if (intgr->i->_mp_alloc <= 0) {
+    return sizeof(mpz_hdr);
+  }
+  return sizeof(mpz_hdr) + sizeof(string) + intgr->i->_mp_alloc * sizeof(mp_limb_t);
+}
+
+void migrate_mpz(mpz_ptr *mpzPtr) {
   mpz_hdr *intgr = struct_base(mpz_hdr, i, *mpzPtr);
-  const uint64_t hdr = intgr->h.hdr;
+  const uint64_t hdr = load_hdr(&intgr->h);
   initialize_migrate();
-  if (!hasForwardingAddress) {
-    mpz_hdr *newIntgr;
+  if (isInOldGen && markRegionOldGen) {
+    if (!hasForwardingAddress) {
+      migrate_header(intgr);
+      mark_old_in_place(&intgr->h);
+      markRegionMarkLive(intgr, sizeof(mpz_hdr));
+      if (intgr->i->_mp_alloc > 0) {
+        string *limbs = struct_base(string, data, intgr->i->_mp_d);
+        mark_in_place(limbs, sizeof(string) + len(limbs));
+#ifdef GC_DBG
+        numBytesLiveAtCollection[oldAge] += len(limbs) + sizeof(string);
+#endif
+      }
+#ifdef GC_DBG
+      numBytesLiveAtCollection[oldAge] += sizeof(mpz_hdr);
+#endif
+      census_record(CENSUS_INT, 0, mpz_census_size(intgr));
+    }
+    return;
+  }
+  if (!hasForwardingAddress && claim_hdr(&intgr->h, hdr)) {
+    bool promote = shouldPromote || (isInOldGen && collect_old);
+    mpz_hdr *newIntgr = (mpz_hdr *)koreAllocGC(sizeof(mpz_hdr), promote);
     string *newLimbs;
     bool hasLimbs = intgr->i->_mp_alloc > 0;
+    count_copy(sizeof(mpz_hdr));
+    census_record(CENSUS_INT, 0, mpz_census_size(intgr));
 #ifdef GC_DBG
     numBytesLiveAtCollection[oldAge] += sizeof(mpz_hdr);
 #endif
     if (hasLimbs) {
       string *limbs = struct_base(string, data, intgr->i->_mp_d);
       size_t lenLimbs = len(limbs);
+      bool largeLimbs = isLargeObject(limbs);
 
 #ifdef GC_DBG
-      numBytesLiveAtCollection[oldAge] += lenLimbs + sizeof(string);
+      if (!largeLimbs) {
+        numBytesLiveAtCollection[oldAge] += lenLimbs + sizeof(string);
+      }
 #endif
 
       assert(intgr->i->_mp_alloc * sizeof(mp_limb_t) == lenLimbs);
 
-      if (shouldPromote || (isInOldGen && collect_old)) {
-        newIntgr = struct_base(mpz_hdr, i, koreAllocIntegerOld(0));
-        newLimbs = (string *) koreAllocTokenOld(sizeof(string) + lenLimbs);
+      if (largeLimbs) {
+        newLimbs = limbs;
+        largeObjectMark(limbs, collect_old);
       } else {
-        newIntgr = struct_base(mpz_hdr, i, koreAllocInteger(0));
-        newLimbs = (string *) koreAllocToken(sizeof(string) + lenLimbs);
-      }
-      memcpy(newLimbs, limbs, sizeof(string) + lenLimbs);
-    } else {
-      if (shouldPromote || (isInOldGen && collect_old)) {
-        newIntgr = struct_base(mpz_hdr, i, koreAllocIntegerOld(0));
-      } else {
-        newIntgr = struct_base(mpz_hdr, i, koreAllocInteger(0));
+        newLimbs = (string *) koreAllocTokenGC(sizeof(string) + lenLimbs, promote);
+        count_copy(sizeof(string) + lenLimbs);
+        memcpy(newLimbs, limbs, sizeof(string) + lenLimbs);
       }
     }
     memcpy(newIntgr, intgr, sizeof(mpz_hdr));
+    newIntgr->h.hdr = hdr;
     migrate_header(newIntgr);
     if (hasLimbs) {
       newIntgr->i->_mp_d = (mp_limb_t *)newLimbs->data;
     }
     *(mpz_ptr *)(&intgr->i->_mp_d) = newIntgr->i;
-    intgr->h.hdr |= FWD_PTR_BIT;
+    publish_hdr(&intgr->h, hdr);
   }
+  await_forwarding(&intgr->h);
   *mpzPtr = *(mpz_ptr *)(&intgr->i->_mp_d);
 }
 
-static void migrate_floating(floating **floatingPtr) {
+void migrate_floating(floating **floatingPtr) {
   floating_hdr *flt = struct_base(floating_hdr, f, *floatingPtr);
-  const uint64_t hdr = flt->h.hdr;
+  const uint64_t hdr = load_hdr(&flt->h);
   initialize_migrate();
-  if (!hasForwardingAddress) {
-    floating_hdr *newFlt;
-    string *newLimbs;
+  if (isInOldGen && markRegionOldGen) {
+    if (!hasForwardingAddress) {
+      string *limbs = struct_base(string, data, flt->f.f->_mpfr_d-1);
+#ifdef GC_DBG
+      numBytesLiveAtCollection[oldAge] += sizeof(floating_hdr) + sizeof(string) + len(limbs);
+#endif
+      census_record(CENSUS_FLOAT, 0, sizeof(floating_hdr) + sizeof(string) + len(limbs));
+      migrate_header(flt);
+      mark_old_in_place(&flt->h);
+      markRegionMarkLive(flt, sizeof(floating_hdr));
+      mark_in_place(limbs, sizeof(string) + len(limbs));
+    }
+    return;
+  }
+  if (!hasForwardingAddress && claim_hdr(&flt->h, hdr)) {
     string *limbs = struct_base(string, data, flt->f.f->_mpfr_d-1);
     size_t lenLimbs = len(limbs);
 
@@ -176,20 +360,20 @@ static void migrate_floating(floating **floatingPtr) {
 
     assert(((flt->f.f->_mpfr_prec + mp_bits_per_limb - 1) / mp_bits_per_limb) * sizeof(mp_limb_t) <= lenLimbs);
 
-    if (shouldPromote || (isInOldGen && collect_old)) {
-      newFlt = struct_base(floating_hdr, f, koreAllocFloatingOld(0));
-      newLimbs = (string *) koreAllocTokenOld(sizeof(string) + lenLimbs);
-    } else {
-      newFlt = struct_base(floating_hdr, f, koreAllocFloating(0));
-      newLimbs = (string *) koreAllocToken(sizeof(string) + lenLimbs);
-    }
+    bool promote = shouldPromote || (isInOldGen && collect_old);
+    floating_hdr *newFlt = (floating_hdr *)koreAllocGC(sizeof(floating_hdr), promote);
+    string *newLimbs = (string *) koreAllocTokenGC(sizeof(string) + lenLimbs, promote);
+    count_copy(sizeof(floating_hdr) + sizeof(string) + lenLimbs);
+    census_record(CENSUS_FLOAT, 0, sizeof(floating_hdr) + sizeof(string) + lenLimbs);
     memcpy(newLimbs, limbs, sizeof(string) + lenLimbs);
     memcpy(newFlt, flt, sizeof(floating_hdr));
+    newFlt->h.hdr = hdr;
     migrate_header(newFlt);
     newFlt->f.f->_mpfr_d = (mp_limb_t *)newLimbs->data+1;
     *(floating **)(flt->f.f->_mpfr_d) = &newFlt->f;
-    flt->h.hdr |= FWD_PTR_BIT;
+    publish_hdr(&flt->h, hdr);
   }
+  await_forwarding(&flt->h);
   *floatingPtr = *(floating **)(flt->f.f->_mpfr_d);
 }
 
@@ -230,103 +414,228 @@ static char* evacuate(char* scan_ptr, char** alloc_ptr) {
   const uint64_t hdr = currBlock->h.hdr;
   uint16_t layoutInt = layout_hdr(hdr);
   if (layoutInt) {
-    layout *layoutData = getLayoutData(layoutInt);
-    for (unsigned i = 0; i < layoutData->nargs; i++) {
-      migrate_child(currBlock, layoutData->args, i, false);
-    }
+    scavenge_table[layoutInt](currBlock);
   }
   return movePtr(scan_ptr, get_size(hdr, layoutInt), *alloc_ptr);
 }
 
-// Contains the decision logic for collecting the old generation.
-// For now, we collect the old generation every 50 young generation collections.
-static bool shouldCollectOldGen() {
-#ifdef GC_DBG
-  return true;
-#else
-  if (++num_collection_only_young == 50) {
-    num_collection_only_young = 0;
-    return true;
+static void scavenge_grey_stack(void) {
+  while (!greyStack.empty()) {
+    block *currBlock = greyStack.back();
+    greyStack.pop_back();
+    size_t pushed = greyStack.size();
+    scavenge_table[layout(currBlock)](currBlock);
+    // the children of the block were pushed in order, and are popped in order
+    // too so that the subterms of the first one are copied first
+    std::reverse(greyStack.begin() + pushed, greyStack.end());
   }
+}
 
-  return false;
-#endif
+static void scavenge_mark_stack(void) {
+  while (!markStack.empty()) {
+    block *currBlock = markStack.back();
+    markStack.pop_back();
+    scavenge_table[layout(currBlock)](currBlock);
+  }
+}
+
+// Scans the blocks copied into the copying old generation by the current
+// collection from the specified allocation pointer of the old generation, or
+// from the start of the old generation if it is null.
+static void evacuate_old_gen(char *previous_oldspace_alloc_ptr) {
+  char *scan_ptr;
+  if (!previous_oldspace_alloc_ptr) {
+    scan_ptr = oldspace_ptr();
+  } else {
+    if (mem_block_start(previous_oldspace_alloc_ptr+1) == previous_oldspace_alloc_ptr) {
+      // this means that the previous oldspace allocation pointer points to an
+      // address that is megabyte-aligned. This can only happen if we have just
+      // filled up a block but have not yet allocated the next block in the
+      // sequence at the start of the collection cycle. This means that the
+      // allocation pointer is invalid and does not actually point to the next
+      // address that would have been allocated at, according to the logic of
+      // arenaAlloc, which will have allocated a fresh memory block and put
+      // the allocation at the start of it. Thus, we use movePtr with a size
+      // of zero to adjust and get the true address of the allocation.
+      scan_ptr = movePtr(previous_oldspace_alloc_ptr, 0, *old_alloc_ptr());
+    } else {
+      scan_ptr = previous_oldspace_alloc_ptr;
+    }
+  }
+  if (scan_ptr != *old_alloc_ptr()) {
+    MEM_LOG("Evacuating old generation\n");
+    while(scan_ptr) {
+      scan_ptr = evacuate(scan_ptr, old_alloc_ptr());
+    }
+  }
+}
+
+// Promotes every young object reachable from the blocks pretenured since the
+// last collection. This must happen before anything else is migrated, since a
+// young object first copied into the young generation could no longer be
+// promoted when reached from a pretenured block. A pretenured block is
+// scavenged in place, or migrated like a root if the old generation is being
+// collected, in which case it survives until the next collection of the old
+// generation even if it is dead. Returns the allocation pointer of the old
+// generation from which the blocks copied into it remain to be scanned.
+static char *migrate_pretenured(char *previous_oldspace_alloc_ptr) {
+  if (pretenuredBlocks.empty()) {
+    return previous_oldspace_alloc_ptr;
+  }
+  MEM_LOG("Migrating pretenured blocks\n");
+  promote_all = true;
+  for (block *currBlock : pretenuredBlocks) {
+    if (collect_old) {
+      migrate(&currBlock);
+    } else {
+      scavenge_table[layout(currBlock)](currBlock);
+    }
+  }
+  pretenuredBlocks.clear();
+  if (markRegionOldGen) {
+    scavenge_mark_stack();
+  } else {
+    evacuate_old_gen(previous_oldspace_alloc_ptr);
+  }
+  promote_all = false;
+  return *old_alloc_ptr();
 }
 
 void migrateRoots();
 
+// Migrates the terms held by the frames of the shadow stack. Roots which have
+// not been stored to yet are null.
+static void migrate_gc_frames(void) {
+  char *frame = gc_frames_begin();
+  while (frame != gc_frame_top) {
+    gc_frame *f = (gc_frame *)frame;
+    for (unsigned i = 0; i < f->nroots; i++) {
+      if (f->roots[i]) {
+        migrate_child(f->roots, f->layout, i, true);
+      }
+    }
+    frame += sizeof(gc_frame) + f->nroots * sizeof(void *);
+  }
+}
+
+// The empty collections are static objects shared by every thread, which are
+// allocated once and never moved by the collector of any thread.
+static std::once_flag staticObjectsOnce;
+
 void initStaticObjects(void) {
-  map m = map();
-  list l = list();
-  set s = set();
-  setKoreMemoryFunctionsForGMP();
+  std::call_once(staticObjectsOnce, [] {
+    koreAllocStaticBegin();
+    map m = map();
+    list l = list();
+    set s = set();
+    koreAllocStaticEnd();
+    setKoreMemoryFunctionsForGMP();
+  });
 }
 
-void koreCollect(void** roots, uint8_t nroots, layoutitem *typeInfo) {
+// Collects from the specified roots and the frames of the shadow stack. The
+// always garbage-collected arena is cleared between steps only, since the
+// functions interrupted by a collection at a safepoint may still use the
+// temporaries allocated there.
+static void collect(void** roots, uint8_t nroots, layoutitem *typeInfo, bool atSafepoint) {
   is_gc = true;
-  collect_old = shouldCollectOldGen();
+  gcTelemetryStart();
+  startCollection();
+  bool census = censusBegin();
+  collect_old = census || shouldCollectOldGen();
   MEM_LOG("Starting garbage collection\n");
 #ifdef GC_DBG
   if (!last_alloc_ptr) {
-    last_alloc_ptr = youngspace_ptr();
+    last_alloc_ptr = arenaStartPtr(&youngspace);
   }
-  char *current_alloc_ptr = *young_alloc_ptr();
+  char *current_alloc_ptr = *arenaEndPtr(&youngspace);
 #endif
-  koreAllocSwap(collect_old);
+  size_t oldBytesBefore = oldspace_used();
+  if (markRegionOldGen && collect_old) {
+    markRegionStartMajor();
+  }
+  koreAllocSwap(collect_old, !atSafepoint);
 #ifdef GC_DBG
   for (int i = 0; i < 2048; i++) {
     numBytesLiveAtCollection[i] = 0;
   }
 #endif
-  char *previous_oldspace_alloc_ptr = *old_alloc_ptr();
+  numBytesDeduplicated = 0;
+  char *previous_oldspace_alloc_ptr = collect_old ? nullptr : *old_alloc_ptr();
+  previous_oldspace_alloc_ptr = migrate_pretenured(previous_oldspace_alloc_ptr);
+  bool parallel = !census && parallelCollectEnabled();
+  if (parallel) {
+    parallelCollectBegin();
+  }
   for (int i = 0; i < nroots; i++) {
     migrate_child(roots, typeInfo, i, true);
   }
   migrateRoots();
-  char *scan_ptr = youngspace_ptr();
-  if (scan_ptr != *young_alloc_ptr()) {
-    MEM_LOG("Evacuating young generation\n");
-    while(scan_ptr) {
-      scan_ptr = evacuate(scan_ptr, young_alloc_ptr());
-    }
-  }
-  if (collect_old || !previous_oldspace_alloc_ptr) {
-    scan_ptr = oldspace_ptr();
+  migrate_gc_frames();
+  if (parallel) {
+    // the copied blocks were pushed as they were copied rather than found by
+    // scanning the arenas, which the threads of the collector fill out of order
+    MEM_LOG("Scavenging in parallel\n");
+    parallelCollectRun();
   } else {
-    if (mem_block_start(previous_oldspace_alloc_ptr+1) == previous_oldspace_alloc_ptr) {
-      // this means that the previous oldspace allocation pointer points to an
-      // address that is megabyte-aligned. This can only happen if we have just
-      // filled up a block but have not yet allocated the next block in the
-      // sequence at the start of the collection cycle. This means that the
-      // allocation pointer is invalid and does not actually point to the next
-      // address that would have been allocated at, according to the logic of
-      // arenaAlloc, which will have allocated a fresh memory block and put
-      // the allocation at the start of it. Thus, we use movePtr with a size
-      // of zero to adjust and get the true address of the allocation.
-      scan_ptr = movePtr(previous_oldspace_alloc_ptr, 0, *old_alloc_ptr());
+    if (depthFirstCopy) {
+      MEM_LOG("Scavenging young generation depth-first\n");
+      scavenge_grey_stack();
     } else {
-      scan_ptr = previous_oldspace_alloc_ptr;
+      char *scan_ptr = arenaStartPtr(&youngspace);
+      if (scan_ptr != *arenaEndPtr(&youngspace)) {
+        MEM_LOG("Evacuating young generation\n");
+        while(scan_ptr) {
+          scan_ptr = evacuate(scan_ptr, arenaEndPtr(&youngspace));
+        }
+      }
     }
-  }
-  if (scan_ptr != *old_alloc_ptr()) {
-    MEM_LOG("Evacuating old generation\n");
-    while(scan_ptr) {
-      scan_ptr = evacuate(scan_ptr, old_alloc_ptr());
+    if (markRegionOldGen) {
+      MEM_LOG("Scavenging old generation\n");
+      scavenge_mark_stack();
+    } else {
+      evacuate_old_gen(previous_oldspace_alloc_ptr);
     }
   }
+  if (dedupOldGen) {
+    dedup_end();
+  }
+  if (hash_cons_terms) {
+    pruneHashConsTable();
+  }
+  largeObjectSweep(collect_old);
 #ifdef GC_DBG
   ssize_t numBytesAllocedSinceLastCollection = ptrDiff(current_alloc_ptr, last_alloc_ptr);
   assert(numBytesAllocedSinceLastCollection >= 0);
   fwrite(&numBytesAllocedSinceLastCollection, sizeof(ssize_t), 1, stderr);
-  last_alloc_ptr = *young_alloc_ptr();
+  last_alloc_ptr = *arenaEndPtr(&youngspace);
   fwrite(numBytesLiveAtCollection, 
       sizeof(numBytesLiveAtCollection[0]),
       sizeof(numBytesLiveAtCollection) / sizeof(numBytesLiveAtCollection[0]),
       stderr);
+  fwrite(&numBytesDeduplicated, sizeof(size_t), 1, stderr);
+  fwrite(&largeObjectBytes, sizeof(size_t), 1, stderr);
+  fwrite(&largeObjectBytesFreed, sizeof(size_t), 1, stderr);
 #endif
+  if (markRegionOldGen && collect_old) {
+    // clears the marks of the old generation, so must come after anything
+    // which looks at them
+    markRegionSweep();
+  }
+  allocationSitesAfterCollection();
+  if (census) {
+    censusEnd();
+  }
+  koreAllocReleaseUnused(collect_old);
+  recordCollection(collect_old, oldBytesBefore, oldspace_used());
+  gcTelemetryRecord(collect_old);
   MEM_LOG("Finishing garbage collection\n");
   is_gc = false;
-  set_gc_threshold(youngspace_size());
+  set_gc_threshold(nextYoungThreshold(collect_old));
+}
+
+void koreCollect(void** roots, uint8_t nroots, layoutitem *typeInfo) {
+  collect(roots, nroots, typeInfo, false);
 }
 
 void freeAllKoreMem() {
@@ -338,4 +647,11 @@ bool is_collection() {
   return youngspaceAlmostFull(threshold);
 }
 
+void koreSafepoint(void) {
+  if (gc_unsafe_frames || !is_collection()) {
+    return;
+  }
+  collect(nullptr, 0, nullptr, true);
+}
+
 }
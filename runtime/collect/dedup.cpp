@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// Deduplication of the blocks copied into the old generation. Two blocks whose
+// contents are the same words, i.e. two tokens with the same contents, or two
+// symbols whose children are the same objects, represent the same term, and
+// since terms are immutable, one copy of them is enough. When the collector
+// is about to copy a block into the old generation, it first looks it up among
+// the blocks it copied into the old generation so far during the collection.
+// If it finds one with the same contents, it forwards the block to that copy
+// instead of allocating a new one, so every reference to the block, be it from
+// a root, a block, or the node of a collection, is migrated to the copy, and
+// the duplicate is never allocated.
+//
+// The contents of the blocks are compared before their children are migrated,
+// so the blocks of two copies of the same term are only found to be
+// duplicates where their children are the same objects, e.g. the tokens and
+// constants at their leaves and the terms they share.
+
+namespace {
+
+struct canonical_block {
+  // offset of the contents of the block in keyWords
+  size_t key;
+  block *copy;
+};
+
+}
+
+// The contents of the blocks copied into the old generation during the current
+// collection, header included, cf key_hdr.
+// The blocks themselves cannot be compared, since the first word of a block is
+// overwritten by its forwarding address once it is copied, and the children of
+// its copy by their own copies once it is scavenged.
+static thread_local std::vector<uint64_t> keyWords;
+static thread_local std::unordered_multimap<size_t, canonical_block> canonical;
+
+thread_local size_t numBytesDeduplicated = 0;
+
+// Deduplication costs a hash table lookup per block promoted by each
+// collection, so it is only done if the KLLVM_GC_DEDUP environment variable is
+// set to on.
+bool dedupOldGen = false;
+
+__attribute__ ((constructor)) static void initDedup() {
+  if (const char *env = getenv("KLLVM_GC_DEDUP")) {
+    if (strcmp(env, "on") == 0) {
+      dedupOldGen = true;
+    } else if (strcmp(env, "off") != 0) {
+      fprintf(stderr, "Invalid value %s for KLLVM_GC_DEDUP: must be on or off\n", env);
+      abort();
+    }
+  }
+  if (!dedupOldGen) {
+    return;
+  }
+  // The mark-region old generation marks its blocks in place rather than
+  // copying them, and the threads of the parallel collector would have to
+  // share the table of canonical blocks, cf mark_region.cpp and parallel.cpp.
+  // The environment is read directly, since the constructors of those files
+  // may not have run yet.
+  const char *oldGen = getenv("KLLVM_OLD_GEN");
+  if (oldGen && strcmp(oldGen, "mark-region") == 0) {
+    fprintf(stderr, "KLLVM_GC_DEDUP=on is not supported with KLLVM_OLD_GEN=mark-region\n");
+    abort();
+  }
+  const char *threads = getenv("KLLVM_GC_THREADS");
+  if (threads && strtol(threads, nullptr, 10) > 1) {
+    fprintf(stderr, "KLLVM_GC_DEDUP=on is not supported with KLLVM_GC_THREADS=%s\n", threads);
+    abort();
+  }
+}
+
+// The number of words of a block compared by deduplication: every word of a
+// token, and every word but the cached hash, if any, of a symbol.
+static size_t key_size(uint16_t layout, size_t lenInBytes) {
+  if (layout && cache_term_hashes) {
+    lenInBytes -= sizeof(uint64_t);
+  }
+  return lenInBytes / sizeof(uint64_t);
+}
+
+// The header of a block without the bits of the collector. Unlike HDR_MASK,
+// this keeps VARIABLE_BIT, which distinguishes variables from other tokens.
+static uint64_t key_hdr(uint64_t hdr) {
+  return hdr & ~(NOT_YOUNG_OBJECT_BIT | AGE_MASK | FWD_PTR_BIT);
+}
+
+static size_t key_hash(block *b, uint64_t hdr, size_t size) {
+  size_t hash = 14695981039346656037ULL;
+  hash = (hash ^ key_hdr(hdr)) * 1099511628211ULL;
+  uint64_t *words = (uint64_t *)b;
+  for (size_t i = 1; i < size; i++) {
+    hash = (hash ^ words[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+extern "C" {
+
+  block *dedup_lookup(block *b, uint64_t hdr, size_t lenInBytes, size_t *hash) {
+    size_t size = key_size(layout_hdr(hdr), lenInBytes);
+    *hash = key_hash(b, hdr, size);
+    auto range = canonical.equal_range(*hash);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+      uint64_t *key = keyWords.data() + entry->second.key;
+      if (key[0] == key_hdr(hdr)
+          && memcmp(key + 1, b->children, (size - 1) * sizeof(uint64_t)) == 0) {
+        numBytesDeduplicated += lenInBytes;
+        return entry->second.copy;
+      }
+    }
+    return nullptr;
+  }
+
+  void dedup_record(block *b, uint64_t hdr, size_t lenInBytes, size_t hash, block *copy) {
+    size_t size = key_size(layout_hdr(hdr), lenInBytes);
+    size_t key = keyWords.size();
+    keyWords.push_back(key_hdr(hdr));
+    keyWords.insert(keyWords.end(), (uint64_t *)b->children, (uint64_t *)b + size);
+    canonical.emplace(hash, canonical_block{key, copy});
+  }
+
+  void dedup_end(void) {
+    keyWords.clear();
+    canonical.clear();
+  }
+}
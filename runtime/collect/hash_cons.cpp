@@ -0,0 +1,64 @@
+#include <unordered_map>
+#include <vector>
+
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// The hash-consing table maps the shallow hash of every canonical block to the
+// block itself. Blocks are hash-consed bottom-up, so the children of a block
+// are canonical by the time it is looked up, and two structurally equal blocks
+// are shallowly equal; a child which is not canonical only loses sharing. The
+// table does not keep the blocks it contains alive: after each collection,
+// pruneHashConsTable drops the entries whose block was garbage and rehashes the
+// others, since the collection may have moved their children. Each thread has a
+// table of its own, since blocks are not shared between threads.
+static thread_local std::unordered_multimap<size_t, block *> hashConsTable;
+
+extern "C" {
+
+  block *hash_cons(block *term) {
+    size_t hash = shallow_hash(term);
+    auto range = hashConsTable.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+      if (shallow_equal(iter->second, term)) {
+        return iter->second;
+      }
+    }
+    hashConsTable.emplace(hash, term);
+    return term;
+  }
+
+  // Must be called before largeObjectSweep and markRegionSweep, which clear the
+  // marks telling which of the blocks that do not move are live.
+  void pruneHashConsTable(void) {
+    std::vector<block *> live;
+    live.reserve(hashConsTable.size());
+    for (auto &entry : hashConsTable) {
+      block *term = entry.second;
+      const uint64_t hdr = term->h.hdr;
+      if (isLargeObject(term)) {
+        // large objects are never forwarded
+        if (largeObjectLive(term, collect_old)) {
+          live.push_back(term);
+        }
+        continue;
+      }
+      bool collected = is_in_young_gen_hdr(hdr) || (is_in_old_gen_hdr(hdr) && collect_old);
+      if (!collected) {
+        live.push_back(term);
+      } else if (markRegionOldGen && is_in_old_gen_hdr(hdr)) {
+        // the block was not moved, and is live if it was marked
+        if (hdr & FWD_PTR_BIT) {
+          live.push_back(term);
+        }
+      } else if (hdr & FWD_PTR_BIT) {
+        // cf migrate
+        live.push_back(*(block **)(term + 1));
+      }
+    }
+    hashConsTable.clear();
+    for (block *term : live) {
+      hashConsTable.emplace(shallow_hash(term), term);
+    }
+  }
+}
@@ -4,50 +4,91 @@
 
 #include <cstring>
 
-void migrate_collection_node(void **nodePtr) {
+// Copies the node *nodePtr points to, unless it has been copied already, and
+// sets owner if the current thread must migrate the slots of the node. A node
+// may be shared by several collections, and so reached by several threads of a
+// parallel collection, but only the thread which claims it when copying it (or
+// marks it first, for a large object) migrates its slots. Its slots have
+// already been migrated, or are being migrated, if it was copied before, and
+// need not be if it is not being collected.
+static void copy_collection_node(void **nodePtr, bool &owner) {
   string *currBlock = struct_base(string, data, *nodePtr);
+  if (isLargeObject(currBlock)) {
+    if (largeObjectMark(currBlock, collect_old)) {
+      census_record(CENSUS_COLLECTION_NODE, 0, get_size(currBlock->h.hdr, 0));
+      owner = true;
+    }
+    return;
+  }
   if (youngspace_collection_id() != getArenaSemispaceIDOfObject((void *)currBlock) &&
       oldspace_collection_id() != getArenaSemispaceIDOfObject((void *)currBlock)) {
     return;
   }
-  const uint64_t hdr = currBlock->h.hdr;
+  const uint64_t hdr = load_hdr(&currBlock->h);
   initialize_migrate();
   size_t lenInBytes = get_size(hdr, 0);
-  if (!hasForwardingAddress) {
-    string *newBlock;
-    if (shouldPromote || (isInOldGen && collect_old)) {
-      newBlock = (string *)koreAllocOld(lenInBytes);
-    } else {
-      newBlock = (string *)koreAlloc(lenInBytes);
-    }
+  if (isInOldGen && markRegionOldGen) {
+    // collection nodes are traversed whenever they are reached, so they need no
+    // mark of their own, and may be counted more than once by a census
+    census_record(CENSUS_COLLECTION_NODE, 0, lenInBytes);
+    markRegionMarkLive(currBlock, lenInBytes);
+    owner = true;
+    return;
+  }
+  if (!hasForwardingAddress && claim_hdr(&currBlock->h, hdr)) {
+    string *newBlock = (string *)koreAllocGC(lenInBytes, shouldPromote || (isInOldGen && collect_old));
+    count_copy(lenInBytes);
+    census_record(CENSUS_COLLECTION_NODE, 0, lenInBytes);
 #ifdef GC_DBG
     numBytesLiveAtCollection[oldAge] += lenInBytes;
 #endif
     memcpy(newBlock, currBlock, lenInBytes);
+    newBlock->h.hdr = hdr;
     migrate_header(newBlock);
     *(void **)(currBlock+1) = newBlock + 1;
-    currBlock->h.hdr |= FWD_PTR_BIT;
+    publish_hdr(&currBlock->h, hdr);
+    owner = true;
   }
-  *nodePtr = *(void **)(currBlock+1);
+  await_forwarding(&currBlock->h);
+  // released for the threads reading the relaxed sizes of a list root they do
+  // not own, cf list_tail_offset
+  __atomic_store_n(nodePtr, *(void **)(currBlock+1), __ATOMIC_RELEASE);
 }
 
+bool migrate_collection_node(void **nodePtr) {
+  bool owner = false;
+  copy_collection_node(nodePtr, owner);
+  return owner;
+}
+
+// Each visit is passed a cursor into an array recording which of the nodes
+// visited by the same call to each are owned by the current thread, since each
+// visits them in order.
 struct migrate_visitor : immer::detail::rbts::visitor_base<migrate_visitor> {
   using this_t = migrate_visitor;
 
   template <typename Pos>
-  static void visit_inner(Pos&& pos) {
+  static void visit_inner(Pos&& pos, const bool *&owned) {
+    if (!*owned++) {
+      return;
+    }
+    bool children[1 << list::bits];
     for (size_t i = 0; i < pos.count(); i++) {
       void **node = (void **)pos.node()->inner() + i;
-      migrate_collection_node(node);
+      children[i] = migrate_collection_node(node);
     }
     if (auto &relaxed = pos.node()->impl.d.data.inner.relaxed) {
       migrate_collection_node((void **)&relaxed);
     }
-    pos.each(this_t{});
+    const bool *cursor = children;
+    pos.each(this_t{}, cursor);
   }
 
   template <typename Pos>
-  static void visit_leaf(Pos&& pos) {
+  static void visit_leaf(Pos&& pos, const bool *&owned) {
+    if (!*owned++) {
+      return;
+    }
     for (size_t i = 0; i < pos.count(); i++) {
       block **element = (block **)pos.node()->leaf() + i;
       migrate_once(element);
@@ -55,22 +96,51 @@ struct migrate_visitor : immer::detail::rbts::visitor_base<migrate_visitor> {
   }
 };
 
+// The offset of the tail of a list, i.e. the number of its elements held by
+// its root. The relaxed sizes of the root are read from their copy, since the
+// thread which owns the root may be migrating them.
+static size_t list_tail_offset(list_impl &impl) {
+  void *relaxed = __atomic_load_n((void **)&impl.root->impl.d.data.inner.relaxed, __ATOMIC_ACQUIRE);
+  if (!relaxed) {
+    return impl.tail_offset();
+  }
+  migrate_collection_node(&relaxed);
+  auto sizes = (list_node::relaxed_t *)relaxed;
+  return sizes->d.sizes[sizes->d.count - 1];
+}
+
 void migrate_list(void *l) {
   auto &impl = ((list *)l)->impl();
-  migrate_collection_node((void **)&impl.root);
-  migrate_collection_node((void **)&impl.tail);
-  if (auto &relaxed = impl.root->impl.d.data.inner.relaxed) {
-    migrate_collection_node((void **)&relaxed);
+  bool ownsRoot = migrate_collection_node((void **)&impl.root);
+  bool ownsTail = migrate_collection_node((void **)&impl.tail);
+  if (ownsRoot) {
+    if (auto &relaxed = impl.root->impl.d.data.inner.relaxed) {
+      migrate_collection_node((void **)&relaxed);
+    }
+  }
+  if (!ownsRoot && !ownsTail) {
+    return;
+  }
+  size_t tailOffset = ownsRoot ? impl.tail_offset() : list_tail_offset(impl);
+  if (ownsRoot && tailOffset) {
+    const bool owned = true;
+    const bool *cursor = &owned;
+    immer::detail::rbts::visit_maybe_relaxed_sub(impl.root, impl.shift, tailOffset, migrate_visitor{}, cursor);
+  }
+  if (ownsTail) {
+    for (size_t i = 0; i < impl.size - tailOffset; i++) {
+      migrate_once((block **)impl.tail->leaf() + i);
+    }
   }
-  impl.traverse(migrate_visitor{});
 }
 
 template <typename Fn, typename NodeT>
 void migrate_champ_traversal(NodeT *node, immer::detail::hamts::count_t depth, Fn&& fn) {
   if (depth < immer::detail::hamts::max_depth<immer::default_bits>) {
     auto datamap = node->datamap();
-    if (datamap) {
-      migrate_collection_node((void **)&node->impl.d.data.inner.values);
+    // the values of a node are a separate allocation, which may be shared by
+    // nodes owned by different threads
+    if (datamap && migrate_collection_node((void **)&node->impl.d.data.inner.values)) {
       fn(node->values(), node->values() + immer::detail::hamts::popcount(datamap));
     }
     auto nodemap = node->nodemap();
@@ -78,8 +148,9 @@ void migrate_champ_traversal(NodeT *node, immer::detail::hamts::count_t depth, F
       auto fst = node->children();
       auto lst = fst + immer::detail::hamts::popcount(nodemap);
       for (; fst != lst; ++fst) {
-        migrate_collection_node((void **)fst);
-        migrate_champ_traversal(*fst, depth + 1, fn);
+        if (migrate_collection_node((void **)fst)) {
+          migrate_champ_traversal(*fst, depth + 1, fn);
+        }
       }
     }
   } else {
@@ -102,12 +173,14 @@ void migrate_set_leaf(KElem *start, KElem *end) {
 
 void migrate_set(void *s) {
   auto &impl = ((set *)s)->impl();
-  migrate_collection_node((void **)&impl.root);
-  migrate_champ_traversal(impl.root, 0, migrate_set_leaf);
+  if (migrate_collection_node((void **)&impl.root)) {
+    migrate_champ_traversal(impl.root, 0, migrate_set_leaf);
+  }
 }
 
 void migrate_map(void *m) {
   auto &impl = ((map *)m)->impl();
-  migrate_collection_node((void **)&impl.root);
-  migrate_champ_traversal(impl.root, 0, migrate_map_leaf);
+  if (migrate_collection_node((void **)&impl.root)) {
+    migrate_champ_traversal(impl.root, 0, migrate_map_leaf);
+  }
 }
@@ -2,10 +2,10 @@
 
 #include "runtime/collect.h"
 
-extern std::vector<BlockEnumerator> blockEnumerators;
+extern thread_local std::vector<BlockEnumerator> blockEnumerators;
 
-extern gmp_randstate_t kllvm_randState;
-extern bool kllvm_randStateInitialized;
+extern thread_local gmp_randstate_t kllvm_randState;
+extern thread_local bool kllvm_randStateInitialized;
 
 extern "C" {
 
@@ -0,0 +1,234 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "runtime/alloc.h"
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// A parallel version of the copying collector, enabled by setting the
+// KLLVM_GC_THREADS environment variable to the number of threads to collect
+// with (default 1, i.e. the serial collector of collect.cpp).
+//
+// The thread which triggered the collection migrates the roots, then wakes up
+// the other threads of the collector, which are started at the first
+// collection and sleep between collections. Each thread copies objects into
+// allocation buffers of its own (cf koreAllocGC) and pushes the blocks it
+// copies onto a deque of its own, from which it pops blocks to scavenge. A
+// thread whose deque is empty steals blocks from the front of the deques of the
+// other threads. Objects reached by several threads at once are copied once,
+// cf claim_hdr, and the nodes of immer collections are traversed only by the
+// thread which copied them, cf migrate_collection_node. The collection ends
+// once every thread is out of work.
+//
+// The parallel collector does not support the mark-region old generation, nor
+// builds with GC_DBG, whose statistics are not thread-safe, nor the
+// deduplication of the old generation (cf dedup.cpp), whose table of the blocks
+// copied into the old generation is not shared between threads.
+//
+// The threads of the collector are shared by the heaps of every thread, and
+// take part in one collection at a time. For its duration, they adopt the heap
+// and the state of the collector of the thread which triggered it.
+
+namespace {
+
+struct grey_deque {
+  std::mutex lock;
+  std::deque<block *> blocks;
+  // read without the lock by threads looking for work
+  std::atomic<size_t> size{0};
+};
+
+// The threads of the collector other than the one which triggered the
+// collection sleep on wake between collections.
+struct worker_pool {
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t epoch = 0;
+  unsigned finished = 0;
+  // the heap being collected, and whether its old generation is
+  kore_heap heap;
+  bool collectOld = false;
+};
+
+}
+
+thread_local bool parallelGC = false;
+
+// held by the thread which triggered a parallel collection from
+// parallelCollectBegin to the end of parallelCollectRun
+static std::mutex collectionLock;
+
+static unsigned numThreads = 1;
+// Allocated at the first parallel collection and never destroyed, since the
+// threads of the collector still use them when the program exits.
+static grey_deque *deques;
+static worker_pool *pool;
+static thread_local unsigned threadIndex = 0;
+// the number of threads which are out of work
+static std::atomic<unsigned> idle;
+
+__attribute__ ((constructor)) static void initParallelGC() {
+  if (const char *env = getenv("KLLVM_GC_THREADS")) {
+    char *end;
+    long threads = strtol(env, &end, 10);
+    if (*end || threads < 1) {
+      fprintf(stderr, "Invalid value %s for KLLVM_GC_THREADS: must be a positive integer\n", env);
+      abort();
+    }
+    numThreads = threads;
+  }
+#ifdef GC_DBG
+  if (numThreads > 1) {
+    fprintf(stderr, "KLLVM_GC_THREADS is not supported in builds with GC_DBG\n");
+    abort();
+  }
+#endif
+}
+
+static bool popGrey(block **result) {
+  grey_deque &own = deques[threadIndex];
+  std::lock_guard<std::mutex> guard(own.lock);
+  if (own.blocks.empty()) {
+    return false;
+  }
+  *result = own.blocks.back();
+  own.blocks.pop_back();
+  own.size.store(own.blocks.size(), std::memory_order_relaxed);
+  return true;
+}
+
+static bool stealGrey(block **result) {
+  for (unsigned i = 1; i < numThreads; i++) {
+    grey_deque &victim = deques[(threadIndex + i) % numThreads];
+    if (!victim.size.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.blocks.empty()) {
+      *result = victim.blocks.front();
+      victim.blocks.pop_front();
+      victim.size.store(victim.blocks.size(), std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool anyGrey() {
+  for (unsigned i = 0; i < numThreads; i++) {
+    if (deques[i].size.load(std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Scavenges blocks until every thread is out of work. A thread only pushes
+// blocks while it is not idle, so once all of them are idle, every deque is
+// empty for good.
+static void drain() {
+  block *currBlock;
+  while (true) {
+    if (popGrey(&currBlock) || stealGrey(&currBlock)) {
+      scavenge_table[layout(currBlock)](currBlock);
+      continue;
+    }
+    idle.fetch_add(1);
+    while (true) {
+      if (idle.load() == numThreads) {
+        return;
+      }
+      if (anyGrey()) {
+        idle.fetch_sub(1);
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+static void workerLoop(unsigned index) {
+  threadIndex = index;
+  uint64_t seen = 0;
+  while (true) {
+    kore_heap heap;
+    {
+      std::unique_lock<std::mutex> guard(pool->lock);
+      pool->wake.wait(guard, [&] { return pool->epoch != seen; });
+      seen = pool->epoch;
+      heap = pool->heap;
+      collect_old = pool->collectOld;
+    }
+    parallelGC = true;
+    koreAllocGCBegin(heap);
+    drain();
+    koreAllocGCEnd();
+    gcTelemetryFlushThread();
+    parallelGC = false;
+    {
+      std::lock_guard<std::mutex> guard(pool->lock);
+      pool->finished++;
+    }
+    pool->done.notify_one();
+  }
+}
+
+extern "C" {
+
+bool parallelCollectEnabled(void) {
+  if (numThreads > 1 && markRegionOldGen) {
+    fprintf(stderr, "KLLVM_GC_THREADS is not supported with KLLVM_OLD_GEN=mark-region\n");
+    abort();
+  }
+  return numThreads > 1;
+}
+
+void parallelCollectBegin(void) {
+  collectionLock.lock();
+  if (!pool) {
+    deques = new grey_deque[numThreads];
+    pool = new worker_pool;
+    largeObjectSpaceShared();
+    for (unsigned i = 1; i < numThreads; i++) {
+      std::thread(workerLoop, i).detach();
+    }
+  }
+  parallelGC = true;
+  koreAllocGCBegin(koreCurrentHeap());
+}
+
+void pushGrey(block *currBlock) {
+  grey_deque &own = deques[threadIndex];
+  std::lock_guard<std::mutex> guard(own.lock);
+  own.blocks.push_back(currBlock);
+  own.size.store(own.blocks.size(), std::memory_order_relaxed);
+}
+
+void parallelCollectRun(void) {
+  idle.store(0);
+  {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->finished = 0;
+    pool->heap = koreCurrentHeap();
+    pool->collectOld = collect_old;
+    pool->epoch++;
+  }
+  pool->wake.notify_all();
+  drain();
+  koreAllocGCEnd();
+  {
+    std::unique_lock<std::mutex> guard(pool->lock);
+    pool->done.wait(guard, [] { return pool->finished == numThreads - 1; });
+  }
+  gcTelemetryGatherThreads();
+  parallelGC = false;
+  collectionLock.unlock();
+}
+
+}
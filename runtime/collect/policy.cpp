@@ -0,0 +1,256 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "runtime/alloc.h"
+#include "runtime/arena.h"
+#include "runtime/collect.h"
+
+// Decides when to collect the old generation. The old generation is collected
+// once it has grown, since the end of the previous collection of the old
+// generation, by a fraction of its size at that point (its growth budget).
+// This fraction adapts to the survival ratio of the old generation, i.e. the
+// fraction of it which survived the last collection of the old generation, not
+// counting the bytes which that collection promoted: if a collection of the old
+// generation reclaimed little, collecting it was mostly wasted work and the
+// fraction doubles; if it reclaimed most of it, the fraction halves. In order
+// not to overshoot the budget, the collection is triggered one young collection
+// early if the bytes promoted by the next young collection, estimated from the
+// recent promotion rate, would exceed it.
+//
+// The policy can be tuned with the following environment variables:
+//
+// KLLVM_OLD_GEN_GROWTH: the initial and minimum fraction, at least 1 (default
+//   1, i.e. the old generation is collected when it has doubled in size).
+// KLLVM_OLD_GEN_MAX_GROWTH: the maximum fraction, at least the minimum one
+//   (default 8).
+// KLLVM_OLD_GEN_MIN_BYTES: the minimum growth budget in bytes (default 32MB).
+// KLLVM_OLD_GEN_INTERVAL: if nonzero, disables the adaptive policy and collects
+//   the old generation every N collections instead (the historical policy with
+//   N = 50).
+//
+// The size of the young generation is also decided here. By default, it is the
+// size of the young arena, which grows whenever the mutator allocates past the
+// end of its last block between two collections. The following environment
+// variables set targets for a controller which grows and shrinks it instead:
+//
+// KLLVM_GC_MAX_OVERHEAD: the maximum fraction of run time spent collecting,
+//   between 0 and 1 exclusive, e.g. 0.1. While the recent overhead of the
+//   collections, young and old, exceeds it, the young generation doubles in
+//   size, so that it is collected half as often.
+// KLLVM_GC_MAX_PAUSE_MS: the maximum duration of a young collection in
+//   milliseconds, a positive number. When a young collection exceeds it, the
+//   young generation halves in size. This takes precedence over the overhead
+//   target.
+// KLLVM_HEAP_LIMIT: a limit in bytes on the size of the young generation plus
+//   the used part of the old generation, a positive integer. The young
+//   generation shrinks to stay within it, and the old generation is collected
+//   when it would exceed it.
+
+extern "C" {
+
+char **old_alloc_ptr(void);
+char *oldspace_ptr(void);
+size_t get_gc_threshold(void);
+
+}
+
+// The parameters of the policy, shared by every thread.
+static double minGrowth = 1.0;
+static double maxGrowth = 8.0;
+static size_t minBudget = 32 * 1024 * 1024;
+static unsigned fixedInterval = 0;
+
+static double maxOverhead = 0;
+static double maxPause = 0;
+static size_t heapLimit = 0;
+
+// The state of the policy for the heap of the current thread. growth is zero
+// until the first collection of the heap.
+static thread_local double growth = 0;
+static thread_local size_t oldBytesAfterMajor = 0;
+static thread_local double promotionRate = 0;
+static thread_local unsigned numCollectionsOnlyYoung = 0;
+
+using gc_clock = std::chrono::steady_clock;
+static thread_local gc_clock::time_point collectionStart;
+static thread_local gc_clock::time_point lastCollectionEnd;
+static thread_local double lastPause = 0;
+static thread_local double overhead = 0;
+static thread_local size_t youngThreshold = 0;
+
+static void invalidPolicy(const char *var, const char *value, const char *reason) {
+  fprintf(stderr, "Invalid value %s for %s: %s\n", value, var, reason);
+  abort();
+}
+
+static double parseNumber(const char *var, const char *value) {
+  char *end;
+  double result = strtod(value, &end);
+  if (end == value || *end) {
+    invalidPolicy(var, value, "must be a number");
+  }
+  return result;
+}
+
+static unsigned long long parseInteger(const char *var, const char *value) {
+  char *end;
+  unsigned long long result = strtoull(value, &end, 10);
+  if (end == value || *end || *value == '-') {
+    invalidPolicy(var, value, "must be a nonnegative integer");
+  }
+  return result;
+}
+
+__attribute__ ((constructor)) static void initPolicy() {
+  if (const char *env = getenv("KLLVM_OLD_GEN_GROWTH")) {
+    minGrowth = parseNumber("KLLVM_OLD_GEN_GROWTH", env);
+    if (!(minGrowth >= 1)) {
+      invalidPolicy("KLLVM_OLD_GEN_GROWTH", env, "must be at least 1");
+    }
+  }
+  if (const char *env = getenv("KLLVM_OLD_GEN_MAX_GROWTH")) {
+    maxGrowth = parseNumber("KLLVM_OLD_GEN_MAX_GROWTH", env);
+    if (!(maxGrowth >= minGrowth)) {
+      invalidPolicy("KLLVM_OLD_GEN_MAX_GROWTH", env, "must be at least KLLVM_OLD_GEN_GROWTH");
+    }
+  } else if (maxGrowth < minGrowth) {
+    maxGrowth = minGrowth;
+  }
+  if (const char *env = getenv("KLLVM_OLD_GEN_MIN_BYTES")) {
+    minBudget = parseInteger("KLLVM_OLD_GEN_MIN_BYTES", env);
+  }
+  if (const char *env = getenv("KLLVM_OLD_GEN_INTERVAL")) {
+    unsigned long long interval = parseInteger("KLLVM_OLD_GEN_INTERVAL", env);
+    if (interval > UINT32_MAX) {
+      invalidPolicy("KLLVM_OLD_GEN_INTERVAL", env, "is too large");
+    }
+    fixedInterval = interval;
+  }
+  if (const char *env = getenv("KLLVM_GC_MAX_OVERHEAD")) {
+    maxOverhead = parseNumber("KLLVM_GC_MAX_OVERHEAD", env);
+    if (!(maxOverhead > 0 && maxOverhead < 1)) {
+      invalidPolicy("KLLVM_GC_MAX_OVERHEAD", env, "must be between 0 and 1 exclusive");
+    }
+  }
+  if (const char *env = getenv("KLLVM_GC_MAX_PAUSE_MS")) {
+    maxPause = parseNumber("KLLVM_GC_MAX_PAUSE_MS", env) / 1000;
+    if (!(maxPause > 0)) {
+      invalidPolicy("KLLVM_GC_MAX_PAUSE_MS", env, "must be positive");
+    }
+  }
+  if (const char *env = getenv("KLLVM_HEAP_LIMIT")) {
+    heapLimit = parseInteger("KLLVM_HEAP_LIMIT", env);
+    if (heapLimit == 0) {
+      invalidPolicy("KLLVM_HEAP_LIMIT", env, "must be positive");
+    }
+  }
+}
+
+size_t oldspace_used(void) {
+  if (markRegionOldGen) {
+    return markRegionBytesUsed();
+  }
+  char *start = oldspace_ptr();
+  if (!start) {
+    return 0;
+  }
+  return ptrDiff(*old_alloc_ptr(), start);
+}
+
+bool shouldCollectOldGen(void) {
+#ifdef GC_DBG
+  return true;
+#else
+  if (!growth) {
+    growth = minGrowth;
+  }
+  size_t used = oldspace_used();
+  if (heapLimit && used + get_gc_threshold() > heapLimit) {
+    return true;
+  }
+  if (fixedInterval) {
+    return numCollectionsOnlyYoung + 1 >= fixedInterval;
+  }
+  size_t grown = used > oldBytesAfterMajor ? used - oldBytesAfterMajor : 0;
+  size_t budget = oldBytesAfterMajor * growth;
+  if (budget < minBudget) {
+    budget = minBudget;
+  }
+  return grown + promotionRate >= budget;
+#endif
+}
+
+void startCollection(void) {
+  collectionStart = gc_clock::now();
+}
+
+void recordCollection(bool collectedOld, size_t oldBytesBefore, size_t oldBytesAfter) {
+  if (!growth) {
+    growth = minGrowth;
+  }
+  auto collectionEnd = gc_clock::now();
+  lastPause = std::chrono::duration<double>(collectionEnd - collectionStart).count();
+  if (lastCollectionEnd != gc_clock::time_point()) {
+    double mutator = std::chrono::duration<double>(collectionStart - lastCollectionEnd).count();
+    if (lastPause + mutator > 0) {
+      // exponential moving average of the fraction of time spent collecting,
+      // including the collections of the old generation, which the young
+      // generation growing makes less frequent too
+      overhead = (overhead + lastPause / (lastPause + mutator)) / 2;
+    }
+  }
+  lastCollectionEnd = collectionEnd;
+  if (collectedOld) {
+    numCollectionsOnlyYoung = 0;
+    oldBytesAfterMajor = oldBytesAfter;
+    // the bytes promoted from the young generation by this collection did
+    // not survive a collection of the old generation yet
+    size_t survived = oldBytesAfter > gcBytesPromoted ? oldBytesAfter - gcBytesPromoted : 0;
+    if (oldBytesBefore) {
+      double survival = (double)survived / oldBytesBefore;
+      if (survival > 0.75 && growth * 2 <= maxGrowth) {
+        growth *= 2;
+      } else if (survival < 0.25 && growth / 2 >= minGrowth) {
+        growth /= 2;
+      }
+    }
+  } else {
+    numCollectionsOnlyYoung++;
+    size_t promoted = oldBytesAfter > oldBytesBefore ? oldBytesAfter - oldBytesBefore : 0;
+    // exponential moving average of the bytes promoted per young collection
+    promotionRate = (promotionRate + promoted) / 2;
+  }
+}
+
+size_t nextYoungThreshold(bool collectedOld) {
+  size_t arenaSize = youngspace_size();
+  if (!maxOverhead && !maxPause && !heapLimit) {
+    return arenaSize;
+  }
+  size_t minThreshold = BLOCK_SIZE - sizeof(memory_block_header);
+  if (!youngThreshold) {
+    youngThreshold = arenaSize;
+  }
+  // the duration of a collection of the old generation says little about the
+  // size of the young generation
+  if (!collectedOld) {
+    if (maxPause && lastPause > maxPause) {
+      youngThreshold /= 2;
+    } else if (maxOverhead && overhead > maxOverhead) {
+      youngThreshold *= 2;
+    }
+  }
+  if (heapLimit) {
+    size_t used = oldspace_used();
+    size_t available = heapLimit > used ? heapLimit - used : 0;
+    if (youngThreshold > available) {
+      youngThreshold = available;
+    }
+  }
+  if (youngThreshold < minThreshold) {
+    youngThreshold = minThreshold;
+  }
+  return youngThreshold;
+}
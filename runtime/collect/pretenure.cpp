@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "runtime/alloc.h"
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// Allocation-site pretenuring. The blocks constructed at the allocation sites
+// selected by the profile passed to llvm-kompile with --pretenure are
+// allocated directly in the old generation by koreAllocPretenured, rather than
+// being copied twice before their promotion.
+//
+// Unlike a block promoted by a collection, whose children are always at least
+// as old as itself, a pretenured block may point to young objects. The
+// collection following its allocation therefore promotes every young object
+// reachable from it before migrating anything else, cf migrate_pretenured in
+// collect.cpp.
+//
+// The profile is gathered by programs kompiled with
+// --profile-allocation-sites, which record the allocation site of each block
+// they construct and count the blocks of each site promoted by a collection.
+// The counts are written at exit to the file named by KLLVM_ALLOCATION_PROFILE
+// (default allocation_profile.txt), one line per site: the number of blocks
+// allocated, the number of blocks promoted and the name of the site, separated
+// by tabs.
+
+thread_local std::vector<block *> pretenuredBlocks;
+
+namespace {
+
+struct site_counts {
+  uint64_t allocated = 0;
+  uint64_t promoted = 0;
+};
+
+}
+
+// Allocated at the first recorded allocation and never destroyed, since it is
+// written out when the program exits. Shared by every thread.
+static std::unordered_map<const char *, site_counts> *sites;
+static std::mutex sitesLock;
+// the allocation site of each young block of the heap of the current thread
+// recorded since it was allocated
+static thread_local std::unordered_map<block *, const char *> *youngBlocks;
+
+extern "C" {
+
+void *koreAllocPretenured(size_t requested) {
+  block *result = (block *)koreAllocOld(requested);
+  pretenuredBlocks.push_back(result);
+  return result;
+}
+
+void koreRecordAllocationSite(block *b, const char *site) {
+  std::lock_guard<std::mutex> guard(sitesLock);
+  if (!sites) {
+    sites = new std::unordered_map<const char *, site_counts>;
+  }
+  if (!youngBlocks) {
+    youngBlocks = new std::unordered_map<block *, const char *>;
+  }
+  site_counts &counts = (*sites)[site];
+  counts.allocated++;
+  if (is_in_young_gen_hdr(b->h.hdr)) {
+    (*youngBlocks)[b] = site;
+  } else {
+    // pretenured
+    counts.promoted++;
+  }
+}
+
+void allocationSitesAfterCollection(void) {
+  if (!youngBlocks) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(sitesLock);
+  auto survivors = new std::unordered_map<block *, const char *>;
+  for (auto &entry : *youngBlocks) {
+    block *b = entry.first;
+    if (!(b->h.hdr & FWD_PTR_BIT)) {
+      // died
+      continue;
+    }
+    block *copy = *(block **)(b + 1);
+    if (is_in_young_gen_hdr(copy->h.hdr)) {
+      (*survivors)[copy] = entry.second;
+    } else {
+      (*sites)[entry.second].promoted++;
+    }
+  }
+  delete youngBlocks;
+  youngBlocks = survivors;
+}
+
+}
+
+__attribute__ ((destructor)) static void writeAllocationProfile() {
+  if (!sites) {
+    return;
+  }
+  const char *filename = getenv("KLLVM_ALLOCATION_PROFILE");
+  FILE *file = fopen(filename ? filename : "allocation_profile.txt", "w");
+  if (!file) {
+    perror("fopen");
+    return;
+  }
+  for (auto &entry : *sites) {
+    fprintf(file, "%lu\t%lu\t%s\n", entry.second.allocated, entry.second.promoted, entry.first);
+  }
+  fclose(file);
+}
@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// The frames of the shadow stack are pushed and popped by generated code (cf
+// GCFrame in lib/codegen/GCFrame.cpp) in a region reserved at startup. Only
+// the pages of the region which are actually used are backed by memory. The
+// last page of the region is left inaccessible, so that overflowing the shadow
+// stack crashes like overflowing the stack does.
+//
+// Each thread has a shadow stack of its own. The one of the main thread is set
+// up at startup, and those of other threads when they first enter the
+// rewriter. The region of a thread is unmapped when it exits.
+
+static const size_t GC_FRAMES_SIZE = 1024 * 1024 * 1024;
+
+namespace {
+
+struct gc_frames_region {
+  char *begin = nullptr;
+
+  ~gc_frames_region() {
+    if (begin) {
+      munmap(begin, GC_FRAMES_SIZE);
+    }
+  }
+};
+
+}
+
+static thread_local gc_frames_region gc_frames;
+
+extern "C" {
+
+thread_local char *gc_frame_top;
+thread_local uint64_t gc_unsafe_frames = 0;
+
+char *gc_frames_begin(void) {
+  return gc_frames.begin;
+}
+
+void initGCFrames(void) {
+  if (gc_frames.begin) {
+    return;
+  }
+  char *region = (char *)mmap(NULL, GC_FRAMES_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  }
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (mprotect(region + GC_FRAMES_SIZE - page, page, PROT_NONE)) {
+    perror("mprotect");
+    abort();
+  }
+  gc_frames.begin = region;
+  gc_frame_top = region;
+}
+
+}
+
+__attribute__ ((constructor)) static void initMainGCFrames() {
+  initGCFrames();
+}
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "runtime/alloc.h"
+#include "runtime/header.h"
+#include "runtime/collect.h"
+
+// Telemetry of the collector, available in every build. If the KLLVM_GC_STATS
+// environment variable names a file, one line of comma-separated values is
+// written to it at the end of each collection, with the following fields:
+//
+// timestamp_ns: the start of the collection, in nanoseconds since the program
+//   started.
+// pause_ns: the duration of the collection in nanoseconds.
+// major: 1 if the collection collected the old generation, 0 otherwise.
+// young_before, young_after: the number of bytes in the young generation at
+//   the start and at the end of the collection.
+// old_before, old_after: the same for the old generation.
+// bytes_copied: the number of bytes copied by the collection, including those
+//   of the old generation when it is collected.
+// bytes_promoted: the number of bytes copied from the young generation into
+//   the old generation.
+//
+// The first line names the fields, and the last line, written when the program
+// exits, is a comment recording its total run time, e.g. `# total_ns=123`.
+// `llvm-kompile-gc-stats summary <file>` summarizes the pauses and the overhead
+// of the collector from such a file.
+
+thread_local size_t gcBytesCopied;
+thread_local size_t gcBytesPromoted;
+
+using telemetry_clock = std::chrono::steady_clock;
+
+// shared by every thread, which write their collections to it line by line
+static FILE *statsFile;
+static telemetry_clock::time_point programStart;
+static thread_local telemetry_clock::time_point collectionStart;
+static thread_local size_t youngBytesBefore;
+static thread_local size_t oldBytesBefore;
+// the bytes copied by the threads of the parallel collector other than the one
+// which triggered the collection. Parallel collections do not overlap, cf
+// parallel.cpp
+static std::atomic<size_t> otherThreadsCopied;
+static std::atomic<size_t> otherThreadsPromoted;
+
+static uint64_t nanosecondsSince(telemetry_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(telemetry_clock::now() - start).count();
+}
+
+__attribute__ ((constructor)) static void initTelemetry() {
+  programStart = telemetry_clock::now();
+  const char *filename = getenv("KLLVM_GC_STATS");
+  if (!filename) {
+    return;
+  }
+  statsFile = fopen(filename, "w");
+  if (!statsFile) {
+    perror("fopen");
+    abort();
+  }
+  fprintf(statsFile, "timestamp_ns,pause_ns,major,young_before,young_after,old_before,old_after,bytes_copied,bytes_promoted\n");
+}
+
+__attribute__ ((destructor)) static void finishTelemetry() {
+  if (!statsFile) {
+    return;
+  }
+  fprintf(statsFile, "# total_ns=%lu\n", nanosecondsSince(programStart));
+  fclose(statsFile);
+}
+
+extern "C" {
+
+void gcTelemetryStart(void) {
+  gcBytesCopied = 0;
+  gcBytesPromoted = 0;
+  if (!statsFile) {
+    return;
+  }
+  collectionStart = telemetry_clock::now();
+  youngBytesBefore = youngspace_used();
+  oldBytesBefore = oldspace_used();
+}
+
+void gcTelemetryFlushThread(void) {
+  otherThreadsCopied += gcBytesCopied;
+  otherThreadsPromoted += gcBytesPromoted;
+  gcBytesCopied = 0;
+  gcBytesPromoted = 0;
+}
+
+void gcTelemetryGatherThreads(void) {
+  gcBytesCopied += otherThreadsCopied.exchange(0);
+  gcBytesPromoted += otherThreadsPromoted.exchange(0);
+}
+
+void gcTelemetryRecord(bool major) {
+  if (!statsFile) {
+    return;
+  }
+  uint64_t pause = nanosecondsSince(collectionStart);
+  uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(collectionStart - programStart).count();
+  fprintf(statsFile, "%lu,%lu,%d,%zu,%zu,%zu,%zu,%zu,%zu\n", timestamp, pause, major,
+      youngBytesBefore, youngspace_used(), oldBytesBefore, oldspace_used(),
+      gcBytesCopied, gcBytesPromoted);
+}
+
+}
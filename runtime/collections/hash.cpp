@@ -1,3 +1,5 @@
+#include <vector>
+
 #include "runtime/header.h"
 
 extern "C" {
@@ -6,6 +8,13 @@ extern "C" {
   void set_hash(set *, void *);
   void int_hash(mpz_ptr, void *);
   void float_hash(floating *, void *);
+  void map_foreach(map *, void(block **));
+  void list_foreach(list *, void(block **));
+  void set_foreach(set *, void(block **));
+
+  // Generated at kompile time: for each layout, a function hashing the
+  // children of a block with that layout.
+  extern void (*hash_table[])(block *, void *);
 
   static thread_local uint32_t hash_length;
   static thread_local uint32_t hash_depth;
@@ -57,61 +66,101 @@ extern "C" {
     hash_depth = hash_depth - 1;
   }
 
+  // Hashes a block of a symbol with arguments whose children have their
+  // hashes cached already, and stores the result in the block. The depth and
+  // length bounds apply afresh to each block, and since the hash of a block
+  // includes the cached hashes of its children, it depends on the whole term.
+  // The hash does not depend on the address of any block, so the cache remains
+  // valid when a block is moved by the garbage collector.
+  static void hash_block(block *arg) {
+    uint32_t saved_length = hash_length, saved_depth = hash_depth;
+    hash_length = 0;
+    hash_depth = 1;
+    size_t hash = 14695981039346656037ULL;
+    add_hash64(&hash, arg->h.hdr & HDR_MASK);
+    hash_table[layout(arg)](arg, &hash);
+    hash_length = saved_length;
+    hash_depth = saved_depth;
+    // zero means that the hash has not been computed yet
+    *cached_hash_slot(arg) = hash ? hash : 1;
+  }
+
+  static thread_local std::vector<block *> uncached_children;
+
+  static void push_if_uncached(block **child) {
+    block *b = *child;
+    if (!is_leaf_block((uintptr_t)b) && layout(b) && !*cached_hash_slot(b)) {
+      uncached_children.push_back(b);
+    }
+  }
+
+  // Returns the cached hash of a block of a symbol with arguments, computing
+  // it first if needed. The hashes of the uncached blocks below it are
+  // computed bottom-up with an explicit worklist, since terms such as long
+  // cons lists are deeper than the native stack allows us to recurse.
+  uint64_t cached_hash(block *arg) {
+    uint64_t *slot = cached_hash_slot(arg);
+    if (*slot) {
+      return *slot;
+    }
+    // each entry is a block and whether its children have been pushed
+    std::vector<std::pair<block *, bool>> worklist;
+    worklist.push_back({arg, false});
+    while (!worklist.empty()) {
+      block *b = worklist.back().first;
+      if (worklist.back().second) {
+        worklist.pop_back();
+        // a block reachable along several paths may be on the list twice
+        if (!*cached_hash_slot(b)) {
+          hash_block(b);
+        }
+        continue;
+      }
+      worklist.back().second = true;
+      layout *layoutData = get_layout_data(layout(b));
+      for (unsigned i = 0; i < layoutData->nargs; i++) {
+        layoutitem *argData = layoutData->args + i;
+        void *child = ((char *)b) + argData->offset;
+        switch(argData->cat) {
+        case MAP_LAYOUT:
+          map_foreach((map *)child, push_if_uncached);
+          break;
+        case LIST_LAYOUT:
+          list_foreach((list *)child, push_if_uncached);
+          break;
+        case SET_LAYOUT:
+          set_foreach((set *)child, push_if_uncached);
+          break;
+        case SYMBOL_LAYOUT:
+        case VARIABLE_LAYOUT:
+          push_if_uncached((block **)child);
+          break;
+        default:
+          break;
+        }
+      }
+      for (block *child : uncached_children) {
+        worklist.push_back({child, false});
+      }
+      uncached_children.clear();
+    }
+    return *slot;
+  }
+
   void k_hash(block *arg, void *h) {
+    uint64_t argintptr = (uint64_t)arg;
+    if (cache_term_hashes && !is_leaf_block(argintptr) && layout(arg)) {
+      add_hash64(h, cached_hash(arg));
+      return;
+    }
     if (hash_enter()) {
-      uint64_t argintptr = (uint64_t)arg;
       if (is_leaf_block(argintptr)) {
         add_hash64(h, argintptr);
       } else {
         uint64_t arghdrcanon = arg->h.hdr & HDR_MASK;
         if (uint16_t arglayout = layout(arg)) {
           add_hash64(h, arghdrcanon);
-          layout *layoutPtr = getLayoutData(arglayout);
-          uint8_t length = layoutPtr->nargs;
-          for (uint8_t i = 0; i < length; i++) {
-            uint64_t offset = layoutPtr->args[i].offset;
-            uint16_t cat = layoutPtr->args[i].cat;
-            switch(cat) {
-            case MAP_LAYOUT: {
-              map *mapptr = (map *)(argintptr+offset);
-              map_hash(mapptr, h);
-              break;
-            }
-            case LIST_LAYOUT: {
-              list *listptr = (list *)(argintptr+offset);
-              list_hash(listptr, h);
-              break;
-            }
-            case SET_LAYOUT: {
-              set *setptr = (set *)(argintptr+offset);
-              set_hash(setptr, h);
-              break;
-            }
-            case INT_LAYOUT: {
-              mpz_ptr *intptrptr = (mpz_ptr *)(argintptr+offset);
-              int_hash(*intptrptr, h);
-              break;
-            }
-            case FLOAT_LAYOUT: {
-              floating **floatptrptr = (floating **)(argintptr+offset);
-              float_hash(*floatptrptr, h);
-              break;
-            }
-            case BOOL_LAYOUT: {
-              bool *boolptr = (bool *)(argintptr+offset);
-              add_hash8(h, *boolptr);
-              break;
-            }
-            case SYMBOL_LAYOUT:
-            case VARIABLE_LAYOUT: {
-              block **childptrptr = (block **)(argintptr+offset);
-              k_hash(*childptrptr, h);
-              break;
-            }
-            default:
-              abort();
-            }
-          }
+          hash_table[arglayout](arg, h);
         } else {
           string *str = (string *)arg;
           add_hash_str(h, str->data, len(arg));
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <stdexcept>
 #include <map>
+#include <mutex>
 #include <fcntl.h>
 #include <libgen.h>
 #include <sys/types.h>
@@ -27,7 +28,9 @@ extern "C" {
   static block * dotK = leaf_block(getTagForSymbolName("dotk{}"));
   static blockheader kseqHeader = {getBlockHeaderForSymbol((uint64_t)getTagForSymbolName("kseq{}"))};
 
+  // shared by every thread, and written out at exit
   static std::map<std::string, std::string> logFiles;
+  static std::mutex logFilesLock;
 
   static block * block_errno() {
     const char * errStr;
@@ -104,8 +107,7 @@ extern "C" {
     case ELOOP: errStr = GETTAG(ELOOP); break;
     case EOVERFLOW: errStr = GETTAG(EOVERFLOW); break;
     default:
-      block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr)));
-      retBlock->h = getBlockHeaderForSymbol((uint64_t)getTagForSymbolName("Lbl'Hash'unknownIOError{}"));
+      block * retBlock = alloc_block(getBlockHeaderForSymbol((uint64_t)getTagForSymbolName("Lbl'Hash'unknownIOError{}")));
       mpz_t err;
       mpz_init_set_si(err, errno);
       mpz_ptr p = move_int(err);
@@ -148,10 +150,8 @@ extern "C" {
 
   static inline block * getKSeqErrorBlock() {
     block * err = block_errno();
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + 2 * sizeof(block *)));
-    block * inj = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(block *)));
-    retBlock->h = kseqHeader;
-    inj->h = header_err();
+    block * retBlock = alloc_block(kseqHeader);
+    block * inj = alloc_block(header_err());
     memcpy(inj->children, &err, sizeof(block *));
     memcpy(retBlock->children, &inj, sizeof(block *));
     memcpy(retBlock->children + 1, &dotK, sizeof(block *));
@@ -160,8 +160,7 @@ extern "C" {
 
   static inline block* getInjErrorBlock() {
     block * p = block_errno();
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(block *)));
-    retBlock->h = header_err();
+    block * retBlock = alloc_block(header_err());
     memcpy(retBlock->children, &p, sizeof(block *));
     return retBlock;
   }
@@ -254,8 +253,7 @@ extern "C" {
       return getInjErrorBlock();
     }
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr)));
-    retBlock->h = header_int();
+    block * retBlock = alloc_block(header_int());
     mpz_init_set_si(result, fd);
     mpz_ptr p = move_int(result);
     memcpy(retBlock->children, &p, sizeof(mpz_ptr));
@@ -274,8 +272,7 @@ extern "C" {
       return getInjErrorBlock();
     }
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr)));
-    retBlock->h = header_int();
+    block * retBlock = alloc_block(header_int());
     mpz_t result;
     mpz_init_set_si(result, (long) loc);
     mpz_ptr p =  move_int(result);
@@ -295,16 +292,14 @@ extern "C" {
 
     if (0 == ret) {
       block * p = leaf_block(getTagForSymbolName(GETTAG(EOF)));
-      block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(block *)));
-      retBlock->h = header_err();
+      block * retBlock = alloc_block(header_err());
       memcpy(retBlock->children, &p, sizeof(block *));
       return retBlock;
     } else if (-1 == ret) {
       return getInjErrorBlock();
     }
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr)));
-    retBlock->h = header_int();
+    block * retBlock = alloc_block(header_int());
     mpz_t result;
     mpz_init_set_si(result, (int) c);
     mpz_ptr p = move_int(result);
@@ -328,8 +323,7 @@ extern "C" {
     }
 
     result = static_cast<string *>(koreResizeLastAlloc(result, sizeof(string) + bytes, sizeof(string) + length));
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(string *)));
-    retBlock->h = header_string();
+    block * retBlock = alloc_block(header_string());
     set_len(result, bytes);
     memcpy(retBlock->children, &result, sizeof(string *));
     return retBlock;
@@ -474,8 +468,7 @@ extern "C" {
       return getInjErrorBlock();
     }
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr)));
-    retBlock->h = header_int();
+    block * retBlock = alloc_block(header_int());
 
     mpz_t result;
     mpz_init_set_si(result, clientsock);
@@ -535,6 +528,7 @@ extern "C" {
     char * p = getTerminatedString(path);
     char * m = getTerminatedString(msg);
 
+    std::lock_guard<std::mutex> guard(logFilesLock);
     static bool flushRegistered = false;
     if (!flushRegistered) {
       atexit(&flush_IO_logs);
@@ -583,8 +577,7 @@ extern "C" {
       stringbuffer * buf = hook_BUFFER_empty();
       buf = hook_BUFFER_concat_raw(buf, llvm_backend_argv[i], strlen(llvm_backend_argv[i]));
       SortString str = hook_BUFFER_toString(buf);
-      block * b = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(str)));
-      b->h = getBlockHeaderForSymbol((uint64_t)getTagForSymbolName("inj{SortString{}, SortKItem{}}"));
+      block * b = alloc_block(getBlockHeaderForSymbol((uint64_t)getTagForSymbolName("inj{SortString{}, SortKItem{}}")));
       memcpy(b->children, &str, sizeof(str));
       l = l.push_back(KElem(b));
     }
@@ -600,7 +593,7 @@ extern "C" {
       return getInjErrorBlock();
     }
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(string *) + sizeof(mpz_ptr)));
+    block * retBlock = alloc_block(getBlockHeaderForSymbol((uint64_t)getTagForSymbolName(GETTAG(tempFile))));
 
     mpz_t result;
     mpz_init_set_si(result, ret);
@@ -611,7 +604,6 @@ extern "C" {
     set_len(retString, length);
     memcpy(retBlock->children, &retString, sizeof(string *));
     memcpy(retBlock->children + 1, &p, sizeof(mpz_ptr));
-    retBlock->h = getBlockHeaderForSymbol((uint64_t)getTagForSymbolName(GETTAG(tempFile)));
 
     return retBlock;
   }
@@ -687,14 +679,13 @@ extern "C" {
     waitpid(pid, &ret, 0);
     ret = WEXITSTATUS(ret);
 
-    block * retBlock = static_cast<block *>(koreAlloc(sizeof(block) + sizeof(mpz_ptr) + sizeof(string *) + sizeof(string *)));
+    block * retBlock = alloc_block(getBlockHeaderForSymbol((uint64_t)getTagForSymbolName(GETTAG(systemResult))));
 
     mpz_t result;
     mpz_init_set_si(result, ret);
     mpz_ptr p = move_int(result);
     memcpy(retBlock->children, &p, sizeof(mpz_ptr));
     
-    retBlock->h = getBlockHeaderForSymbol((uint64_t)getTagForSymbolName(GETTAG(systemResult)));
     string *outStr, *errStr;
     outStr = hook_BUFFER_toString(outBuffer);
     errStr = hook_BUFFER_toString(errBuffer);
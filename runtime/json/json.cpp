@@ -94,8 +94,7 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
 
   bool Null() { stack.push_back(null()); return true; }
   bool Bool(bool b) {
-    boolinj *inj = (boolinj *)koreAlloc(sizeof(boolinj));
-    inj->h = boolHdr();
+    boolinj *inj = (boolinj *)alloc_block(boolHdr());
     inj->data = b;
     result = (block *)inj;
     stack.push_back(result);
@@ -106,8 +105,7 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
     mpz_t z;
     int status = mpz_init_set_str(z, str, 10);
     if (status == 0) {
-      zinj *inj = (zinj *)koreAlloc(sizeof(zinj));
-      inj->h = intHdr();
+      zinj *inj = (zinj *)alloc_block(intHdr());
       inj->data = move_int(z);
       result = (block *)inj;
       stack.push_back(result);
@@ -118,8 +116,7 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
       mpfr_init2(f->f, 53);
       f->exp = 11;
       mpfr_set_str(f->f, str, 9, MPFR_RNDN);
-      floatinj *inj = (floatinj *)koreAlloc(sizeof(floatinj));
-      inj->h = floatHdr();
+      floatinj *inj = (floatinj *)alloc_block(floatHdr());
       inj->data = move_float(f);
       result = (block *)inj;
       stack.push_back(result);
@@ -128,8 +125,7 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
   }
 
   bool String(const char *str, SizeType len, bool copy) {
-    stringinj *inj = (stringinj *)koreAlloc(sizeof(stringinj));
-    inj->h = strHdr();
+    stringinj *inj = (stringinj *)alloc_block(strHdr());
     string *token = (string *)koreAllocToken(sizeof(string) + len);
     set_len(token, len);
     memcpy(token->data, str, len);
@@ -149,20 +145,17 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
   bool EndObject(SizeType memberCount) {
     result = dotList();
     for (int i = 0; i < memberCount; i++) {
-      jsonmember *member = (jsonmember *)koreAlloc(sizeof(jsonmember));
-      member->h = membHdr();
+      jsonmember *member = (jsonmember *)alloc_block(membHdr());
       member->val = stack.back();
       stack.pop_back();
       member->key = stack.back();
       stack.pop_back();
-      jsonlist *list = (jsonlist *)koreAlloc(sizeof(jsonlist));
-      list->h = listHdr();
+      jsonlist *list = (jsonlist *)alloc_block(listHdr());
       list->hd = (block *)member;
       list->tl = (jsonlist *)result;
       result = (block *)list;
     }
-    json *wrap = (json *)koreAlloc(sizeof(json));
-    wrap->h = objHdr();
+    json *wrap = (json *)alloc_block(objHdr());
     wrap->data = (jsonlist *)result;
     stack.push_back((block *)wrap);
     return true;
@@ -173,15 +166,13 @@ struct KoreHandler : BaseReaderHandler<UTF8<>, KoreHandler> {
   bool EndArray(SizeType elementCount) {
     result = dotList();
     for (int i = 0; i < elementCount; i++) {
-      jsonlist *list = (jsonlist *)koreAlloc(sizeof(jsonlist));
-      list->h = listHdr();
+      jsonlist *list = (jsonlist *)alloc_block(listHdr());
       list->hd = stack.back();
       stack.pop_back();
       list->tl = (jsonlist *)result;
       result = (block *)list;
     }
-    json *wrap = (json *)koreAlloc(sizeof(json));
-    wrap->h = listWrapHdr();
+    json *wrap = (json *)alloc_block(listWrapHdr());
     wrap->data = (jsonlist *)result;
     stack.push_back((block *)wrap);
     return true;
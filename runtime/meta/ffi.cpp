@@ -33,8 +33,9 @@ extern "C" {
 
   thread_local static std::vector<ffi_type *> structTypes;
 
-  static std::unordered_map<block *, string *, HashBlock, KEq> allocatedKItemPtrs;
-  static std::map<string *, block *> allocatedBytesRefs;
+  // the allocations of the current thread, whose terms live in its heap
+  static thread_local std::unordered_map<block *, string *, HashBlock, KEq> allocatedKItemPtrs;
+  static thread_local std::map<string *, block *> allocatedBytesRefs;
 
   TAG_TYPE(void)
   TAG_TYPE(uint8)
@@ -305,7 +306,7 @@ extern "C" {
   }
 
   static std::pair<std::vector<block **>::iterator, std::vector<block **>::iterator> firstBlockEnumerator() {
-    static std::vector<block **> blocks;
+    static thread_local std::vector<block **> blocks;
 
     blocks.clear();
 
@@ -317,7 +318,7 @@ extern "C" {
   }
 
   static std::pair<std::vector<block **>::iterator, std::vector<block **>::iterator> secondBlockEnumerator() {
-    static std::vector<block **> blocks;
+    static thread_local std::vector<block **> blocks;
 
     blocks.clear();
 
@@ -329,7 +330,7 @@ extern "C" {
   }
 
   string * hook_FFI_alloc(block * kitem, mpz_t size, mpz_t align) {
-    static int registered = -1;
+    static thread_local int registered = -1;
 
     if (registered == -1) {
       registerGCRootsEnumerator(firstBlockEnumerator);
@@ -27,6 +27,7 @@ void makeDirty(bool &dirty, uint64_t offset, New newArg, block *&newBlock) {
     alloc->h = newBlock->h;
     reset_gc(alloc);
     memcpy(alloc->children, newBlock->children, offset-8);
+    clear_cached_hash(alloc);
     newBlock = alloc;
   }
   New *newPtr = (New *)(((char *)newBlock) + offset);
@@ -45,7 +46,7 @@ block *debruijnizeInternal(block *currBlock) {
     if(isBinder) {
       idx++;
     }
-    layout *layoutData = getLayoutData(layoutInt);
+    layout *layoutData = get_layout_data(layoutInt);
     bool dirty = false;
     block *newBlock = currBlock;
     for (unsigned i = 0; i < layoutData->nargs; i++) {
@@ -118,7 +119,7 @@ block *replaceBinderInternal(block *currBlock) {
     if(isBinder) {
       idx++;
     }
-    layout *layoutData = getLayoutData(layoutInt);
+    layout *layoutData = get_layout_data(layoutInt);
     bool dirty = false;
     block *newBlock = currBlock;
     for (unsigned i = 0; i < layoutData->nargs; i++) {
@@ -181,7 +182,7 @@ block *substituteInternal(block *currBlock) {
     return incrementDebruijn(replacement);
   }
   if (layoutInt) {
-    layout *layoutData = getLayoutData(layoutInt);
+    layout *layoutData = get_layout_data(layoutInt);
     bool dirty = false;
     block *newBlock = currBlock;
     uint32_t tag = tag_hdr(hdr);
@@ -255,7 +256,7 @@ block *substituteInternal(block *currBlock) {
 extern "C" {
 
 block *debruijnize(block *term) {
-  auto layoutData = getLayoutData(layout(term));
+  auto layoutData = get_layout_data(layout(term));
   auto layoutVar = layoutData->args[0];
   auto layoutBody = layoutData->args[layoutData->nargs-1];
   var = *(string **)(((char *)term) + layoutVar.offset);
@@ -288,7 +289,7 @@ block *incrementDebruijn(block *currBlock) {
   const uint64_t hdr = currBlock->h.hdr;
   uint16_t layoutInt = layout_hdr(hdr);
   if (layoutInt) {
-    layout *layoutData = getLayoutData(layoutInt);
+    layout *layoutData = get_layout_data(layoutInt);
     bool dirty = false;
     block *newBlock = currBlock;
     uint32_t tag = tag_hdr(hdr);
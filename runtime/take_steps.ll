@@ -6,13 +6,14 @@ target triple = "x86_64-unknown-linux-gnu"
 
 declare fastcc %block* @step(%block*)
 declare fastcc %block** @stepAll(%block*, i64*)
+declare void @initGCFrames()
 
 @depth = thread_local global i64 zeroinitializer
 @steps = thread_local global i64 zeroinitializer
 @current_interval = thread_local global i64 0
 @GC_THRESHOLD = thread_local global i64 @GC_THRESHOLD@
 
-@gc_roots = global [256 x i8 *] zeroinitializer
+@gc_roots = thread_local global [256 x i8 *] zeroinitializer
 
 define void @set_gc_threshold(i64 %threshold) {
   store i64 %threshold, i64* @GC_THRESHOLD
@@ -42,12 +43,14 @@ else:
 }
 
 define %block* @take_steps(i64 %depth, %block* %subject) {
+  call void @initGCFrames()
   store i64 %depth, i64* @depth
   %result = call fastcc %block* @step(%block* %subject)
   ret %block* %result
 }
 
 define %block** @take_search_step(%block* %subject, i64* %count) {
+  call void @initGCFrames()
   store i64 -1, i64* @depth
   %result = call fastcc %block** @stepAll(%block* %subject, i64* %count)
   ret %block** %result
@@ -58,3 +61,11 @@ entry:
   %steps = load i64, i64* @steps
   ret i64 %steps
 }
+
+define void @add_steps(i64 %n) {
+entry:
+  %steps = load i64, i64* @steps
+  %sum = add i64 %steps, %n
+  store i64 %sum, i64* @steps
+  ret void
+}
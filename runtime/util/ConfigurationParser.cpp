@@ -3,35 +3,43 @@
 #include "runtime/alloc.h"
 
 #include <gmp.h>
+#include <cstdio>
+#include <cstring>
 #include <variant>
-#include <map>
 
 #include "runtime/header.h"
+#include "runtime/name_table.h"
 
 using namespace kllvm;
 using namespace kllvm::parser;
 
-using Cache = std::map<std::string, uint32_t>;
-static thread_local Cache cache;
-
 extern "C" {
-  uint32_t getTagForSymbolNameInternal(const char *);
-  
+  extern const name_table symbol_name_table;
+  extern const name_table fresh_sort_table;
+
   void init_float(floating *result, const char *c_str) {
     std::string contents = std::string(c_str);
     init_float2(result, contents);
   }
 
+  bool lookupNameTable(const name_table *table, const char *name, uint32_t *result) {
+    return name_table_lookup(table, name, result);
+  }
+
   uint32_t getTagForSymbolName(const char *name) {
-    std::string s = name;
-    // https://stackoverflow.com/a/101980/6209703
-    Cache::iterator lb = cache.lower_bound(s);
-    // key exists
-    if (lb != cache.end() && !(cache.key_comp()(s, lb->first))) {
-      return lb->second;
+    uint32_t tag;
+    if (!lookupNameTable(&symbol_name_table, name, &tag)) {
+      puts(name);
+      abort();
+    }
+    return tag;
+  }
+
+  uint32_t getTagForFreshSort(const char *sort) {
+    uint32_t tag;
+    if (!lookupNameTable(&fresh_sort_table, sort, &tag)) {
+      abort();
     }
-    uint32_t const tag = getTagForSymbolNameInternal(s.c_str());
-    cache.insert(lb, Cache::value_type{s, tag});
     return tag;
   }
 }
@@ -90,12 +98,12 @@ static void *constructInitialConfiguration(const KOREPattern *initial) {
         continue;
       }
 
-      struct blockheader headerVal = getBlockHeaderForSymbol(tag);
+      struct blockheader headerVal = get_block_header_for_symbol(tag);
       size_t size = size_hdr(headerVal.hdr);
 
       if (tag >= first_inj_tag && tag <= last_inj_tag) {
         uint16_t layout_code = layout_hdr(headerVal.hdr);
-        layout *data = getLayoutData(layout_code);
+        layout *data = get_layout_data(layout_code);
         if (data->args[0].cat == SYMBOL_LAYOUT) {
           block *child = (block *)arguments[0];
           if (!is_leaf_block(child) && layout(child) != 0) {
@@ -115,6 +123,9 @@ static void *constructInitialConfiguration(const KOREPattern *initial) {
       if (isSymbolABinder(tag)) {
         Block = debruijnize(Block);
       }
+      if (hash_cons_terms) {
+        Block = hash_cons(Block);
+      }
       output.push_back(Block);
     }
   }
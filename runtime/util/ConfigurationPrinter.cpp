@@ -260,7 +260,7 @@ struct MatchLog {
   char *sort;
 };
 
-static std::vector<MatchLog> matchLog;
+static thread_local std::vector<MatchLog> matchLog;
 
 void resetMatchReason(void) {
   matchLog.clear();
@@ -278,6 +278,12 @@ size_t getMatchLogSize(void) {
   return matchLog.size();
 }
 
+// True if the last call to a match function matched, since its log ends at the
+// success of the first pattern which matches.
+bool matchSucceeded(void) {
+  return !matchLog.empty() && matchLog.back().kind == MatchLog::SUCCESS;
+}
+
 extern "C" {
   
 void addMatchSuccess(void) {
@@ -1,10 +1,30 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include <sys/mman.h>
 
 #include "runtime/header.h"
+#include "runtime/alloc.h"
+#include "runtime/arena.h"
 #include "runtime/collect.h"
+#include "runtime/term_encoding.h"
 
 extern "C" {
 
@@ -21,58 +41,1453 @@ void addSearchResult(block *result, block ***bufPtr, uint64_t *count, uint64_t *
 }
 
 block** take_search_step(block *, uint64_t *);
+uint64_t get_steps(void);
+void add_steps(uint64_t);
+mpz_ptr move_int(mpz_t);
+floating *move_float(floating *);
+// generated by llvm-kompile-codegen if the definition was compiled with a
+// search goal
+void match_search_goal(block *) __attribute__((weak));
+
+}
+
+void resetMatchReason(void);
+bool matchSucceeded(void);
+
+// The parallel search, enabled by setting the KLLVM_SEARCH_THREADS environment
+// variable to the number of threads to search with (default 1, i.e. the serial
+// search below).
+//
+// Each thread rewrites the states it expands on a heap of its own (cf
+// runtime/alloc/alloc.h), and shares the states it reaches with the others by
+// copying them into its searchspace, whose objects are immutable and never
+// collected (cf freezeTerm). The frontier is a deque per thread: a thread
+// pushes the states it reaches at the back of its own deque and expands the
+// states at its front (at its back in a depth-first search), and a thread whose
+// deque is empty steals states from the other end of the deques of the other
+// threads. As in the serial search, a state is queued unless it was visited
+// before (cf visited_table). The solutions found by each thread are merged
+// once the search is over.
+//
+// The threads other than the one which calls the search are started by the
+// first parallel search and reused by the next ones (cf search_pool). The
+// states shared by the threads stay in their searchspaces until the search is
+// over, when the solutions are copied into the heap of the calling thread and
+// the searchspaces are cleared.
+//
+// Both searches record every state they reach in a table of visited states,
+// whose kind is set by the KLLVM_SEARCH_VISITED environment variable:
+//
+// - exact (the default): the states themselves, compared by hook_KEQUAL_eq.
+//   The states are frozen, and stay in memory until the search is over. In a
+//   search bounded by the length of its paths, the table also keeps the length
+//   of the shortest path by which each state was reached, and a state reached
+//   again by a shorter path is expanded again.
+// - hash64, hash128: only a fingerprint of 64 or 128 bits of each state,
+//   computed from the whole term (cf fingerprintTerm), as in hash compaction.
+//   A state whose fingerprint collides with that of a visited state is
+//   wrongly considered visited, which is unlikely until the number of states
+//   nears the square root of the number of fingerprints.
+// - bitstate: a Bloom filter of 2^N bits, where N is set by the
+//   KLLVM_SEARCH_BITSTATE_BITS environment variable (default 30, i.e. 128MiB),
+//   in which each state sets BITSTATE_HASHES bits. Its memory does not grow
+//   with the number of states, but the probability that a new state is
+//   wrongly considered visited grows with the proportion of the bits set.
+//
+// Unlike exact, the hash64, hash128 and bitstate tables do not keep the length
+// of the paths to the states, so a search bounded by the length of its paths
+// with them is incomplete beyond their collisions, cf dfs below.
+//
+// The KLLVM_SEARCH_STRATEGY environment variable sets the order in which the
+// states are expanded:
+//
+// - bfs (the default): breadth-first. The depth bounds the number of states
+//   expanded.
+// - dfs: depth-first. The depth bounds the length of the paths explored. With
+//   the exact table, a state first reached by a longer path is expanded again
+//   when it is reached by a shorter one, so every state within the bound is
+//   found. With the other tables, a state is expanded only the first time it
+//   is reached, so a state within the bound may be missed if it is only
+//   reachable within the bound through a state first reached by a longer
+//   path.
+// - iddfs: iterative deepening, i.e. a depth-first search bounded by 0, 1, 2,
+//   ... until the whole state space is explored, the depth is reached or a
+//   solution is found. Each iteration starts over with an empty table of
+//   visited states, and is as complete as the depth-first search with the
+//   same table. The searchspaces are cleared between iterations.
+//
+// If the definition was compiled with a search goal (cf the --search-goal
+// option of the matching compiler), the solutions of the search are the
+// states reached which match it. Otherwise they are the stuck states, along
+// with the states left unexpanded because of the depth. The search stops once
+// it finds the number of solutions set by the KLLVM_SEARCH_MAX_SOLUTIONS
+// environment variable (default unbounded), so that KLLVM_SEARCH_MAX_SOLUTIONS=1
+// stops it at the first.
+//
+// The KLLVM_SEARCH_FRONTIER environment variable sets how the states queued are
+// kept:
+//
+// - heap: as terms. The serial search keeps them on its heap until they are
+//   expanded. The parallel search freezes them, since they are shared between
+//   threads, and they stay in memory until the search is over whatever the
+//   kind of the table of visited states, so its memory grows with the number
+//   of states reached even with hash64, hash128 or bitstate.
+// - compressed: as byte strings outside the heap (cf term_encoder), which the
+//   collector does not scan, and which are decoded when they are expanded and
+//   freed afterwards. Since the states reached by one expansion mostly differ
+//   in a few subterms, each of them but the first is only kept as the bytes
+//   which differ from the encoding of the first. This saves memory unless the
+//   table of visited states keeps the states themselves.
+//
+// The default is compressed for a parallel search whose table of visited
+// states only keeps fingerprints or a Bloom filter, so that its memory is
+// bounded by the size of the frontier, and heap otherwise.
+//
+// If the KLLVM_SEARCH_STATS environment variable names a file, the number of
+// states explored, the number of duplicate states reached and the occupancy of
+// the table are written to it at the end of the search, one `name=value` line
+// each.
+
+static unsigned numSearchThreads = 1;
+
+enum class search_strategy { BFS, DFS, IDDFS };
+
+static search_strategy searchStrategy = search_strategy::BFS;
+// zero if unbounded
+static uint64_t maxSolutions = 0;
+static bool compressFrontier = false;
+
+enum class visited_mode { Exact, Hash64, Hash128, Bitstate };
+
+static visited_mode visitedMode = visited_mode::Exact;
+static unsigned bitstateBits = 30;
+static const char *searchStatsFile;
+
+static const unsigned BITSTATE_HASHES = 3;
+
+__attribute__ ((constructor)) static void initSearch() {
+  if (const char *env = getenv("KLLVM_SEARCH_THREADS")) {
+    char *end;
+    long threads = strtol(env, &end, 10);
+    if (*end || threads < 1) {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_THREADS: must be a positive integer\n", env);
+      abort();
+    }
+    numSearchThreads = threads;
+  }
+  if (const char *env = getenv("KLLVM_SEARCH_STRATEGY")) {
+    if (strcmp(env, "bfs") == 0) {
+      searchStrategy = search_strategy::BFS;
+    } else if (strcmp(env, "dfs") == 0) {
+      searchStrategy = search_strategy::DFS;
+    } else if (strcmp(env, "iddfs") == 0) {
+      searchStrategy = search_strategy::IDDFS;
+    } else {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_STRATEGY: must be bfs, dfs or iddfs\n", env);
+      abort();
+    }
+  }
+  if (const char *env = getenv("KLLVM_SEARCH_MAX_SOLUTIONS")) {
+    char *end;
+    long long solutions = strtoll(env, &end, 10);
+    if (*end || solutions < 1) {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_MAX_SOLUTIONS: must be a positive integer\n", env);
+      abort();
+    }
+    maxSolutions = solutions;
+  }
+  if (const char *env = getenv("KLLVM_SEARCH_VISITED")) {
+    if (strcmp(env, "exact") == 0) {
+      visitedMode = visited_mode::Exact;
+    } else if (strcmp(env, "hash64") == 0) {
+      visitedMode = visited_mode::Hash64;
+    } else if (strcmp(env, "hash128") == 0) {
+      visitedMode = visited_mode::Hash128;
+    } else if (strcmp(env, "bitstate") == 0) {
+      visitedMode = visited_mode::Bitstate;
+    } else {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_VISITED: must be exact, hash64, hash128 or bitstate\n", env);
+      abort();
+    }
+  }
+  if (const char *env = getenv("KLLVM_SEARCH_FRONTIER")) {
+    if (strcmp(env, "heap") == 0) {
+      compressFrontier = false;
+    } else if (strcmp(env, "compressed") == 0) {
+      compressFrontier = true;
+    } else {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_FRONTIER: must be heap or compressed\n", env);
+      abort();
+    }
+  } else {
+    compressFrontier = numSearchThreads > 1 && visitedMode != visited_mode::Exact;
+  }
+  if (const char *env = getenv("KLLVM_SEARCH_BITSTATE_BITS")) {
+    char *end;
+    long bits = strtol(env, &end, 10);
+    if (*end || bits < 10 || bits > 40) {
+      fprintf(stderr, "Invalid value %s for KLLVM_SEARCH_BITSTATE_BITS: must be an integer between 10 and 40\n", env);
+      abort();
+    }
+    bitstateBits = bits;
+  }
+  searchStatsFile = getenv("KLLVM_SEARCH_STATS");
+}
+
+// the copies made by the current call to freezeTerm and its callers, so that
+// the subterms shared by the states reached by one step are copied once
+static thread_local std::unordered_map<void *, void *> frozenCopies;
+
+// True if the object with the specified header is immutable and never
+// collected: a constant, a static object or an object of a searchspace. The
+// header of a large object does not tell which heap it belongs to.
+static bool isFrozen(void *ptr, uint64_t hdr) {
+  if (isLargeObject(ptr)) {
+    return largeObjectInRegion(ptr);
+  }
+  return !is_in_young_gen_hdr(hdr) && !is_in_old_gen_hdr(hdr);
+}
+
+// True if the specified node of a collection and its descendants are in a
+// region which is never collected, in which case it was allocated by
+// freezeTerm, or is the empty node of initStaticObjects.
+static bool isFrozenNode(void *node) {
+  string *nodeBlock = struct_base(string, data, node);
+  if (isLargeObject(nodeBlock)) {
+    return largeObjectInRegion(nodeBlock);
+  }
+  char id = getArenaSemispaceIDOfObject(nodeBlock);
+  return id == SEARCHSPACE_ID || id == STATICSPACE_ID;
+}
+
+static void freezeHeader(blockheader *h) {
+  h->hdr &= ~(AGE_MASK | FWD_PTR_BIT);
+  h->hdr |= NOT_YOUNG_OBJECT_BIT;
+}
+
+static block *freezeTerm(block *term);
+
+static mpz_ptr freezeInt(mpz_ptr i) {
+  mpz_hdr *intBlock = struct_base(mpz_hdr, i, i);
+  if (isFrozen(intBlock, intBlock->h.hdr)) {
+    return i;
+  }
+  mpz_t copy;
+  mpz_init_set(copy, i);
+  mpz_ptr result = move_int(copy);
+  freezeHeader(&struct_base(mpz_hdr, i, result)->h);
+  return result;
+}
+
+static floating *freezeFloat(floating *f) {
+  floating_hdr *floatBlock = struct_base(floating_hdr, f, f);
+  if (isFrozen(floatBlock, floatBlock->h.hdr)) {
+    return f;
+  }
+  floating copy[1];
+  copy->exp = f->exp;
+  mpfr_init2(copy->f, mpfr_get_prec(f->f));
+  mpfr_set(copy->f, f->f, MPFR_RNDN);
+  floating *result = move_float(copy);
+  freezeHeader(&struct_base(floating_hdr, f, result)->h);
+  return result;
+}
+
+static stringbuffer *freezeStringBuffer(stringbuffer *buffer) {
+  if (isFrozen(buffer, buffer->h.hdr)) {
+    return buffer;
+  }
+  stringbuffer *result = (stringbuffer *)koreAlloc(sizeof(stringbuffer));
+  memcpy(result, buffer, sizeof(stringbuffer));
+  freezeHeader(&result->h);
+  result->contents = (string *)freezeTerm((block *)buffer->contents);
+  return result;
+}
+
+static map freezeMap(map *m) {
+  if (isFrozenNode(m->impl().root)) {
+    return *m;
+  }
+  map result;
+  for (auto iter = m->begin(); iter != m->end(); ++iter) {
+    result = result.set(freezeTerm(iter->first), freezeTerm(iter->second));
+  }
+  return result;
+}
+
+static list freezeList(list *l) {
+  auto &impl = l->impl();
+  if (isFrozenNode(impl.root) && isFrozenNode(impl.tail)) {
+    return *l;
+  }
+  auto tmp = list().transient();
+  for (auto iter = l->begin(); iter != l->end(); ++iter) {
+    tmp.push_back(freezeTerm(*iter));
+  }
+  return tmp.persistent();
+}
+
+static set freezeSet(set *s) {
+  if (isFrozenNode(s->impl().root)) {
+    return *s;
+  }
+  set result;
+  for (auto iter = s->begin(); iter != s->end(); ++iter) {
+    result = result.insert(freezeTerm(*iter));
+  }
+  return result;
+}
+
+// Returns a copy of term whose objects are all immutable and never collected,
+// sharing its subterms which already are. Must be called between
+// koreAllocSearchBegin and koreAllocSearchEnd, so that the copy is allocated
+// into the searchspace of the current thread.
+static block *freezeTerm(block *term) {
+  if (is_leaf_block(term)) {
+    return term;
+  }
+  const uint64_t hdr = term->h.hdr;
+  if (isFrozen(term, hdr)) {
+    return term;
+  }
+  auto copied = frozenCopies.find(term);
+  if (copied != frozenCopies.end()) {
+    return (block *)copied->second;
+  }
+  uint16_t layoutInt = layout_hdr(hdr);
+  block *result;
+  if (!layoutInt) {
+    size_t size = sizeof(string) + len_hdr(hdr);
+    result = (block *)koreAllocToken(size);
+    memcpy(result, term, size);
+    freezeHeader(&result->h);
+  } else {
+    // this also copies the cached hash of the block, if any
+    result = (block *)koreAlloc(size_hdr(hdr));
+    memcpy(result, term, size_hdr(hdr));
+    freezeHeader(&result->h);
+    layout *layoutData = get_layout_data(layoutInt);
+    for (unsigned i = 0; i < layoutData->nargs; i++) {
+      layoutitem *argData = layoutData->args + i;
+      void *arg = ((char *)result) + argData->offset;
+      switch(argData->cat) {
+      case MAP_LAYOUT:
+        *(map *)arg = freezeMap((map *)arg);
+        break;
+      case LIST_LAYOUT:
+        *(list *)arg = freezeList((list *)arg);
+        break;
+      case SET_LAYOUT:
+        *(set *)arg = freezeSet((set *)arg);
+        break;
+      case STRINGBUFFER_LAYOUT:
+        *(stringbuffer **)arg = freezeStringBuffer(*(stringbuffer **)arg);
+        break;
+      case INT_LAYOUT:
+        *(mpz_ptr *)arg = freezeInt(*(mpz_ptr *)arg);
+        break;
+      case FLOAT_LAYOUT:
+        *(floating **)arg = freezeFloat(*(floating **)arg);
+        break;
+      case SYMBOL_LAYOUT:
+      case VARIABLE_LAYOUT:
+        *(block **)arg = freezeTerm(*(block **)arg);
+        break;
+      case BOOL_LAYOUT:
+      default: //mint
+        break;
+      }
+    }
+  }
+  frozenCopies[term] = result;
+  return result;
+}
+
+
+// Returns a frozen copy of a state reached by the current thread.
+static block *freezeState(block *state) {
+  koreAllocSearchBegin();
+  block *result = freezeTerm(state);
+  koreAllocSearchEnd();
+  return result;
+}
+
+// the copies made by the current call to thawTerm and its callers
+static thread_local std::unordered_map<void *, void *> thawedCopies;
+
+// True if the specified object is one of the static objects, which stay valid
+// after the searchspaces are cleared.
+static bool isStatic(void *ptr) {
+  return !isLargeObject(ptr) && getArenaSemispaceIDOfObject(ptr) == STATICSPACE_ID;
+}
+
+static bool isStaticNode(void *node) {
+  return isStatic(struct_base(string, data, node));
+}
+
+static void thawHeader(blockheader *h) {
+  h->hdr &= ~NOT_YOUNG_OBJECT_BIT;
+}
+
+static block *thawTerm(block *term);
+
+static mpz_ptr thawInt(mpz_ptr i) {
+  if (isStatic(struct_base(mpz_hdr, i, i))) {
+    return i;
+  }
+  mpz_t copy;
+  mpz_init_set(copy, i);
+  return move_int(copy);
+}
+
+static floating *thawFloat(floating *f) {
+  if (isStatic(struct_base(floating_hdr, f, f))) {
+    return f;
+  }
+  floating copy[1];
+  copy->exp = f->exp;
+  mpfr_init2(copy->f, mpfr_get_prec(f->f));
+  mpfr_set(copy->f, f->f, MPFR_RNDN);
+  return move_float(copy);
+}
+
+static stringbuffer *thawStringBuffer(stringbuffer *buffer) {
+  if (isStatic(buffer)) {
+    return buffer;
+  }
+  stringbuffer *result = (stringbuffer *)koreAlloc(sizeof(stringbuffer));
+  memcpy(result, buffer, sizeof(stringbuffer));
+  thawHeader(&result->h);
+  result->contents = (string *)thawTerm((block *)buffer->contents);
+  return result;
+}
+
+static map thawMap(map *m) {
+  if (isStaticNode(m->impl().root)) {
+    return *m;
+  }
+  map result;
+  for (auto iter = m->begin(); iter != m->end(); ++iter) {
+    result = result.set(thawTerm(iter->first), thawTerm(iter->second));
+  }
+  return result;
+}
+
+static list thawList(list *l) {
+  auto &impl = l->impl();
+  if (isStaticNode(impl.root) && isStaticNode(impl.tail)) {
+    return *l;
+  }
+  auto tmp = list().transient();
+  for (auto iter = l->begin(); iter != l->end(); ++iter) {
+    tmp.push_back(thawTerm(*iter));
+  }
+  return tmp.persistent();
+}
+
+static set thawSet(set *s) {
+  if (isStaticNode(s->impl().root)) {
+    return *s;
+  }
+  set result;
+  for (auto iter = s->begin(); iter != s->end(); ++iter) {
+    result = result.insert(thawTerm(*iter));
+  }
+  return result;
+}
+
+// Returns a copy of a frozen term on the young generation of the current
+// thread, sharing its static objects, so that it stays valid once the
+// searchspaces are cleared.
+static block *thawTerm(block *term) {
+  if (is_leaf_block(term) || isStatic(term)) {
+    return term;
+  }
+  auto copied = thawedCopies.find(term);
+  if (copied != thawedCopies.end()) {
+    return (block *)copied->second;
+  }
+  const uint64_t hdr = term->h.hdr;
+  uint16_t layoutInt = layout_hdr(hdr);
+  block *result;
+  if (!layoutInt) {
+    size_t size = sizeof(string) + len_hdr(hdr);
+    result = (block *)koreAllocToken(size);
+    memcpy(result, term, size);
+    thawHeader(&result->h);
+  } else {
+    result = (block *)koreAlloc(size_hdr(hdr));
+    memcpy(result, term, size_hdr(hdr));
+    thawHeader(&result->h);
+    layout *layoutData = get_layout_data(layoutInt);
+    for (unsigned i = 0; i < layoutData->nargs; i++) {
+      layoutitem *argData = layoutData->args + i;
+      void *arg = ((char *)result) + argData->offset;
+      switch(argData->cat) {
+      case MAP_LAYOUT:
+        *(map *)arg = thawMap((map *)arg);
+        break;
+      case LIST_LAYOUT:
+        *(list *)arg = thawList((list *)arg);
+        break;
+      case SET_LAYOUT:
+        *(set *)arg = thawSet((set *)arg);
+        break;
+      case STRINGBUFFER_LAYOUT:
+        *(stringbuffer **)arg = thawStringBuffer(*(stringbuffer **)arg);
+        break;
+      case INT_LAYOUT:
+        *(mpz_ptr *)arg = thawInt(*(mpz_ptr *)arg);
+        break;
+      case FLOAT_LAYOUT:
+        *(floating **)arg = thawFloat(*(floating **)arg);
+        break;
+      case SYMBOL_LAYOUT:
+      case VARIABLE_LAYOUT:
+        *(block **)arg = thawTerm(*(block **)arg);
+        break;
+      case BOOL_LAYOUT:
+      default: //mint
+        break;
+      }
+    }
+  }
+  thawedCopies[term] = result;
+  return result;
+}
+
+namespace {
+
+// A fingerprint of a term, of which the hash64 table keeps the first word.
+struct fingerprint {
+  uint64_t lo = 0x243f6a8885a308d3ULL;
+  uint64_t hi = 0x13198a2e03707344ULL;
+
+  void add(uint64_t word) {
+    lo = mix(lo ^ word);
+    hi = mix(hi + ((word << 32) | (word >> 32)) + 0x9e3779b97f4a7c15ULL);
+  }
+
+  void add(const fingerprint &other) {
+    add(other.lo);
+    add(other.hi);
+  }
+
+  void addBytes(const char *data, size_t len) {
+    add(len);
+    for (size_t i = 0; i < len; i += 8) {
+      uint64_t word = 0;
+      memcpy(&word, data + i, len - i < 8 ? len - i : 8);
+      add(word);
+    }
+  }
+
+  // the splitmix64 finalizer
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+};
+
+}
+
+// the fingerprints computed by the current call to fingerprintTerm, so that
+// subterms shared within a state are traversed once
+static thread_local std::unordered_map<block *, fingerprint> fingerprints;
+
+static fingerprint fingerprintBlock(block *term);
+
+static void fingerprintInt(fingerprint &fp, mpz_ptr i) {
+  fp.add((uint64_t)i->_mp_size);
+  for (size_t j = 0; j < mpz_size(i); j++) {
+    fp.add(mpz_getlimbn(i, j));
+  }
+}
+
+static void fingerprintFloat(fingerprint &fp, floating *f) {
+  fp.add(f->exp);
+  fp.add(mpfr_get_prec(f->f));
+  fp.add(mpfr_signbit(f->f));
+  if (!mpfr_regular_p(f->f)) {
+    fp.add(mpfr_nan_p(f->f) ? 0 : mpfr_inf_p(f->f) ? 1 : 2);
+    return;
+  }
+  fp.add(mpfr_get_exp(f->f));
+  size_t limbs = (mpfr_get_prec(f->f) + mp_bits_per_limb - 1) / mp_bits_per_limb;
+  for (size_t j = 0; j < limbs; j++) {
+    fp.add(f->f->_mpfr_d[j]);
+  }
+}
+
+// Maps and sets are iterated in an order which depends on their history, so
+// their entries are combined by a commutative sum.
+static void fingerprintMap(fingerprint &fp, map *m) {
+  fingerprint sum;
+  sum.lo = sum.hi = 0;
+  for (auto iter = m->begin(); iter != m->end(); ++iter) {
+    fingerprint entry;
+    entry.add(fingerprintBlock(iter->first));
+    entry.add(fingerprintBlock(iter->second));
+    sum.lo += entry.lo;
+    sum.hi += entry.hi;
+  }
+  fp.add(m->size());
+  fp.add(sum.lo);
+  fp.add(sum.hi);
+}
+
+static void fingerprintSet(fingerprint &fp, set *s) {
+  fingerprint sum;
+  sum.lo = sum.hi = 0;
+  for (auto iter = s->begin(); iter != s->end(); ++iter) {
+    fingerprint entry = fingerprintBlock(*iter);
+    sum.lo += entry.lo;
+    sum.hi += entry.hi;
+  }
+  fp.add(s->size());
+  fp.add(sum.lo);
+  fp.add(sum.hi);
+}
+
+static void fingerprintList(fingerprint &fp, list *l) {
+  fp.add(l->size());
+  for (auto iter = l->begin(); iter != l->end(); ++iter) {
+    fp.add(fingerprintBlock(*iter));
+  }
+}
+
+static fingerprint fingerprintBlock(block *term) {
+  fingerprint fp;
+  if (is_leaf_block(term)) {
+    fp.add((uint64_t)term);
+    return fp;
+  }
+  auto known = fingerprints.find(term);
+  if (known != fingerprints.end()) {
+    return known->second;
+  }
+  const uint64_t hdr = term->h.hdr;
+  fp.add(hdr & HDR_MASK);
+  uint16_t layoutInt = layout_hdr(hdr);
+  if (!layoutInt) {
+    string *str = (string *)term;
+    fp.addBytes(str->data, len(str));
+  } else {
+    layout *layoutData = get_layout_data(layoutInt);
+    for (unsigned i = 0; i < layoutData->nargs; i++) {
+      layoutitem *argData = layoutData->args + i;
+      void *arg = ((char *)term) + argData->offset;
+      switch(argData->cat) {
+      case MAP_LAYOUT:
+        fingerprintMap(fp, (map *)arg);
+        break;
+      case LIST_LAYOUT:
+        fingerprintList(fp, (list *)arg);
+        break;
+      case SET_LAYOUT:
+        fingerprintSet(fp, (set *)arg);
+        break;
+      case STRINGBUFFER_LAYOUT: {
+        stringbuffer *buffer = *(stringbuffer **)arg;
+        fp.addBytes(buffer->contents->data, buffer->strlen);
+        break;
+      }
+      case INT_LAYOUT:
+        fingerprintInt(fp, *(mpz_ptr *)arg);
+        break;
+      case FLOAT_LAYOUT:
+        fingerprintFloat(fp, *(floating **)arg);
+        break;
+      case SYMBOL_LAYOUT:
+      case VARIABLE_LAYOUT:
+        fp.add(fingerprintBlock(*(block **)arg));
+        break;
+      case BOOL_LAYOUT:
+        fp.add(*(bool *)arg);
+        break;
+      default: //mint
+        fp.addBytes((char *)arg, mintBytes(argData->cat));
+        break;
+      }
+    }
+  }
+  fingerprints[term] = fp;
+  return fp;
+}
+
+// Returns a fingerprint of the whole of term, unlike hash_k, which only hashes
+// a bounded part of it. Structurally equal terms have the same fingerprint.
+static fingerprint fingerprintTerm(block *term) {
+  fingerprint result = fingerprintBlock(term);
+  fingerprints.clear();
+  return result;
+}
+
+namespace {
+
+// An open-addressing hash table of fingerprints, in which the zero slot is
+// empty.
+template <typename Slot>
+struct fingerprint_shard {
+  std::mutex lock;
+  std::vector<Slot> slots;
+  size_t count = 0;
+
+  static bool empty(const Slot &slot) {
+    return slot == Slot();
+  }
+
+  // Returns true if the fingerprint was not in the table yet.
+  bool insert(Slot slot) {
+    if (slots.empty()) {
+      slots.resize(1024);
+    }
+    if ((count + 1) * 4 > slots.size() * 3) {
+      std::vector<Slot> old(slots.size() * 2);
+      old.swap(slots);
+      count = 0;
+      for (auto &entry : old) {
+        if (!empty(entry)) {
+          insertNew(entry);
+        }
+      }
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = hashOf(slot) & mask; ; i = (i + 1) & mask) {
+      if (slots[i] == slot) {
+        return false;
+      }
+      if (empty(slots[i])) {
+        slots[i] = slot;
+        count++;
+        return true;
+      }
+    }
+  }
+
+  void insertNew(Slot slot) {
+    size_t mask = slots.size() - 1;
+    size_t i = hashOf(slot) & mask;
+    while (!empty(slots[i])) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+    count++;
+  }
+
+  static uint64_t hashOf(uint64_t slot) {
+    return slot;
+  }
 
+  static uint64_t hashOf(const std::pair<uint64_t, uint64_t> &slot) {
+    return slot.first;
+  }
+};
+
+struct exact_shard {
+  std::mutex lock;
+  // the length of the shortest path by which each state was reached
+  std::unordered_map<block *, int64_t, HashBlock, KEq> states;
+};
+
+static const unsigned NUM_VISITED_SHARDS = 256;
+
+// The states reached by a search, shared by its threads.
+class visited_table {
+  std::unique_ptr<exact_shard[]> exact;
+  std::unique_ptr<fingerprint_shard<uint64_t>[]> hash64;
+  std::unique_ptr<fingerprint_shard<std::pair<uint64_t, uint64_t>>[]> hash128;
+  std::atomic<uint64_t> *bitstate = nullptr;
+  size_t bitstateWords = 0;
+
+public:
+  std::atomic<uint64_t> explored{0};
+  std::atomic<uint64_t> duplicates{0};
+  // set if the search is bounded by the length of its paths, in which case a
+  // state reached again by a shorter path must be expanded again, since states
+  // beyond the bound from its first path may be within it from the new one
+  bool bounded = false;
+
+  visited_table() {
+    switch (visitedMode) {
+    case visited_mode::Exact:
+      exact.reset(new exact_shard[NUM_VISITED_SHARDS]);
+      break;
+    case visited_mode::Hash64:
+      hash64.reset(new fingerprint_shard<uint64_t>[NUM_VISITED_SHARDS]);
+      break;
+    case visited_mode::Hash128:
+      hash128.reset(new fingerprint_shard<std::pair<uint64_t, uint64_t>>[NUM_VISITED_SHARDS]);
+      break;
+    case visited_mode::Bitstate: {
+      bitstateWords = ((size_t)1 << bitstateBits) / 64;
+      // zeroed lazily by the OS
+      void *bits = mmap(NULL, bitstateWords * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (bits == MAP_FAILED) {
+        perror("mmap");
+        abort();
+      }
+      bitstate = (std::atomic<uint64_t> *)bits;
+      break;
+    }
+    }
+  }
+
+  ~visited_table() {
+    if (bitstate) {
+      munmap(bitstate, bitstateWords * sizeof(uint64_t));
+    }
+  }
+
+  // Records a state reached by the current thread by a path of the given
+  // length. Returns false if it was visited already, by a path no longer than
+  // this one if the search is bounded, and otherwise sets queued to the state
+  // to queue: a frozen copy of it if share is true or the table keeps the
+  // states themselves, and the state itself otherwise.
+  bool insert(block *state, int64_t distance, bool share, block **queued) {
+    bool inserted;
+    if (visitedMode == visited_mode::Exact) {
+      exact_shard &shard = exact[hash_k(state) % NUM_VISITED_SHARDS];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      auto found = shard.states.find(state);
+      if (found == shard.states.end()) {
+        *queued = freezeState(state);
+        shard.states.emplace(*queued, distance);
+        inserted = true;
+      } else if (bounded && distance < found->second) {
+        found->second = distance;
+        *queued = found->first;
+        inserted = true;
+      } else {
+        inserted = false;
+      }
+    } else {
+      inserted = insertFingerprint(fingerprintTerm(state));
+      if (inserted) {
+        *queued = share ? freezeState(state) : state;
+      }
+    }
+    if (!inserted) {
+      duplicates.fetch_add(1);
+    }
+    return inserted;
+  }
+
+  // Returns true if a state left unexpanded because it was reached by a path
+  // as long as the bound was expanded after all, having been reached again by
+  // a shorter path. Only the exact table knows.
+  bool expandedWithin(block *state, int64_t bound) {
+    if (visitedMode != visited_mode::Exact) {
+      return false;
+    }
+    exact_shard &shard = exact[hash_k(state) % NUM_VISITED_SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.states.find(state);
+    return found != shard.states.end() && found->second < bound;
+  }
+
+  void report(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+      perror("fopen");
+      abort();
+    }
+    fprintf(file, "states_explored=%lu\n", explored.load());
+    fprintf(file, "duplicates=%lu\n", duplicates.load());
+    switch (visitedMode) {
+    case visited_mode::Exact: {
+      size_t states = 0;
+      for (unsigned i = 0; i < NUM_VISITED_SHARDS; i++) {
+        states += exact[i].states.size();
+      }
+      fprintf(file, "visited=exact\nstates_stored=%zu\n", states);
+      break;
+    }
+    case visited_mode::Hash64:
+      reportFingerprints(file, "hash64", hash64.get(), 64);
+      break;
+    case visited_mode::Hash128:
+      reportFingerprints(file, "hash128", hash128.get(), 128);
+      break;
+    case visited_mode::Bitstate: {
+      uint64_t bitsSet = 0;
+      for (size_t i = 0; i < bitstateWords; i++) {
+        bitsSet += __builtin_popcountll(bitstate[i].load(std::memory_order_relaxed));
+      }
+      double fill = (double)bitsSet / (bitstateWords * 64);
+      fprintf(file, "visited=bitstate\nbits=%zu\nbits_set=%lu\noccupancy=%.6f\n", bitstateWords * 64, bitsSet, fill);
+      // the probability that a new state is wrongly considered visited
+      fprintf(file, "false_positive_rate=%.3g\n", pow(fill, BITSTATE_HASHES));
+      break;
+    }
+    }
+    fclose(file);
+  }
+
+private:
+  bool insertFingerprint(const fingerprint &fp) {
+    unsigned index = fp.lo >> 56;
+    switch (visitedMode) {
+    case visited_mode::Hash64: {
+      auto &shard = hash64[index];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      return shard.insert(fp.lo ? fp.lo : 1);
+    }
+    case visited_mode::Hash128: {
+      auto &shard = hash128[index];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      return shard.insert({fp.lo, fp.hi ? fp.hi : 1});
+    }
+    default: {
+      bool inserted = false;
+      uint64_t mask = ((uint64_t)1 << bitstateBits) - 1;
+      for (unsigned i = 0; i < BITSTATE_HASHES; i++) {
+        uint64_t bit = (fp.lo + i * (fp.hi | 1)) & mask;
+        uint64_t word = (uint64_t)1 << (bit % 64);
+        if (!(bitstate[bit / 64].fetch_or(word, std::memory_order_relaxed) & word)) {
+          inserted = true;
+        }
+      }
+      return inserted;
+    }
+    }
+  }
+
+  template <typename Slot>
+  static void reportFingerprints(FILE *file, const char *mode, fingerprint_shard<Slot> *shards, unsigned bits) {
+    size_t count = 0, slots = 0;
+    for (unsigned i = 0; i < NUM_VISITED_SHARDS; i++) {
+      count += shards[i].count;
+      slots += shards[i].slots.size();
+    }
+    fprintf(file, "visited=%s\nstates_stored=%zu\nslots=%zu\noccupancy=%.6f\nbytes=%zu\n", mode, count, slots, slots ? (double)count / slots : 0.0, slots * sizeof(Slot));
+    // the expected number of states wrongly considered visited, i.e. of pairs
+    // of states with the same fingerprint
+    fprintf(file, "expected_omissions=%.3g\n", (double)count * count / ldexp(2.0, bits));
+  }
+};
+
+// The encoding of a state of a compressed frontier, made of the bytes it shares
+// at its start and its end with the encoding of the first state queued by the
+// same expansion, and of the bytes in between.
+struct encoded_state {
+  std::shared_ptr<const std::string> base;
+  size_t prefix, suffix;
+  std::string middle;
+};
+
+// A state of the frontier, with the length of the path by which it was
+// reached. In a compressed frontier, only its encoding is kept.
+struct search_state {
+  block *term;
+  encoded_state encoded;
+  int64_t distance;
+};
+
+struct search_deque {
+  std::mutex lock;
+  std::deque<search_state> states;
+  // read without the lock by threads looking for work
+  std::atomic<size_t> size{0};
+};
+
+struct parallel_search {
+  std::unique_ptr<search_deque[]> deques;
+  visited_table visited;
+  bool dfs;
+  // the number of states which may still be expanded, or -1 if unbounded
+  std::atomic<int64_t> depth;
+  // the length of the paths explored, or -1 if unbounded
+  int64_t bound;
+  // the number of states queued or being expanded. The search is over once it
+  // drops to zero.
+  std::atomic<uint64_t> pending{0};
+  std::atomic<uint64_t> steps{0};
+  std::atomic<uint64_t> solutions{0};
+  std::atomic<bool> stop{false};
+  // true if a state was left unexpanded because of the bound
+  std::atomic<bool> cut{false};
+  std::unique_ptr<std::vector<block *>[]> results;
+  // the states left unexpanded because of the bound, which are solutions
+  // unless they were expanded after all, cf visited_table::expandedWithin
+  std::unique_ptr<std::vector<block *>[]> cutStates;
+};
+
+// The threads of the parallel search other than the one which calls it. They
+// are started by the first parallel search and wait for the next one in
+// between, so that the blocks of their heaps and searchspaces are reused
+// rather than abandoned with them.
+class search_pool {
+public:
+  // Calls job with the index of each thread of the search, 0 being the current
+  // thread, and returns once every call has returned.
+  void run(const std::function<void(unsigned)> &job) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      while (threads.size() + 1 < numSearchThreads) {
+        largeObjectSpaceShared();
+        unsigned index = threads.size() + 1;
+        threads.emplace_back(&search_pool::work, this, index, generation);
+      }
+      current = &job;
+      running = threads.size();
+      generation++;
+    }
+    wake.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this]() { return running == 0; });
+    current = nullptr;
+  }
+
+private:
+  void work(unsigned index, uint64_t seen) {
+    while (true) {
+      const std::function<void(unsigned)> *job;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this, seen]() { return generation != seen; });
+        seen = generation;
+        job = current;
+      }
+      (*job)(index);
+      std::lock_guard<std::mutex> guard(lock);
+      if (--running == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::vector<std::thread> threads;
+  const std::function<void(unsigned)> *current = nullptr;
+  // incremented by each call to run
+  uint64_t generation = 0;
+  // the number of threads of the pool which have not returned from the job
+  unsigned running = 0;
+};
+
+}
+
+// Never destroyed, since the threads of the pool wait for work until the
+// program exits.
+static search_pool &searchPool() {
+  static search_pool *pool = new search_pool;
+  return *pool;
+}
+
+// True if enough solutions were found for the search to stop.
+static bool enoughSolutions(uint64_t found) {
+  return maxSolutions && found >= maxSolutions;
+}
+
+// True if the specified state matches the search goal, which must exist.
+static bool matchesGoal(block *state) {
+  resetMatchReason();
+  match_search_goal(state);
+  return matchSucceeded();
 }
 
-static std::list<block *> states;
-static block *state;
+static thread_local std::list<search_state> states;
+static thread_local block *state;
 
 static std::pair<std::vector<block **>::iterator, std::vector<block **>::iterator> blockEnumerator() {
-  static std::vector<block **> blocks;
+  static thread_local std::vector<block **> blocks;
 
   blocks.clear();
 
   for (auto &keyVal : states) {
-    blocks.push_back(const_cast<block**>(&(keyVal)));
+    if (keyVal.term) {
+      blocks.push_back(&keyVal.term);
+    }
   }
   blocks.push_back(&state);
 
   return std::make_pair(blocks.begin(), blocks.end());
 }
 
-std::unordered_set<block *, HashBlock, KEq> take_search_steps(int64_t depth, block *subject) {
-  static int registered = -1;
+// Makes the collections of the current thread move the states it searches.
+static void registerSearchRoots() {
+  static thread_local int registered = -1;
   if (registered == -1) {
     registerGCRootsEnumerator(blockEnumerator);
+    registered = 0;
   }
+}
 
-  std::unordered_set<block *, HashBlock, KEq> results;
-  std::unordered_set<block *, HashBlock, KEq> states_set;
-  states.clear();
-  states_set.insert(subject);
-  states.push_back(subject);
-  while(!states.empty() && depth != 0) {
-    state = states.front();
-    states.pop_front();
-    states_set.erase(state);
-    if (depth > 0) depth--;
+// Makes the entry of the frontier of a state reached by the current thread. In
+// a compressed frontier, the state is encoded relative to base, the encoding of
+// the first state queued by the same expansion, or becomes base if there is
+// none yet.
+static search_state frontierEntry(block *term, int64_t distance, std::shared_ptr<const std::string> &base) {
+  search_state result;
+  result.distance = distance;
+  if (!compressFrontier) {
+    result.term = term;
+    return result;
+  }
+  result.term = nullptr;
+  std::string encoding;
+  term_encoder(encoding).encode(term);
+  if (!base) {
+    base = std::make_shared<const std::string>(std::move(encoding));
+    result.encoded = {base, base->size(), 0, ""};
+    return result;
+  }
+  size_t shortest = std::min(base->size(), encoding.size());
+  size_t prefix = 0, suffix = 0;
+  while (prefix < shortest && (*base)[prefix] == encoding[prefix]) {
+    prefix++;
+  }
+  while (suffix < shortest - prefix && (*base)[base->size() - suffix - 1] == encoding[encoding.size() - suffix - 1]) {
+    suffix++;
+  }
+  result.encoded = {base, prefix, suffix, encoding.substr(prefix, encoding.size() - prefix - suffix)};
+  return result;
+}
+
+// Returns the state of an entry of the frontier, decoding it on the young
+// generation of the current thread if the frontier is compressed.
+static block *frontierState(const search_state &entry) {
+  if (entry.term) {
+    return entry.term;
+  }
+  static thread_local std::string encoding;
+  const encoded_state &encoded = entry.encoded;
+  encoding.assign(*encoded.base, 0, encoded.prefix);
+  encoding.append(encoded.middle);
+  encoding.append(*encoded.base, encoded.base->size() - encoded.suffix, encoded.suffix);
+  return term_decoder(encoding.data()).decode();
+}
+
+static void pushState(parallel_search &search, unsigned index, search_state state) {
+  search_deque &own = search.deques[index];
+  std::lock_guard<std::mutex> guard(own.lock);
+  own.states.push_back(std::move(state));
+  own.size.store(own.states.size(), std::memory_order_relaxed);
+}
+
+static bool popState(parallel_search &search, unsigned index, search_state *result) {
+  search_deque &own = search.deques[index];
+  std::lock_guard<std::mutex> guard(own.lock);
+  if (own.states.empty()) {
+    return false;
+  }
+  if (search.dfs) {
+    *result = std::move(own.states.back());
+    own.states.pop_back();
+  } else {
+    *result = std::move(own.states.front());
+    own.states.pop_front();
+  }
+  own.size.store(own.states.size(), std::memory_order_relaxed);
+  return true;
+}
+
+// Takes a state from the end of the deque of another thread which its owner
+// would expand last: in a depth-first search, the shallowest, whose subtree is
+// likely the largest.
+static bool stealState(parallel_search &search, unsigned index, search_state *result) {
+  for (unsigned i = 1; i < numSearchThreads; i++) {
+    search_deque &victim = search.deques[(index + i) % numSearchThreads];
+    if (!victim.size.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.states.empty()) {
+      if (search.dfs) {
+        *result = std::move(victim.states.front());
+        victim.states.pop_front();
+      } else {
+        *result = std::move(victim.states.back());
+        victim.states.pop_back();
+      }
+      victim.size.store(victim.states.size(), std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reserves the expansion of one state within the depth bound.
+static bool claimStep(parallel_search &search) {
+  int64_t depth = search.depth.load();
+  while (depth != 0) {
+    if (depth < 0 || search.depth.compare_exchange_weak(depth, depth - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void releaseStep(parallel_search &search) {
+  if (search.depth.load() >= 0) {
+    search.depth.fetch_add(1);
+  }
+}
+
+// Records a solution found by the current thread, unless enough were found
+// already.
+static void addSolution(parallel_search &search, unsigned index, block *state) {
+  uint64_t found = search.solutions.fetch_add(1);
+  if (enoughSolutions(found)) {
+    return;
+  }
+  search.results[index].push_back(state);
+  if (enoughSolutions(found + 1)) {
+    search.stop.store(true);
+  }
+}
+
+// Queues a state reached by the current thread unless it was visited before.
+// The states queued are shared with the other threads, so they are frozen
+// unless the frontier is compressed.
+static void queueState(parallel_search &search, unsigned index, block *state, int64_t distance, std::shared_ptr<const std::string> &base) {
+  block *queued;
+  if (search.visited.insert(state, distance, !compressFrontier, &queued)) {
+    if (match_search_goal && matchesGoal(queued)) {
+      addSolution(search, index, freezeState(queued));
+    }
+    search.pending.fetch_add(1);
+    pushState(search, index, frontierEntry(queued, distance, base));
+  }
+}
+
+static void searchWorker(parallel_search *search, unsigned index) {
+  registerSearchRoots();
+  search_state entry;
+  while (search->pending.load() && !search->stop.load() && claimStep(*search)) {
+    if (!popState(*search, index, &entry) && !stealState(*search, index, &entry)) {
+      releaseStep(*search);
+      std::this_thread::yield();
+      continue;
+    }
+    state = frontierState(entry);
+    if (search->bound >= 0 && entry.distance >= search->bound) {
+      releaseStep(*search);
+      search->cut.store(true);
+      if (!match_search_goal) {
+        search->cutStates[index].push_back(freezeState(state));
+        frozenCopies.clear();
+      }
+      search->pending.fetch_sub(1);
+      continue;
+    }
+    search->visited.explored.fetch_add(1);
     uint64_t count;
     block **stepResults = take_search_step(state, &count);
     if (count == 0) {
-      results.insert(state);
+      if (!match_search_goal) {
+        addSolution(*search, index, freezeState(state));
+      }
     } else {
+      std::shared_ptr<const std::string> base;
       for (uint64_t i = 0; i < count; i++) {
-        auto dirty = states_set.insert(stepResults[i]);
-        if (dirty.second) {
-          states.push_back(stepResults[i]);
+        queueState(*search, index, stepResults[i], entry.distance + 1, base);
+      }
+    }
+    frozenCopies.clear();
+    search->pending.fetch_sub(1);
+  }
+}
+
+static std::unordered_set<block *, HashBlock, KEq> searchParallel(block *subject, int64_t depth, bool dfs, bool *cut) {
+  parallel_search search;
+  search.deques.reset(new search_deque[numSearchThreads]);
+  search.results.reset(new std::vector<block *>[numSearchThreads]);
+  search.cutStates.reset(new std::vector<block *>[numSearchThreads]);
+  search.dfs = dfs;
+  search.depth = dfs || depth < 0 ? -1 : depth;
+  search.bound = dfs ? depth : -1;
+  search.visited.bounded = search.bound >= 0;
+  std::shared_ptr<const std::string> base;
+  queueState(search, 0, subject, 0, base);
+  frozenCopies.clear();
+
+  searchPool().run([&search](unsigned index) {
+    uint64_t before = get_steps();
+    searchWorker(&search, index);
+    if (index) {
+      search.steps.fetch_add(get_steps() - before);
+    }
+  });
+  add_steps(search.steps.load());
+
+  std::unordered_set<block *, HashBlock, KEq> results;
+  for (unsigned i = 0; i < numSearchThreads; i++) {
+    results.insert(search.results[i].begin(), search.results[i].end());
+    for (block *cutState : search.cutStates[i]) {
+      if (!search.visited.expandedWithin(cutState, search.bound)) {
+        results.insert(cutState);
+      }
+    }
+  }
+  if (search.depth.load() == 0 && search.pending.load()) {
+    search.cut.store(true);
+    if (!match_search_goal && !search.stop.load()) {
+      for (unsigned i = 0; i < numSearchThreads; i++) {
+        for (auto &entry : search.deques[i].states) {
+          results.insert(freezeState(frontierState(entry)));
+          frozenCopies.clear();
         }
       }
     }
   }
-  if (depth == 0) {
-    for (auto state : states) {
-      results.insert(state);
+  if (searchStatsFile) {
+    search.visited.report(searchStatsFile);
+  }
+  *cut = search.cut.load();
+  return results;
+}
+
+// Queues a state reached by the serial search unless it was visited before.
+// Returns false once enough solutions were found.
+static bool reachState(visited_table &visited, std::unordered_set<block *, HashBlock, KEq> &results, block *reached, int64_t distance, std::shared_ptr<const std::string> &base) {
+  block *queued;
+  if (!visited.insert(reached, distance, false, &queued)) {
+    return true;
+  }
+  states.push_back(frontierEntry(queued, distance, base));
+  if (match_search_goal && matchesGoal(queued)) {
+    results.insert(freezeState(queued));
+    return !enoughSolutions(results.size());
+  }
+  return true;
+}
+
+static std::unordered_set<block *, HashBlock, KEq> searchSerial(block *subject, int64_t depth, bool dfs, bool *cut) {
+  registerSearchRoots();
+
+  // The states queued are frozen if the visited table keeps them, encoded if
+  // the frontier is compressed, and are otherwise kept alive by
+  // blockEnumerator. The results are frozen, since the collector does not know
+  // about them.
+  std::unordered_set<block *, HashBlock, KEq> results;
+  // the states left unexpanded because of the bound, cf
+  // visited_table::expandedWithin
+  std::vector<block *> cutStates;
+  visited_table visited;
+  // the number of states which may still be expanded, and the length of the
+  // paths explored, or -1 if unbounded
+  int64_t budget = dfs ? -1 : depth;
+  int64_t bound = dfs ? depth : -1;
+  visited.bounded = bound >= 0;
+  *cut = false;
+  states.clear();
+  std::shared_ptr<const std::string> initial;
+  bool more = reachState(visited, results, subject, 0, initial);
+  frozenCopies.clear();
+  while(more && !states.empty() && budget != 0) {
+    search_state next;
+    if (dfs) {
+      next = std::move(states.back());
+      states.pop_back();
+    } else {
+      next = std::move(states.front());
+      states.pop_front();
+    }
+    state = frontierState(next);
+    if (bound >= 0 && next.distance >= bound) {
+      *cut = true;
+      if (!match_search_goal) {
+        cutStates.push_back(freezeState(state));
+      }
+      frozenCopies.clear();
+      continue;
+    }
+    if (budget > 0) budget--;
+    visited.explored++;
+    uint64_t count;
+    block **stepResults = take_search_step(state, &count);
+    if (count == 0) {
+      if (!match_search_goal) {
+        results.insert(freezeState(state));
+        more = !enoughSolutions(results.size());
+      }
+    } else {
+      std::shared_ptr<const std::string> base;
+      for (uint64_t i = 0; i < count && more; i++) {
+        more = reachState(visited, results, stepResults[i], next.distance + 1, base);
+      }
+    }
+    frozenCopies.clear();
+  }
+  if (budget == 0 && !states.empty()) {
+    *cut = true;
+    if (!match_search_goal && more) {
+      for (auto &entry : states) {
+        results.insert(freezeState(frontierState(entry)));
+        frozenCopies.clear();
+      }
     }
   }
+  states.clear();
+  for (block *cutState : cutStates) {
+    if (!visited.expandedWithin(cutState, bound)) {
+      results.insert(cutState);
+    }
+  }
+  if (searchStatsFile) {
+    visited.report(searchStatsFile);
+  }
+  return results;
+}
+
+static std::unordered_set<block *, HashBlock, KEq> searchStates(block *subject, int64_t depth, bool dfs, bool *cut) {
+  if (numSearchThreads > 1) {
+    return searchParallel(subject, depth, dfs, cut);
+  }
+  return searchSerial(subject, depth, dfs, cut);
+}
+
+static void clearSearchspaces() {
+  if (numSearchThreads > 1) {
+    searchPool().run([](unsigned) { koreAllocSearchClear(); });
+  } else {
+    koreAllocSearchClear();
+  }
+}
+
+// Copies the solutions of a search into the heap of the current thread, then
+// clears the searchspaces of every thread of the search, which nothing
+// references anymore.
+static std::unordered_set<block *, HashBlock, KEq> thawResults(const std::unordered_set<block *, HashBlock, KEq> &frozen) {
+  std::unordered_set<block *, HashBlock, KEq> results;
+  for (block *result : frozen) {
+    results.insert(thawTerm(result));
+  }
+  thawedCopies.clear();
+  clearSearchspaces();
   return results;
 }
+
+std::unordered_set<block *, HashBlock, KEq> take_search_steps(int64_t depth, block *subject) {
+  bool cut;
+  if (searchStrategy != search_strategy::IDDFS) {
+    return thawResults(searchStates(subject, depth, searchStrategy == search_strategy::DFS, &cut));
+  }
+  // every iteration starts over from the initial state, which therefore must
+  // not be moved by the collections of the previous ones
+  subject = freezeState(subject);
+  frozenCopies.clear();
+  for (int64_t bound = 0; ; bound++) {
+    auto results = searchStates(subject, bound, true, &cut);
+    if (!cut || bound == depth || enoughSolutions(results.size()) || (match_search_goal && !results.empty())) {
+      return thawResults(results);
+    }
+    // nothing but the initial state outlives the iteration, so it is copied
+    // out of the searchspaces before they are cleared, and frozen again. The
+    // collector does not run in between.
+    block *initial = thawTerm(subject);
+    thawedCopies.clear();
+    clearSearchspaces();
+    subject = freezeState(initial);
+    frozenCopies.clear();
+  }
+}
@@ -0,0 +1,278 @@
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "runtime/header.h"
+#include "runtime/alloc.h"
+#include "runtime/term_encoding.h"
+
+extern "C" {
+  mpz_ptr move_int(mpz_t);
+  floating *move_float(floating *);
+}
+
+// In the encoding of a term, each object is introduced by a varint whose two
+// lowest bits are its kind:
+//
+// - LEAF: a constant, whose tag and variable bit are the rest of the varint.
+// - SHARED: an object encoded before, the rest of the varint being how many
+//   objects were encoded since.
+// - TOKEN: a string, whose length and variable bit are the rest of the varint,
+//   followed by its bytes.
+// - SYMBOL: a block, whose tag and variable bit are the rest of the varint,
+//   followed by the encoding of its arguments.
+//
+// Integers, floats and machine integers are encoded by their words, and
+// collections by their size followed by their elements.
+enum encoded_kind { LEAF = 0, SHARED = 1, TOKEN = 2, SYMBOL = 3 };
+
+static void encodeVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+static uint64_t decodeVarint(const char *&in) {
+  uint64_t result = 0;
+  unsigned shift = 0;
+  while (*in & 0x80) {
+    result |= (uint64_t)(*in++ & 0x7f) << shift;
+    shift += 7;
+  }
+  return result | (uint64_t)(unsigned char)*in++ << shift;
+}
+
+static void encodeSigned(std::string &out, int64_t value) {
+  encodeVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static int64_t decodeSigned(const char *&in) {
+  uint64_t value = decodeVarint(in);
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static uint64_t variableBit(uint64_t hdr) {
+  return (hdr & VARIABLE_BIT) ? 1 : 0;
+}
+
+void term_encoder::encodeInt(mpz_ptr i) {
+  encodeSigned(out, i->_mp_size);
+  for (size_t j = 0; j < mpz_size(i); j++) {
+    encodeVarint(out, mpz_getlimbn(i, j));
+  }
+}
+
+void term_encoder::encodeFloat(floating *f) {
+  encodeVarint(out, f->exp);
+  encodeVarint(out, mpfr_get_prec(f->f));
+  encodeSigned(out, f->f->_mpfr_sign);
+  encodeSigned(out, f->f->_mpfr_exp);
+  if (mpfr_regular_p(f->f)) {
+    size_t limbs = (mpfr_get_prec(f->f) + mp_bits_per_limb - 1) / mp_bits_per_limb;
+    for (size_t j = 0; j < limbs; j++) {
+      encodeVarint(out, f->f->_mpfr_d[j]);
+    }
+  }
+}
+
+void term_encoder::encode(block *term) {
+  if (is_leaf_block(term)) {
+    uint64_t value = (uint64_t)term;
+    encodeVarint(out, ((value >> 32) << 3) | (((value >> 1) & 1) << 2) | LEAF);
+    return;
+  }
+  auto known = shared.find(term);
+  if (known != shared.end()) {
+    encodeVarint(out, ((shared.size() - known->second) << 2) | SHARED);
+    return;
+  }
+  uint64_t index = shared.size();
+  shared[term] = index;
+  const uint64_t hdr = term->h.hdr;
+  uint16_t layoutInt = layout_hdr(hdr);
+  if (!layoutInt) {
+    string *str = (string *)term;
+    encodeVarint(out, (len(str) << 3) | (variableBit(hdr) << 2) | TOKEN);
+    out.append(str->data, len(str));
+    return;
+  }
+  encodeVarint(out, ((uint64_t)tag_hdr(hdr) << 3) | (variableBit(hdr) << 2) | SYMBOL);
+  layout *layoutData = get_layout_data(layoutInt);
+  for (unsigned i = 0; i < layoutData->nargs; i++) {
+    layoutitem *argData = layoutData->args + i;
+    void *arg = ((char *)term) + argData->offset;
+    switch(argData->cat) {
+    case MAP_LAYOUT: {
+      map *m = (map *)arg;
+      encodeVarint(out, m->size());
+      for (auto iter = m->begin(); iter != m->end(); ++iter) {
+        encode(iter->first);
+        encode(iter->second);
+      }
+      break;
+    }
+    case LIST_LAYOUT: {
+      list *l = (list *)arg;
+      encodeVarint(out, l->size());
+      for (auto iter = l->begin(); iter != l->end(); ++iter) {
+        encode(*iter);
+      }
+      break;
+    }
+    case SET_LAYOUT: {
+      set *s = (set *)arg;
+      encodeVarint(out, s->size());
+      for (auto iter = s->begin(); iter != s->end(); ++iter) {
+        encode(*iter);
+      }
+      break;
+    }
+    case STRINGBUFFER_LAYOUT: {
+      stringbuffer *buffer = *(stringbuffer **)arg;
+      encodeVarint(out, buffer->strlen);
+      out.append(buffer->contents->data, buffer->strlen);
+      break;
+    }
+    case INT_LAYOUT:
+      encodeInt(*(mpz_ptr *)arg);
+      break;
+    case FLOAT_LAYOUT:
+      encodeFloat(*(floating **)arg);
+      break;
+    case SYMBOL_LAYOUT:
+    case VARIABLE_LAYOUT:
+      encode(*(block **)arg);
+      break;
+    case BOOL_LAYOUT:
+      out.push_back(*(bool *)arg);
+      break;
+    default: //mint
+      out.append((char *)arg, mintBytes(argData->cat));
+      break;
+    }
+  }
+}
+
+mpz_ptr term_decoder::decodeInt() {
+  int64_t size = decodeSigned(in);
+  size_t limbs = size < 0 ? -size : size;
+  mpz_t result;
+  mpz_init2(result, limbs * mp_bits_per_limb);
+  for (size_t j = 0; j < limbs; j++) {
+    result->_mp_d[j] = decodeVarint(in);
+  }
+  result->_mp_size = size;
+  return move_int(result);
+}
+
+floating *term_decoder::decodeFloat() {
+  floating result[1];
+  result->exp = decodeVarint(in);
+  mpfr_prec_t prec = decodeVarint(in);
+  mpfr_init2(result->f, prec);
+  result->f->_mpfr_sign = decodeSigned(in);
+  result->f->_mpfr_exp = decodeSigned(in);
+  if (mpfr_regular_p(result->f)) {
+    size_t limbs = (prec + mp_bits_per_limb - 1) / mp_bits_per_limb;
+    for (size_t j = 0; j < limbs; j++) {
+      result->f->_mpfr_d[j] = decodeVarint(in);
+    }
+  }
+  return move_float(result);
+}
+
+stringbuffer *term_decoder::decodeStringBuffer() {
+  uint64_t strlen = decodeVarint(in);
+  uint64_t capacity = strlen < 16 ? 16 : strlen;
+  stringbuffer *result = (stringbuffer *)koreAlloc(sizeof(stringbuffer));
+  set_len(result, sizeof(stringbuffer) - sizeof(blockheader));
+  result->strlen = strlen;
+  string *contents = (string *)koreAllocToken(sizeof(string) + capacity);
+  set_len(contents, capacity);
+  memcpy(contents->data, in, strlen);
+  in += strlen;
+  result->contents = contents;
+  return result;
+}
+
+block *term_decoder::decode() {
+  uint64_t head = decodeVarint(in);
+  switch(head & 3) {
+  case LEAF:
+    return (block *)(((head >> 3) << 32) | (((head >> 2) & 1) << 1) | 1);
+  case SHARED:
+    return shared[shared.size() - (head >> 2)];
+  case TOKEN: {
+    uint64_t length = head >> 3;
+    string *str = (string *)koreAllocToken(sizeof(string) + length);
+    set_len(str, length);
+    if ((head >> 2) & 1) {
+      str->h.hdr |= VARIABLE_BIT;
+    }
+    memcpy(str->data, in, length);
+    in += length;
+    shared.push_back((block *)str);
+    return (block *)str;
+  }
+  }
+  block *result = alloc_block(get_block_header_for_symbol(head >> 3));
+  if ((head >> 2) & 1) {
+    result->h.hdr |= VARIABLE_BIT;
+  }
+  shared.push_back(result);
+  layout *layoutData = get_layout_data(layout(result));
+  for (unsigned i = 0; i < layoutData->nargs; i++) {
+    layoutitem *argData = layoutData->args + i;
+    void *arg = ((char *)result) + argData->offset;
+    switch(argData->cat) {
+    case MAP_LAYOUT: {
+      map m;
+      for (uint64_t size = decodeVarint(in); size; size--) {
+        block *key = decode();
+        m = m.set(key, decode());
+      }
+      new (arg) map(m);
+      break;
+    }
+    case LIST_LAYOUT: {
+      auto tmp = list().transient();
+      for (uint64_t size = decodeVarint(in); size; size--) {
+        tmp.push_back(decode());
+      }
+      new (arg) list(tmp.persistent());
+      break;
+    }
+    case SET_LAYOUT: {
+      set s;
+      for (uint64_t size = decodeVarint(in); size; size--) {
+        s = s.insert(decode());
+      }
+      new (arg) set(s);
+      break;
+    }
+    case STRINGBUFFER_LAYOUT:
+      *(stringbuffer **)arg = decodeStringBuffer();
+      break;
+    case INT_LAYOUT:
+      *(mpz_ptr *)arg = decodeInt();
+      break;
+    case FLOAT_LAYOUT:
+      *(floating **)arg = decodeFloat();
+      break;
+    case SYMBOL_LAYOUT:
+    case VARIABLE_LAYOUT:
+      *(block **)arg = decode();
+      break;
+    case BOOL_LAYOUT:
+      *(bool *)arg = *in++;
+      break;
+    default: //mint
+      memcpy(arg, in, mintBytes(argData->cat));
+      in += mintBytes(argData->cat);
+      break;
+    }
+  }
+  return result;
+}
@@ -14,6 +14,8 @@
 #include <libgen.h>
 #include <sys/stat.h>
 
+#include <cstring>
+
 #include <iostream>
 #include <fstream>
 
@@ -26,11 +28,27 @@ std::string getFilename(std::map<std::string, std::string> index, char **argv, K
 
 int main (int argc, char **argv) {
   if (argc < 5) {
-    std::cerr << "Usage: llvm-kompile-codegen <def.kore> <dt.yaml> <dir> [1|0]\n";
+    std::cerr << "Usage: llvm-kompile-codegen <def.kore> <dt.yaml> <dir> [1|0] [--cache-hashes] [--hash-cons] [--gc-safepoints] [--profile-allocation-sites] [--pretenure=<profile>]\n";
     exit(1);
   }
 
   CODEGEN_DEBUG = atoi(argv[4]);
+  for (int i = 5; i < argc; i++) {
+    if (std::string(argv[i]) == "--cache-hashes") {
+      CACHE_TERM_HASHES = true;
+    } else if (std::string(argv[i]) == "--hash-cons") {
+      HASH_CONS_TERMS = true;
+    } else if (std::string(argv[i]) == "--gc-safepoints") {
+      GC_SAFEPOINTS = true;
+    } else if (std::string(argv[i]) == "--profile-allocation-sites") {
+      PROFILE_ALLOCATION_SITES = true;
+    } else if (std::string(argv[i]).rfind("--pretenure=", 0) == 0) {
+      loadPretenuringProfile(std::string(argv[i]).substr(strlen("--pretenure=")));
+    } else {
+      std::cerr << "llvm-kompile-codegen: unknown option " << argv[i] << "\n";
+      exit(1);
+    }
+  }
 
   KOREParser parser(argv[1]);
   ptr<KOREDefinition> definition = parser.definition();
@@ -76,6 +94,13 @@ int main (int argc, char **argv) {
   auto dtSearch = parseYamlDecisionTree(mod.get(), argv[3] + std::string("/") + "dt-search.yaml", definition->getAllSymbols(), definition->getHookedSorts());
   makeStepFunction(definition.get(), mod.get(), dtSearch, true);
 
+  std::string goalFilename = argv[3] + std::string("/") + "dt-goal.yaml";
+  struct stat goalBuf;
+  if (stat(goalFilename.c_str(), &goalBuf) == 0) {
+    auto dtGoal = parseYamlDecisionTree(mod.get(), goalFilename, definition->getAllSymbols(), definition->getHookedSorts());
+    makeSearchGoalFunction(definition.get(), mod.get(), dtGoal);
+  }
+
   std::map<std::string, std::string> index;
 
   std::ifstream in(argv[3] + std::string("/index.txt"));
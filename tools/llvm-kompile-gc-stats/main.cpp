@@ -1,18 +1,175 @@
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <gmp.h>
 
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// the smallest pause which is at least as long as the specified fraction of
+// pauses
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double fraction) {
+  size_t rank = ceil(fraction * sorted.size());
+  return sorted[rank ? rank - 1 : 0];
+}
+
+// Summarizes a file written by a program run with KLLVM_GC_STATS set, cf
+// runtime/collect/telemetry.cpp.
+static int summary(FILE *f) {
+  std::vector<uint64_t> pauses;
+  size_t numMajor = 0;
+  uint64_t totalPause = 0, totalTime = 0, copied = 0, promoted = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    uint64_t timestamp, pause, youngBefore, youngAfter, oldBefore, oldAfter, bytesCopied, bytesPromoted;
+    int major;
+    if (sscanf(line, "# total_ns=%lu", &totalTime) == 1) {
+      continue;
+    }
+    if (sscanf(line, "%lu,%lu,%d,%lu,%lu,%lu,%lu,%lu,%lu", &timestamp, &pause, &major,
+          &youngBefore, &youngAfter, &oldBefore, &oldAfter, &bytesCopied, &bytesPromoted) != 9) {
+      // the line naming the fields
+      continue;
+    }
+    pauses.push_back(pause);
+    numMajor += major;
+    totalPause += pause;
+    copied += bytesCopied;
+    promoted += bytesPromoted;
+  }
+  printf("%zd collections (%zd minor, %zd major)\n", pauses.size(), pauses.size() - numMajor, numMajor);
+  if (pauses.empty()) {
+    return 0;
+  }
+  std::sort(pauses.begin(), pauses.end());
+  printf("pause p50: %.3f ms\n", percentile(pauses, 0.5) / 1e6);
+  printf("pause p90: %.3f ms\n", percentile(pauses, 0.9) / 1e6);
+  printf("pause p99: %.3f ms\n", percentile(pauses, 0.99) / 1e6);
+  printf("pause max: %.3f ms\n", pauses.back() / 1e6);
+  printf("total pause: %.3f ms\n", totalPause / 1e6);
+  if (totalTime) {
+    printf("overhead: %.2f%%\n", 100.0 * totalPause / totalTime);
+  } else {
+    // the program did not exit normally
+    printf("overhead: unknown\n");
+  }
+  printf("bytes copied: %lu\n", copied);
+  printf("bytes promoted: %lu\n", promoted);
+  return 0;
+}
+
+namespace {
+
+struct census_entry {
+  uint64_t objects = 0;
+  uint64_t bytes = 0;
+};
+
+struct census {
+  std::string header;
+  std::map<std::string, census_entry> entries;
+};
+
+}
+
+// prints the specified number of entries with the most bytes
+static void printTopEntries(std::vector<std::pair<std::string, census_entry>> &entries, uint64_t totalBytes, size_t numEntries) {
+  std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) { return a.second.bytes > b.second.bytes; });
+  for (size_t i = 0; i < entries.size() && i < numEntries; i++) {
+    auto &entry = entries[i];
+    printf("  %12lu bytes %6.2f%% %10lu objects  %s\n", entry.second.bytes,
+        totalBytes ? 100.0 * entry.second.bytes / totalBytes : 0.0,
+        entry.second.objects, entry.first.c_str());
+  }
+}
+
+// Summarizes a file written by a program run with KLLVM_GC_CENSUS set, cf
+// runtime/collect/census.cpp.
+static int summarizeCensus(FILE *f, size_t numEntries) {
+  std::vector<census> censuses;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = 0;
+    if (line[0] == '#') {
+      censuses.emplace_back();
+      censuses.back().header = line + 2;
+      continue;
+    }
+    census_entry entry;
+    int nameOffset;
+    if (censuses.empty() || sscanf(line, "%lu\t%lu\t%n", &entry.objects, &entry.bytes, &nameOffset) != 2) {
+      fprintf(stderr, "invalid census line: %s\n", line);
+      return 1;
+    }
+    censuses.back().entries[line + nameOffset] = entry;
+  }
+  for (auto &c : censuses) {
+    std::vector<std::pair<std::string, census_entry>> entries(c.entries.begin(), c.entries.end());
+    census_entry total;
+    for (auto &entry : entries) {
+      total.objects += entry.second.objects;
+      total.bytes += entry.second.bytes;
+    }
+    printf("%s: %lu bytes in %lu objects\n", c.header.c_str(), total.bytes, total.objects);
+    printTopEntries(entries, total.bytes, numEntries);
+  }
+  if (censuses.size() < 2) {
+    return 0;
+  }
+  // the entries which grew the most between the first and the last census
+  auto &first = censuses.front().entries;
+  auto &last = censuses.back().entries;
+  std::vector<std::pair<std::string, census_entry>> growth;
+  uint64_t totalGrowth = 0;
+  for (auto &entry : last) {
+    auto before = first.find(entry.first);
+    census_entry grown = entry.second;
+    if (before != first.end()) {
+      if (before->second.bytes >= grown.bytes) {
+        continue;
+      }
+      grown.bytes -= before->second.bytes;
+      grown.objects = grown.objects > before->second.objects ? grown.objects - before->second.objects : 0;
+    }
+    totalGrowth += grown.bytes;
+    growth.emplace_back(entry.first, grown);
+  }
+  printf("growth from %s to %s: %lu bytes\n", censuses.front().header.c_str(), censuses.back().header.c_str(), totalGrowth);
+  printTopEntries(growth, totalGrowth, numEntries);
+  return 0;
+}
+
 int main (int argc, char **argv) {
-  const char *usage = "usage: %s [dump|analyze|generation|count] <file>"
-   " [<lower_bound> <upper_bound>]\n";
+  const char *usage = "usage: %s [dump|analyze|generation|count|alloc|dedup|large|summary|census] <file>"
+   " [<lower_bound> <upper_bound>|<entries>]\n";
   if (argc < 3) {
     fprintf(stderr, usage, argv[0]);
     return 1;
   }
   FILE *f = fopen(argv[2], "rb");
-  size_t frame[2049];
+  // `llvm-kompile-gc-stats summary` reads the telemetry written by programs
+  // run with KLLVM_GC_STATS set, rather than the log of a build with GC_DBG,
+  // and emits the number of collections, the percentiles of their pauses, the
+  // fraction of run time spent collecting, and the number of bytes copied and
+  // promoted.
+  if (strcmp(argv[1], "summary") == 0) {
+    return summary(f);
+  }
+  // `llvm-kompile-gc-stats census` reads the heap census written by programs
+  // run with KLLVM_GC_CENSUS set, and emits for each census the symbols and
+  // categories of objects with the most live bytes (20 by default, or the
+  // specified number of entries), followed by those whose live bytes grew the
+  // most between the first and the last census.
+  if (strcmp(argv[1], "census") == 0) {
+    return summarizeCensus(f, argc > 3 ? atoi(argv[3]) : 20);
+  }
+  size_t frame[2052];
   mpz_t total[2048];
   size_t step = 0;
   // `llvm-kompile-gc-stats dump` dumps the raw log to stdout. useful for
@@ -33,6 +190,16 @@ int main (int argc, char **argv) {
   // after each collection. This can be used to graph the allocation behavior
   // over time.
   bool alloc = strcmp(argv[1], "alloc") == 0;
+  // `llvm-kompile-gc-stats dedup` emits the number of bytes which each
+  // collection of a program run with KLLVM_GC_DEDUP=on did not copy into the
+  // old generation because it already had a copy of them, followed by the
+  // total over the life of the program.
+  bool dedup = strcmp(argv[1], "dedup") == 0;
+  // `llvm-kompile-gc-stats large` emits the number of bytes in the large-object
+  // space and the number of bytes of large objects freed at each collection.
+  bool large = strcmp(argv[1], "large") == 0;
+  mpz_t duplicates;
+  mpz_init(duplicates);
   if (analyze) {
     for (int i = 0; i < 2048; i++) {
       mpz_init(total[i]);
@@ -47,8 +214,8 @@ int main (int argc, char **argv) {
     mpz_init(size);
   }
   while(true) {
-    int ret = fread(frame, sizeof(size_t), 2049, f);
-    // the frame contains 2049 integers:
+    int ret = fread(frame, sizeof(size_t), 2052, f);
+    // the frame contains 2052 integers:
     //
     // frame[0] contains the total number of bytes allocated since the last
     // collection cycle
@@ -59,13 +226,25 @@ int main (int argc, char **argv) {
     //
     // frame[2048] contains the total number of bytes that survived
     // at least 2048 collection cycles that are alive at that point in time.
-    if (ret < 2049) break;
+    //
+    // frame[2049] contains the number of bytes of duplicate blocks that the
+    // collection did not copy into the old generation.
+    //
+    // frame[2050] contains the number of bytes in the large-object space after
+    // the collection.
+    //
+    // frame[2051] contains the number of bytes of large objects freed by the
+    // collection.
+    if (ret < 2052) break;
     if (dump) {
       printf("Collection %zd\n", step);
       for (int i = 0; i < 2048; i++) {
         printf("%d: %zd\n", i, frame[i]);
       }
       printf("saturated: %zd\n", frame[2048]);
+      printf("deduplicated: %zd\n", frame[2049]);
+      printf("large objects: %zd\n", frame[2050]);
+      printf("large objects freed: %zd\n", frame[2051]);
     } else if (analyze) {
       for (int i = 0; i < 2048; i++) {
         mpz_add_ui(total[i], total[i], frame[i]);
@@ -87,6 +266,11 @@ int main (int argc, char **argv) {
       gmp_printf("%zd: %Zd\n", step, size);
     } else if (alloc) {
       printf("%zd: %zd\n", step, frame[0]);
+    } else if (dedup) {
+      printf("%zd: %zd\n", step, frame[2049]);
+      mpz_add_ui(duplicates, duplicates, frame[2049]);
+    } else if (large) {
+      printf("%zd: %zd %zd\n", step, frame[2050], frame[2051]);
     } else if (!count) {
       fprintf(stderr, usage, argv[0]);
       return 1;
@@ -100,6 +284,8 @@ int main (int argc, char **argv) {
     gmp_printf("saturated: %Zd\n", total[2047]);
   } else if (count) {
     printf("%zd collections\n", step);
+  } else if (dedup) {
+    gmp_printf("total deduplicated: %Zd\n", duplicates);
   }
   return 0;
 }
@@ -0,0 +1,158 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kllvm/codegen/EmitConfigParser.h"
+#include "runtime/name_table.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace kllvm;
+
+namespace {
+
+// A name table emitted by emitNameTable, read back from the initializers of
+// the globals it emits.
+struct test_table {
+  std::vector<std::string> names;
+  std::vector<uint32_t> displacements;
+  std::vector<const char *> keys;
+  std::vector<uint32_t> values;
+  name_table table;
+
+  test_table(std::vector<std::string> names, uint64_t maxAttempts) : names(names) {
+    llvm::LLVMContext Ctx;
+    llvm::Module module("test", Ctx);
+    llvm::StructType::create(Ctx, {llvm::Type::getInt64Ty(Ctx), llvm::Type::getInt64Ty(Ctx), llvm::Type::getInt32PtrTy(Ctx), llvm::PointerType::getUnqual(llvm::Type::getInt8PtrTy(Ctx)), llvm::Type::getInt32PtrTy(Ctx)}, "name_table");
+    // the key of each name is a distinct global, from which its index is
+    // recovered
+    std::vector<NameTableEntry> entries;
+    std::map<llvm::Constant *, size_t> indices;
+    for (size_t i = 0; i < names.size(); i++) {
+      auto key = new llvm::GlobalVariable(module, llvm::Type::getInt8Ty(Ctx), true, llvm::GlobalValue::ExternalLinkage, nullptr, "key" + std::to_string(i));
+      entries.push_back({names[i], key, (uint32_t)i});
+      indices[key] = i;
+    }
+    auto global = llvm::cast<llvm::GlobalVariable>(emitNameTable("test_table", entries, &module, maxAttempts));
+    auto init = global->getInitializer();
+    uint64_t nkeys = field(init, 0);
+    uint64_t nbuckets = field(init, 1);
+    BOOST_REQUIRE_EQUAL(nkeys, names.size());
+    if (nbuckets) {
+      auto arr = array(init, 2);
+      for (uint64_t i = 0; i < nbuckets; i++) {
+        displacements.push_back(llvm::cast<llvm::ConstantInt>(arr->getAggregateElement(i))->getZExtValue());
+      }
+    } else {
+      BOOST_CHECK(llvm::isa<llvm::ConstantPointerNull>(init->getAggregateElement(2u)));
+    }
+    if (nkeys) {
+      auto keyArr = array(init, 3);
+      auto valueArr = array(init, 4);
+      for (uint64_t i = 0; i < nkeys; i++) {
+        keys.push_back(this->names[indices.at(keyArr->getAggregateElement(i))].c_str());
+        values.push_back(llvm::cast<llvm::ConstantInt>(valueArr->getAggregateElement(i))->getZExtValue());
+      }
+    }
+    table = {nkeys, nbuckets, displacements.data(), keys.data(), values.data()};
+  }
+
+private:
+  static uint64_t field(llvm::Constant *init, unsigned i) {
+    return llvm::cast<llvm::ConstantInt>(init->getAggregateElement(i))->getZExtValue();
+  }
+
+  // the initializer of the global array a field of the table points to
+  static llvm::Constant *array(llvm::Constant *init, unsigned i) {
+    return llvm::cast<llvm::GlobalVariable>(init->getAggregateElement(i)->stripPointerCasts())->getInitializer();
+  }
+};
+
+std::vector<uint64_t> hashNames(const std::vector<std::string> &names) {
+  std::vector<uint64_t> hashes;
+  for (auto &name : names) {
+    hashes.push_back(hash_name(name.c_str()));
+  }
+  return hashes;
+}
+
+std::vector<std::string> symbolNames(size_t n) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < n; i++) {
+    names.push_back("Lbl'Hash'sym" + std::to_string(i) + "{SortInt{}}");
+  }
+  return names;
+}
+
+void checkLookups(const test_table &t) {
+  for (size_t i = 0; i < t.names.size(); i++) {
+    uint32_t value;
+    BOOST_CHECK(name_table_lookup(&t.table, t.names[i].c_str(), &value));
+    BOOST_CHECK_EQUAL(value, i);
+  }
+  uint32_t value;
+  BOOST_CHECK(!name_table_lookup(&t.table, "", &value));
+  BOOST_CHECK(!name_table_lookup(&t.table, "Lbl'Hash'unknown{}", &value));
+  BOOST_CHECK(!name_table_lookup(&t.table, "Lbl'Hash'sym0{SortInt{}", &value));
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(NameTableTest)
+
+BOOST_AUTO_TEST_CASE(perfect) {
+  for (size_t n : {1, 2, 5, 100, 5000}) {
+    auto names = symbolNames(n);
+    test_table t(names, NAME_TABLE_ATTEMPTS_PER_KEY * n + NAME_TABLE_MIN_ATTEMPTS);
+    BOOST_CHECK(t.table.nbuckets > 0);
+    checkLookups(t);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(empty) {
+  test_table t({}, NAME_TABLE_MIN_ATTEMPTS);
+  uint32_t value;
+  BOOST_CHECK(!name_table_lookup(&t.table, "foo", &value));
+}
+
+BOOST_AUTO_TEST_CASE(same_bucket) {
+  // hashes whose high halves are equal all fall in the same bucket, which the
+  // displacements must still spread over distinct slots
+  auto names = symbolNames(8);
+  std::vector<uint64_t> hashes;
+  for (size_t i = 0; i < names.size(); i++) {
+    hashes.push_back((42ULL << 32) | i);
+  }
+  std::vector<uint32_t> displacements;
+  std::vector<int64_t> slots;
+  BOOST_CHECK(buildNameTable(hashes, 3, NAME_TABLE_MIN_ATTEMPTS, displacements, slots));
+  std::vector<bool> seen(names.size());
+  for (int64_t i : slots) {
+    BOOST_CHECK(i >= 0 && !seen[i]);
+    seen[i] = true;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(colliding) {
+  auto names = symbolNames(10);
+  auto hashes = hashNames(names);
+  hashes[7] = hashes[3];
+  std::vector<uint32_t> displacements;
+  std::vector<int64_t> slots;
+  BOOST_CHECK(!buildNameTable(hashes, 3, NAME_TABLE_MIN_ATTEMPTS, displacements, slots));
+}
+
+BOOST_AUTO_TEST_CASE(attempts) {
+  auto names = symbolNames(1000);
+  test_table t(names, 10);
+  BOOST_CHECK_EQUAL(t.table.nbuckets, 0);
+  checkLookups(t);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -31,7 +31,7 @@ extern "C" {
   void *koreAllocToken(size_t requested) {
     return malloc(requested);
   }
-  const size_t BLOCK_SIZE = -1;
+  size_t BLOCK_SIZE = -1;
 
   void printConfigurationInternal(writer *file, block *subject, const char *sort, bool) {}
   void sfprintf(writer *, const char *, ...) {}
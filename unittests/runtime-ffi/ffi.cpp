@@ -43,6 +43,8 @@ extern "C" {
     return blockheader {tag};
   }
 
+  const bool cache_term_hashes = false;
+
   void add_hash64(void*, uint64_t) {}
 
   size_t hash_k(block * kitem) {
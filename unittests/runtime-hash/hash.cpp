@@ -0,0 +1,83 @@
+#include<boost/test/unit_test.hpp>
+#include<gmp.h>
+
+#include <vector>
+
+#include "runtime/header.h"
+
+// A cons list of the symbol with tag 1 and layout 1, whose blocks end in the
+// word holding their cached hash.
+struct cons {
+  blockheader h;
+  block *next;
+  uint64_t hash;
+};
+
+static const uint64_t CONS_HDR = ((uint64_t)1 << LAYOUT_OFFSET) | ((sizeof(cons) / 8) << 32) | 1;
+static block *const NIL = (block *)(((uint64_t)2 << 32) | 1);
+
+extern "C" {
+  size_t hash_k(block *);
+
+  const bool cache_term_hashes = true;
+
+  static layoutitem cons_args[] = {{offsetof(cons, next), SYMBOL_LAYOUT}};
+  static layout cons_layout = {1, cons_args};
+  layout *const layout_table[] = {nullptr, &cons_layout};
+
+  static void hash_cons_children(block *b, void *h) {
+    k_hash(((cons *)b)->next, h);
+  }
+  void (*hash_table[])(block *, void *) = {nullptr, hash_cons_children};
+
+  void map_hash(map *, void *) {}
+  void list_hash(list *, void *) {}
+  void set_hash(set *, void *) {}
+  void int_hash(mpz_ptr, void *) {}
+  void float_hash(floating *, void *) {}
+  void map_foreach(map *, void(block **)) {}
+  void list_foreach(list *, void(block **)) {}
+  void set_foreach(set *, void(block **)) {}
+}
+
+static std::vector<cons> make_list(size_t length, block *last) {
+  std::vector<cons> cells(length);
+  for (size_t i = 0; i < length; i++) {
+    cells[i].h.hdr = CONS_HDR;
+    cells[i].next = i + 1 < length ? (block *)&cells[i + 1] : last;
+    cells[i].hash = 0;
+  }
+  return cells;
+}
+
+BOOST_AUTO_TEST_SUITE(HashTest)
+
+  // deep enough that hashing it recursively would overflow an 8MB stack
+  static const size_t DEPTH = 1000000;
+
+  BOOST_AUTO_TEST_CASE(deep_list) {
+    auto l1 = make_list(DEPTH, NIL);
+    auto l2 = make_list(DEPTH, NIL);
+    size_t h1 = hash_k((block *)&l1[0]);
+    BOOST_CHECK_EQUAL(h1, hash_k((block *)&l1[0]));
+    BOOST_CHECK_EQUAL(h1, hash_k((block *)&l2[0]));
+    BOOST_CHECK(l1[0].hash != 0);
+    BOOST_CHECK(l1[DEPTH - 1].hash != 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(deep_difference) {
+    auto l1 = make_list(DEPTH, NIL);
+    auto l2 = make_list(DEPTH, (block *)(((uint64_t)3 << 32) | 1));
+    BOOST_CHECK(hash_k((block *)&l1[0]) != hash_k((block *)&l2[0]));
+  }
+
+  BOOST_AUTO_TEST_CASE(shared_suffix) {
+    auto l1 = make_list(DEPTH, NIL);
+    size_t h1 = hash_k((block *)&l1[DEPTH / 2]);
+    size_t h2 = hash_k((block *)&l1[0]);
+    auto l2 = make_list(DEPTH, NIL);
+    BOOST_CHECK_EQUAL(h1, hash_k((block *)&l2[DEPTH / 2]));
+    BOOST_CHECK_EQUAL(h2, hash_k((block *)&l2[0]));
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
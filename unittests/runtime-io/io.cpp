@@ -30,10 +30,14 @@ extern "C" {
     return 0;
   }
   
+  // blocks are allocated by the size in their header, so make room for the
+  // children of the largest symbol above (systemResult)
   struct blockheader getBlockHeaderForSymbol(uint32_t tag) {
-    return blockheader {tag};
+    return blockheader {tag | ((uint64_t)4 << 32)};
   }
 
+  const bool cache_term_hashes = false;
+
   bool during_gc() { return false; }
 
   void add_hash64(void*, uint64_t) {}
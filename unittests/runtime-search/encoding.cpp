@@ -0,0 +1,297 @@
+#include<boost/test/unit_test.hpp>
+#include<gmp.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+
+#include "runtime/header.h"
+#include "runtime/term_encoding.h"
+
+// The symbol with tag 1 and layout 1, whose arguments are of every kind but
+// floats and string buffers.
+struct state {
+  blockheader h;
+  map m;
+  list l;
+  set s;
+  mpz_ptr i;
+  block *k;
+  bool b;
+  uint64_t mint;
+};
+
+// A cons list of the symbol with tag 2 and layout 2.
+struct cons {
+  blockheader h;
+  block *head;
+  block *tail;
+};
+
+static const uint16_t MINT64_LAYOUT = VARIABLE_LAYOUT + 1 + 64;
+static const uint64_t STATE_HDR = ((uint64_t)1 << LAYOUT_OFFSET) | ((sizeof(state) / 8) << 32) | 1;
+static const uint64_t CONS_HDR = ((uint64_t)2 << LAYOUT_OFFSET) | ((sizeof(cons) / 8) << 32) | 2;
+static block *const NIL = (block *)(((uint64_t)3 << 32) | 1);
+
+static bool equal(block *t1, block *t2);
+
+extern "C" {
+  size_t BLOCK_SIZE = 1024 * 1024;
+
+  const bool cache_term_hashes = false;
+
+  static layoutitem state_args[] = {
+    {offsetof(state, m), MAP_LAYOUT},
+    {offsetof(state, l), LIST_LAYOUT},
+    {offsetof(state, s), SET_LAYOUT},
+    {offsetof(state, i), INT_LAYOUT},
+    {offsetof(state, k), SYMBOL_LAYOUT},
+    {offsetof(state, b), BOOL_LAYOUT},
+    {offsetof(state, mint), MINT64_LAYOUT},
+  };
+  static layout state_layout = {7, state_args};
+  static layoutitem cons_args[] = {{offsetof(cons, head), SYMBOL_LAYOUT}, {offsetof(cons, tail), SYMBOL_LAYOUT}};
+  static layout cons_layout = {2, cons_args};
+  layout *const layout_table[] = {nullptr, &state_layout, &cons_layout};
+  const blockheader table_getBlockHeaderForSymbol[] = {{0}, {STATE_HDR}, {CONS_HDR}};
+
+  void *koreAlloc(size_t requested) {
+    return malloc(requested);
+  }
+
+  void *koreAllocToken(size_t requested) {
+    return malloc(requested);
+  }
+
+  mpz_ptr move_int(mpz_t i) {
+    mpz_ptr result = (mpz_ptr)malloc(sizeof(__mpz_struct));
+    *result = *i;
+    return result;
+  }
+
+  floating *move_float(floating *f) {
+    floating *result = (floating *)malloc(sizeof(floating));
+    *result = *f;
+    return result;
+  }
+
+  bool during_gc() {
+    return false;
+  }
+
+  size_t hash_k(block *term) {
+    if (is_leaf_block(term)) {
+      return (size_t)term;
+    }
+    if (!layout(term)) {
+      return std::hash<std::string>{}(std::string(((string *)term)->data, len(term)));
+    }
+    return tag_hdr(term->h.hdr);
+  }
+
+  bool hook_KEQUAL_eq(block *t1, block *t2) {
+    return equal(t1, t2);
+  }
+}
+
+static bool equal_args(block *t1, block *t2) {
+  layout *layoutData = get_layout_data(layout(t1));
+  for (unsigned i = 0; i < layoutData->nargs; i++) {
+    layoutitem *argData = layoutData->args + i;
+    void *arg1 = ((char *)t1) + argData->offset;
+    void *arg2 = ((char *)t2) + argData->offset;
+    switch(argData->cat) {
+    case MAP_LAYOUT: {
+      map *m1 = (map *)arg1, *m2 = (map *)arg2;
+      if (m1->size() != m2->size()) {
+        return false;
+      }
+      for (auto &entry : *m1) {
+        const KElem *value = m2->find(entry.first);
+        if (!value || !equal(entry.second, *value)) {
+          return false;
+        }
+      }
+      break;
+    }
+    case LIST_LAYOUT: {
+      list *l1 = (list *)arg1, *l2 = (list *)arg2;
+      if (l1->size() != l2->size()) {
+        return false;
+      }
+      for (auto iter1 = l1->begin(), iter2 = l2->begin(); iter1 != l1->end(); ++iter1, ++iter2) {
+        if (!equal(*iter1, *iter2)) {
+          return false;
+        }
+      }
+      break;
+    }
+    case SET_LAYOUT: {
+      set *s1 = (set *)arg1, *s2 = (set *)arg2;
+      if (s1->size() != s2->size()) {
+        return false;
+      }
+      for (auto &elem : *s1) {
+        if (!s2->count(elem)) {
+          return false;
+        }
+      }
+      break;
+    }
+    case INT_LAYOUT:
+      if (mpz_cmp(*(mpz_ptr *)arg1, *(mpz_ptr *)arg2)) {
+        return false;
+      }
+      break;
+    case SYMBOL_LAYOUT:
+    case VARIABLE_LAYOUT:
+      if (!equal(*(block **)arg1, *(block **)arg2)) {
+        return false;
+      }
+      break;
+    case BOOL_LAYOUT:
+      if (*(bool *)arg1 != *(bool *)arg2) {
+        return false;
+      }
+      break;
+    default: //mint
+      if (memcmp(arg1, arg2, mintBytes(argData->cat))) {
+        return false;
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+static bool equal(block *t1, block *t2) {
+  if (is_leaf_block(t1) || is_leaf_block(t2)) {
+    return t1 == t2;
+  }
+  if ((t1->h.hdr & HDR_MASK) != (t2->h.hdr & HDR_MASK)) {
+    return false;
+  }
+  if (!layout(t1)) {
+    return !memcmp(((string *)t1)->data, ((string *)t2)->data, len(t1));
+  }
+  return equal_args(t1, t2);
+}
+
+static block *token(const std::string &contents) {
+  string *result = (string *)koreAllocToken(sizeof(string) + contents.size());
+  set_len(result, contents.size());
+  memcpy(result->data, contents.data(), contents.size());
+  return (block *)result;
+}
+
+static block *make_cons(block *head, block *tail) {
+  cons *result = (cons *)koreAlloc(sizeof(cons));
+  result->h.hdr = CONS_HDR;
+  result->head = head;
+  result->tail = tail;
+  return (block *)result;
+}
+
+static mpz_ptr integer(const char *digits) {
+  mpz_t result;
+  mpz_init_set_str(result, digits, 10);
+  return move_int(result);
+}
+
+static state *make_state() {
+  state *result = (state *)koreAlloc(sizeof(state));
+  result->h.hdr = STATE_HDR;
+  new (&result->m) map();
+  new (&result->l) list();
+  new (&result->s) set();
+  result->i = integer("0");
+  result->k = NIL;
+  result->b = false;
+  result->mint = 0;
+  return result;
+}
+
+static block *round_trip(block *term) {
+  std::string encoding;
+  term_encoder(encoding).encode(term);
+  return term_decoder(encoding.data()).decode();
+}
+
+BOOST_AUTO_TEST_SUITE(EncodingTest)
+
+  BOOST_AUTO_TEST_CASE(constant) {
+    BOOST_CHECK_EQUAL(round_trip(NIL), NIL);
+  }
+
+  BOOST_AUTO_TEST_CASE(tokens) {
+    block *term = token("hello, \"world\"\n");
+    BOOST_CHECK(equal(round_trip(term), term));
+    block *variable = token("X");
+    variable->h.hdr |= VARIABLE_BIT;
+    block *decoded = round_trip(variable);
+    BOOST_CHECK(equal(decoded, variable));
+    BOOST_CHECK(decoded->h.hdr & VARIABLE_BIT);
+  }
+
+  BOOST_AUTO_TEST_CASE(collections) {
+    state *term = make_state();
+    term->m = term->m.set(token("a"), make_cons(token("b"), NIL));
+    term->m = term->m.set(NIL, token("c"));
+    for (int i = 0; i < 100; i++) {
+      term->l = term->l.push_back(token(std::to_string(i)));
+    }
+    term->s = term->s.insert(token("d"));
+    term->s = term->s.insert(make_cons(NIL, NIL));
+    term->i = integer("-123456789012345678901234567890");
+    term->k = make_cons(token("e"), make_cons(token("f"), NIL));
+    term->b = true;
+    term->mint = 0xdeadbeefcafef00dULL;
+    block *decoded = round_trip((block *)term);
+    BOOST_CHECK(equal(decoded, (block *)term));
+    BOOST_CHECK_EQUAL(((state *)decoded)->m.size(), 2);
+    BOOST_CHECK_EQUAL(((state *)decoded)->l.size(), 100);
+    BOOST_CHECK_EQUAL(((state *)decoded)->s.size(), 2);
+  }
+
+  BOOST_AUTO_TEST_CASE(empty_collections) {
+    state *term = make_state();
+    BOOST_CHECK(equal(round_trip((block *)term), (block *)term));
+  }
+
+  BOOST_AUTO_TEST_CASE(difference) {
+    state *term = make_state();
+    term->l = term->l.push_back(token("a"));
+    block *decoded = round_trip((block *)term);
+    ((state *)decoded)->l = ((state *)decoded)->l.set(0, token("b"));
+    BOOST_CHECK(!equal(decoded, (block *)term));
+  }
+
+  BOOST_AUTO_TEST_CASE(sharing) {
+    block *shared = make_cons(token("a"), NIL);
+    block *term = make_cons(shared, shared);
+    cons *decoded = (cons *)round_trip(term);
+    BOOST_CHECK(equal((block *)decoded, term));
+    BOOST_CHECK_EQUAL(decoded->head, decoded->tail);
+  }
+
+  // objects larger than a block, which the runtime allocates in the
+  // large-object space
+  BOOST_AUTO_TEST_CASE(large_objects) {
+    state *term = make_state();
+    term->k = token(std::string(2 * BLOCK_SIZE, 'x'));
+    mpz_t big;
+    mpz_init(big);
+    mpz_setbit(big, 16 * BLOCK_SIZE);
+    mpz_neg(big, big);
+    term->i = move_int(big);
+    for (int i = 0; i < 100000; i++) {
+      term->l = term->l.push_back(NIL);
+    }
+    block *decoded = round_trip((block *)term);
+    BOOST_CHECK(equal(decoded, (block *)term));
+    BOOST_CHECK_EQUAL(len(((state *)decoded)->k), 2 * BLOCK_SIZE);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -53,6 +53,10 @@ extern "C" {
   }
 
   void add_hash64(void*, uint64_t) {}
+
+  bool during_gc() {
+    return false;
+  }
 }
 
 BOOST_AUTO_TEST_SUITE(StringTest)